@@ -0,0 +1,524 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+/** Benchmarks of the reconstruction hot paths on synthetic events.
+ *
+ * Usage: trec_bench [--events N] [--threads N] [--min-time S]
+ *                   [--filter NAME] [--json FILE]
+ *
+ * Each benchmark processes the whole dataset, repetitions run until
+ * the minimum time is reached and the best repetition is reported.
+ * Results are printed as a table and written as JSON (events/s and
+ * ns/event of each benchmark) to compare commits.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <unistd.h>
+
+#include "trec_system_configure.hh"
+#include "trec_hits_positions.hh"
+#include "trec_track_coordinates.hh"
+#include "trec_strip_digitizer.hh"
+#ifdef TREC_USE_ROOT
+#include "trec_tracks_reconstruction.hh"
+#endif
+#include "trec_online_reconstruction.hh"
+#include "trec_pipeline.hh"
+#include "trec_ring_buffer.hh"
+#include "trec_event_generator.hh"
+#include "trec_parallel.hh"
+
+using namespace TREC;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/** Benchmark options
+ */
+struct Options {
+	Options()
+		:
+		events(100000),
+		threads(0),
+		min_time(0.5),
+		json("trec_bench.json")
+	{
+	}
+
+	size_t events;
+	unsigned int threads;
+	double min_time; // minimum time of the benchmark (s)
+	std::string filter;
+	std::string json;
+};
+
+/** Result of one benchmark
+ */
+struct Result {
+	std::string name;
+	std::string type; // "micro" or "macro"
+	size_t events; // events of one repetition
+	int repetitions;
+	double seconds; // best repetition time
+};
+
+/** Synthetic dataset: events and their tracks
+ */
+struct Dataset {
+	HitsPositionsVector hits;
+	MainTracksVector main;
+	FullTracksVector full;
+};
+
+/** Result sink, keeps the compiler from removing benchmarked code
+ */
+volatile double sink = 0.0;
+
+/** Hits vector of the plane crossed at the coordinate
+ */
+HitsVector
+plane_hits( StripGeometryType type, double u, int width)
+{
+	const StripGeometry* g = StripGeometry::get(type);
+	const PlaneTransform* t = StripGeometry::transform(type);
+
+	HitsVector hits( g->strips, false);
+	int strip = int(std::floor((t->sign * u - t->origin) / t->pitch + 0.5));
+	for ( int i = strip; i < strip + width; ++i) {
+		if (i >= 0 && i < g->strips)
+			hits[i] = true;
+	}
+	return hits;
+}
+
+/** Step phantom: polystyrene step of half the image
+ */
+ThicknessMap
+phantom()
+{
+	ThicknessMap object(ImageBinning( -30.0, 30.0, -30.0, 30.0,
+		TREC_BINS_X, TREC_BINS_Y));
+	for ( int j = 0; j < TREC_BINS_Y; ++j) {
+		for ( int i = TREC_BINS_X / 2; i < TREC_BINS_X; ++i)
+			object.values[j * TREC_BINS_X + i] = 20.0f; // mm
+	}
+	return object;
+}
+
+/** Generate events of the step phantom and find their tracks
+ */
+void
+generate( const EventGenerator& generator, size_t events,
+	unsigned int threads, Dataset& data)
+{
+	data.hits.clear();
+	generator.generate( events, data.hits, 20130501, threads);
+
+	data.main.clear();
+	data.full.clear();
+	for ( size_t i = 0; i < data.hits.size(); ++i) {
+		TrackCoordinates coords(data.hits[i]);
+		bool main, full;
+		coords.calculate_tracks( main, full);
+		if (!main || !full)
+			continue;
+
+		TrackXYPair track_main, track_full;
+		coords.get_tracks( track_main, track_full);
+		data.main.push_back(track_main);
+		data.full.push_back(std::make_pair( track_full,
+			data.hits[i].calorimeter_position()));
+	}
+}
+
+/** Run benchmark until the minimum time
+ * @param func - benchmark, processes the dataset once and returns
+ * number of processed events
+ */
+template<class Function>
+Result
+measure( const std::string& name, const std::string& type,
+	const Options& options, Function func)
+{
+	Result result;
+	result.name = name;
+	result.type = type;
+	result.events = 0;
+	result.repetitions = 0;
+	result.seconds = 0.0;
+
+	double total = 0.0;
+	while (result.repetitions < 1 || total < options.min_time) {
+		Clock::time_point start = Clock::now();
+		size_t events = func();
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+
+		if (!result.repetitions || elapsed.count() < result.seconds)
+			result.seconds = elapsed.count();
+		result.events = events;
+		result.repetitions++;
+		total += elapsed.count();
+	}
+	return result;
+}
+
+/** Measure benchmark if it matches the filter
+ */
+template<class Function>
+void
+run( std::vector<Result>& results, const Options& options,
+	const std::string& name, const std::string& type, Function func)
+{
+	if (options.filter.empty() || name.find(options.filter) != std::string::npos)
+		results.push_back(measure( name, type, options, func));
+}
+
+double
+events_per_second(const Result& r)
+{
+	return (r.seconds > 0.0) ? r.events / r.seconds : 0.0;
+}
+
+double
+ns_per_event(const Result& r)
+{
+	return r.events ? r.seconds * 1e9 / r.events : 0.0;
+}
+
+void
+print( std::ostream& out, const std::vector<Result>& results)
+{
+	out << std::left << std::setw(32) << "benchmark" << std::right;
+	out << std::setw(8) << "type" << std::setw(12) << "events";
+	out << std::setw(16) << "events/s" << std::setw(14) << "ns/event";
+	out << std::endl;
+
+	for ( size_t i = 0; i < results.size(); ++i) {
+		const Result& r = results[i];
+		out << std::left << std::setw(32) << r.name << std::right;
+		out << std::setw(8) << r.type << std::setw(12) << r.events;
+		out << std::setw(16) << std::fixed << std::setprecision(0);
+		out << events_per_second(r);
+		out << std::setw(14) << std::setprecision(1) << ns_per_event(r);
+		out << std::endl;
+	}
+}
+
+bool
+save_json( const char* filename, const Options& options,
+	const std::vector<Result>& results)
+{
+	std::ofstream out(filename);
+	if (!out.is_open()) {
+		std::cerr << "Can't open benchmark results file " << filename << std::endl;
+		return false;
+	}
+
+	out << "{" << std::endl;
+	out << "  \"benchmark\": \"trec_bench\"," << std::endl;
+	out << "  \"events\": " << options.events << "," << std::endl;
+	out << "  \"threads\": " << worker_threads(options.threads) << "," << std::endl;
+	out << "  \"stations\": " << TREC_NUMBER_OF_STATIONS << "," << std::endl;
+	out << "  \"results\": [" << std::endl;
+	out.precision(10);
+	for ( size_t i = 0; i < results.size(); ++i) {
+		const Result& r = results[i];
+		out << "    {\"name\": \"" << r.name << "\", \"type\": \"" << r.type;
+		out << "\", \"events\": " << r.events;
+		out << ", \"repetitions\": " << r.repetitions;
+		out << ", \"seconds\": " << r.seconds;
+		out << ", \"events_per_second\": " << events_per_second(r);
+		out << ", \"ns_per_event\": " << ns_per_event(r) << "}";
+		out << ((i + 1 < results.size()) ? "," : "") << std::endl;
+	}
+	out << "  ]" << std::endl;
+	out << "}" << std::endl;
+
+	return out.good();
+}
+
+bool
+parse( int argc, char** argv, Options& options)
+{
+	for ( int i = 1; i < argc; ++i) {
+		std::string arg(argv[i]);
+		if (i + 1 >= argc) {
+			std::cerr << "Missing value of " << arg << std::endl;
+			return false;
+		}
+
+		std::istringstream value(argv[++i]);
+		if (arg == "--events")
+			value >> options.events;
+		else if (arg == "--threads")
+			value >> options.threads;
+		else if (arg == "--min-time")
+			value >> options.min_time;
+		else if (arg == "--filter")
+			value >> options.filter;
+		else if (arg == "--json")
+			value >> options.json;
+		else {
+			std::cerr << "Unknown option " << arg << std::endl;
+			return false;
+		}
+
+		if (value.fail()) {
+			std::cerr << "Wrong value of " << arg << std::endl;
+			return false;
+		}
+	}
+	return options.events > 0;
+}
+
+} // namespace
+
+int
+main( int argc, char** argv)
+{
+	Options options;
+	if (!parse( argc, argv, options)) {
+		std::cerr << "Usage: " << argv[0] << " [--events N] [--threads N]";
+		std::cerr << " [--min-time S] [--filter NAME] [--json FILE]" << std::endl;
+		return 1;
+	}
+
+	SharedConf conf = SystemConfigure::instance("");
+	unsigned int threads = worker_threads(options.threads);
+
+	EventGenerator generator( GeneratorParameters(), phantom(), conf);
+
+	Dataset data;
+	generate( generator, options.events, threads, data);
+	const HitsPositionsVector& hits = data.hits;
+	size_t n = hits.size();
+
+	// inputs of the clusters and tracks fits benchmarks
+	std::vector<HitsVector> planes(n);
+	for ( size_t i = 0; i < n; ++i)
+		planes[i] = plane_hits( MSD_X1, (i % 500) * 0.1 - 25.0, 1 + i % 3);
+
+	std::vector<double> points( n * 5);
+	FastRandom random(1);
+	for ( size_t i = 0; i < points.size(); ++i)
+		points[i] = 0.1 * random.gauss();
+	double z[5] = { -50.0, 300.0, 1300.0, 1340.0, 1400.0 };
+	double w[5] = { 57.735e-3, 94.0e-3, 1.0, 1.0, 1.0 };
+
+	char filename[] = "/tmp/trec_bench_XXXXXX";
+	int fd = mkstemp(filename);
+	if (fd == -1) {
+		std::cerr << "Can't create temporary file" << std::endl;
+		return 1;
+	}
+	close(fd);
+	HitsPositions::save( filename, hits);
+
+	std::vector<Result> results;
+
+	// micro-benchmarks
+
+	run( results, options, "event_generator", "micro", [&]() -> size_t {
+		HitsPositionsVector generated;
+		generator.generate( n, generated, 1, 1);
+		return generated.size();
+	});
+
+	run( results, options, "hits_save", "micro", [&]() -> size_t {
+		HitsPositions::save( filename, hits);
+		return n;
+	});
+
+	run( results, options, "hits_load", "micro", [&]() -> size_t {
+		HitsPositionsVector loaded;
+		HitsPositions::load( filename, loaded);
+		sink = sink + loaded.size();
+		return loaded.size();
+	});
+
+	run( results, options, "calorimeter_position", "micro", [&]() -> size_t {
+		long sum = 0;
+		for ( size_t i = 0; i < n; ++i)
+			sum += hits[i].calorimeter_position();
+		sink = sink + sum;
+		return n;
+	});
+
+	run( results, options, "check_one_cluster", "micro", [&]() -> size_t {
+		long sum = 0;
+		HitsVector::const_iterator begin, end;
+		for ( size_t i = 0; i < n; ++i)
+			sum += TrackCoordinates::check_one_cluster( planes[i], begin, end);
+		sink = sink + sum;
+		return n;
+	});
+
+	run( results, options, "track_coordinates", "micro", [&]() -> size_t {
+		long sum = 0;
+		for ( size_t i = 0; i < n; ++i) {
+			TrackCoordinates coords(hits[i]);
+			bool main, full;
+			coords.calculate_tracks( main, full);
+			sum += full;
+		}
+		sink = sink + sum;
+		return n;
+	});
+
+	run( results, options, "track_create_unrolled", "micro", [&]() -> size_t {
+		double sum = 0.0;
+		for ( size_t i = 0; i < n; ++i) {
+			double f[3] = { points[5 * i], points[5 * i + 1], points[5 * i + 2] };
+			sum += Track::create( z, f, w, 3).a();
+		}
+		sink = sink + sum;
+		return n;
+	});
+
+	run( results, options, "track_create_gsl", "micro", [&]() -> size_t {
+		double sum = 0.0;
+		for ( size_t i = 0; i < n; ++i)
+			sum += Track::create( z, &points[5 * i], w, 5).a();
+		sink = sink + sum;
+		return n;
+	});
+
+	run( results, options, "track_create_ccmath", "micro", [&]() -> size_t {
+		double sum = 0.0;
+		for ( size_t i = 0; i < n; ++i) {
+			double f[3] = { points[5 * i], points[5 * i + 1], points[5 * i + 2] };
+			sum += Track::create( z, f, 3).a();
+		}
+		sink = sink + sum;
+		return n;
+	});
+
+	run( results, options, "track_fit", "micro", [&]() -> size_t {
+		double sum = 0.0;
+		for ( size_t i = 0; i < data.full.size(); ++i)
+			sum += data.full[i].first.first.fit(800.0);
+		sink = sink + sum;
+		return data.full.size();
+	});
+
+	run( results, options, "strip_digitizer", "micro", [&]() -> size_t {
+		// 10 steps of the ion in each plane
+		StripDigitizer digitizer;
+		HitsPositions event;
+		long sum = 0;
+		for ( size_t i = 0; i < n; ++i) {
+			double x = 50.0 * points[5 * i], y = 50.0 * points[5 * i + 1];
+			for ( int plane = 0; plane < TREC_NUMBER_OF_SILICON_DETECTORS; ++plane)
+				for ( int k = 0; k < 10; ++k)
+					digitizer.add( plane, x + 0.01 * k, y, 0.0084);
+			digitizer.digitize(event);
+			sum += event.record_size();
+		}
+		sink = sink + sum;
+		return n;
+	});
+
+	// macro-benchmarks
+
+	run( results, options, "event_generator_parallel", "macro", [&]() -> size_t {
+		HitsPositionsVector generated;
+		generator.generate( n, generated, 1, threads);
+		return generated.size();
+	});
+
+	run( results, options, "tracks_parallel", "macro", [&]() -> size_t {
+		std::vector<long> full( threads, 0);
+		parallel_for( n, threads,
+			[&]( size_t begin, size_t end, unsigned int t) {
+			for ( size_t i = begin; i < end; ++i) {
+				TrackCoordinates coords(hits[i]);
+				bool main_ok, full_ok;
+				coords.calculate_tracks( main_ok, full_ok);
+				full[t] += full_ok;
+			}
+		});
+		for ( unsigned int t = 0; t < threads; ++t)
+			sink = sink + full[t];
+		return n;
+	});
+
+	run( results, options, "online_reconstruction", "macro", [&]() -> size_t {
+		OnlineReconstruction online( ImageBinning( -30.0, 30.0, -30.0, 30.0,
+			TREC_BINS_X, TREC_BINS_Y), 100, 250, conf);
+		online.add_tracks(data.full);
+		sink = sink + online.entries();
+		return data.full.size();
+	});
+
+	run( results, options, "pipeline", "macro", [&]() -> size_t {
+		OnlineReconstruction online( ImageBinning( -30.0, 30.0, -30.0, 30.0,
+			TREC_BINS_X, TREC_BINS_Y), 100, 250, conf);
+		PipelineOptions pipeline_options;
+		pipeline_options.threads[PIPELINE_CLUSTER] = std::max( threads / 2, 1u);
+		pipeline_options.threads[PIPELINE_FIT] = std::max( threads / 2, 1u);
+		Pipeline pipeline( online, pipeline_options);
+		PipelineReport report = pipeline.run(filename);
+		sink = sink + online.entries();
+		return report.events;
+	});
+
+	std::string ring_name = "/trec_bench_" + std::to_string(getpid());
+	run( results, options, "ring_pipeline", "macro", [&]() -> size_t {
+		RingReader ring(ring_name.c_str());
+		OnlineReconstruction online( ImageBinning( -30.0, 30.0, -30.0, 30.0,
+			TREC_BINS_X, TREC_BINS_Y), 100, 250, conf);
+		Pipeline pipeline(online);
+		std::thread producer( [&]() {
+			produce_events( ring_name.c_str(), generator, options.events);
+		});
+		PipelineReport report = pipeline.run(ring);
+		producer.join();
+		sink = sink + online.entries() + report.latency_mean;
+		return report.events;
+	});
+
+#ifdef TREC_USE_ROOT
+	run( results, options, "tracks_reconstruction", "macro", [&]() -> size_t {
+		TracksReconstruction rec( data.main, data.full, -30.0, 30.0,
+			-30.0, 30.0, TREC_BINS_X, TREC_BINS_Y, conf);
+		rec.reconstruct( 100, 250, 250);
+		return data.full.size();
+	});
+#endif
+
+	std::remove(filename);
+
+	print( std::cout, results);
+	if (!options.json.empty() && !save_json( options.json.c_str(), options, results))
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "trec_strip_geometry.hh"
+#include "trec_hits_positions.hh"
+
+namespace TREC {
+
+/** Alignment statistics of one iteration
+ */
+struct AlignmentReport {
+	int iteration;
+	size_t tracks; // tracks used in the fit
+	double rms; // RMS of residuals before the iteration (mm)
+	double correction; // maximum shift correction of the iteration (mm)
+	double seconds; // wall time of the iteration
+};
+typedef std::vector<AlignmentReport> AlignmentReportsVector;
+
+/** Class Alignment fits shifts and in-plane rotations of the detector
+ * planes using residuals of tracks.
+ *
+ * The first two stations (XY1, XY2) are the reference: main track
+ * of an event predicts coordinates on the aligned planes. The residual
+ * on X plane is modeled as r = shift + rotation * y, on Y plane as
+ * r = shift - rotation * x. Normal equations of all aligned planes are
+ * accumulated by several threads, then the small global system is
+ * solved. Coordinates of events are extracted once and cached, so an
+ * iteration is a pass over flat arrays: the solved corrections are
+ * applied to the cached coordinates and the fit is repeated.
+ */
+class Alignment {
+public:
+	/** Constructor
+	 * @param planes - aligned planes (X3 and Y3 by default)
+	 * @param max_residual - residuals above are outliers (mm)
+	 */
+	Alignment( const std::vector<StripGeometryType>& planes =
+		std::vector<StripGeometryType>(), double max_residual = 3.0);
+
+	/** Extract and cache coordinates of events which have hits
+	 * on the reference and all aligned planes
+	 * @param hits - events
+	 * @param threads - number of threads, 0 for all hardware threads
+	 * @return number of added tracks
+	 */
+	size_t add_events( const HitsPositionsVector& hits,
+		unsigned int threads = 0);
+
+	/** Number of cached tracks
+	 */
+	size_t tracks() const { return z_.empty() ? 0 : ref_[0].size(); }
+
+	/** One alignment iteration
+	 * @param threads - number of threads, 0 for all hardware threads
+	 * @return <tt>true</tt> if the system is solved, <tt>false</tt> otherwise
+	 */
+	bool iterate(unsigned int threads = 0);
+
+	/** Iterate until the maximum shift correction is below tolerance
+	 * @param iterations - maximum number of iterations
+	 * @param tolerance - shift tolerance (mm)
+	 * @param threads - number of threads, 0 for all hardware threads
+	 * @return <tt>true</tt> if converged, <tt>false</tt> otherwise
+	 */
+	bool solve( int iterations = 10, double tolerance = 1e-4,
+		unsigned int threads = 0);
+
+	/** Total corrections of the plane
+	 * @param type - aligned plane
+	 * @param shift - returns shift of the coordinate (mm)
+	 * @param rotation - returns in-plane rotation (rad)
+	 * @return <tt>true</tt> if the plane is aligned, <tt>false</tt> otherwise
+	 */
+	bool corrections( StripGeometryType type, double& shift,
+		double& rotation) const;
+
+	/** Apply corrections to the strip geometry of the first
+	 * add_events() call, repeated calls set the same geometry
+	 */
+	void apply() const;
+
+	/** Save the current strip geometry in StripGeometry::load format,
+	 * corrections are written after apply()
+	 * @param filename - name of the file
+	 * @return <tt>true</tt> on success, <tt>false</tt> otherwise
+	 */
+	bool save(const char* filename) const;
+
+	/** Reports of all iterations
+	 */
+	const AlignmentReportsVector& reports() const { return reports_; }
+
+private:
+	std::vector<StripGeometryType> planes_;
+	double max_residual_;
+	std::vector<double> z_; // aligned planes positions
+	double ref_z_[4]; // X1, Y1, X2, Y2 positions
+	std::vector<double> ref_[4]; // X1, Y1, X2, Y2 coordinates of tracks
+	std::vector< std::vector<double> > u_; // aligned planes coordinates
+	std::vector<double> shift_;
+	std::vector<double> rotation_;
+	std::vector<StripGeometry> base_; // aligned planes geometry of
+		// the cached coordinates, corrections are relative to it
+	AlignmentReportsVector reports_;
+};
+
+} // namespace TREC
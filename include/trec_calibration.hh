@@ -0,0 +1,160 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include "trec_hits_positions.hh"
+
+namespace TREC {
+
+/** Calibration point: bregg peak position for the clear beam energy
+ * or for the object thickness
+ */
+struct CalibrationPoint {
+	double value; // energy (MeV/u) or thickness (cm)
+	double position; // calorimeter slice + 1
+};
+typedef std::vector<CalibrationPoint> CalibrationPointsVector;
+
+/** Calibration tables of the energy and thickness models.
+ * Calorimeter slice = 1.5 mm, object is G4_POLYSTYRENE,
+ * thickness points are measured at the configuration beam energy.
+ */
+struct CalibrationData {
+	CalibrationPointsVector ps_energy; // G4_POLYSTYRENE calorimeter
+	CalibrationPointsVector water_energy; // G4_WATER calorimeter
+	CalibrationPointsVector ps_thickness; // G4_POLYSTYRENE calorimeter
+	CalibrationPointsVector water_thickness; // G4_WATER calorimeter
+
+	/** Check if the tables are enough for the models
+	 * @return <tt>true</tt> if the energy tables have at least three
+	 * points and the thickness table has at least two points
+	 */
+	bool valid() const;
+
+	/** Save calibration into binary file
+	 * @param filename - name of the file
+	 * @return <tt>true</tt> on success, <tt>false</tt> otherwise
+	 */
+	bool save(const char* filename) const;
+
+	/** Load calibration from binary file
+	 * @param filename - name of the file
+	 * @return <tt>true</tt> on success, <tt>false</tt> if file can't be
+	 * opened or it isn't a valid calibration file
+	 */
+	bool load(const char* filename);
+
+	/** Built-in calibration (Geant4 simulation of the setup)
+	 */
+	static CalibrationData builtin();
+};
+
+/** Calibration run type
+ */
+enum CalibrationRunType {
+	CALIBRATION_ENERGY, // clear beam of the known energy
+	CALIBRATION_THICKNESS // object of the known thickness
+};
+
+/** Calibration run: hits file and its fitted bregg peak
+ */
+struct CalibrationRun {
+	std::string filename; // hits file
+	CalibrationRunType type;
+	double value; // energy (MeV/u) or thickness (cm)
+	bool water; // G4_WATER calorimeter
+	double peak; // fitted bregg peak position (calorimeter slice + 1)
+	size_t events; // number of events with calorimeter hits
+	bool loaded; // hits file is read
+	bool ok; // peak is found
+};
+typedef std::vector<CalibrationRun> CalibrationRunsVector;
+
+/** Class CalibrationFit derives calibration tables from calibration runs.
+ * Bregg peak position of each run is fitted from the calorimeter
+ * profile of its events, runs are processed in parallel. Then the
+ * energy and thickness models are checked and the calibration tables
+ * are formed. Result is saved into binary file, which is loaded by
+ * SystemConfigure.
+ */
+class CalibrationFit {
+public:
+	/** Constructor
+	 */
+	CalibrationFit();
+
+	/** Add calibration run
+	 * @param filename - hits file of the run
+	 * @param type - run type
+	 * @param value - beam energy (MeV/u) or object thickness (cm)
+	 * @param water - <tt>true</tt> for G4_WATER calorimeter
+	 */
+	void add_run( const char* filename, CalibrationRunType type,
+		double value, bool water = false);
+
+	/** Fit bregg peaks of all runs and form calibration tables
+	 * @param threads - number of threads, 0 for all hardware threads
+	 * @return <tt>true</tt> if calibration is valid,
+	 * <tt>false</tt> otherwise
+	 */
+	bool fit(unsigned int threads = 0);
+
+	/** Runs with fitted peaks
+	 */
+	const CalibrationRunsVector& runs() const { return runs_; }
+
+	/** Calibration tables
+	 */
+	const CalibrationData& data() const { return data_; }
+
+	/** Linear thickness model of the polystyrene calorimeter:
+	 * position = intercept + slope * thickness
+	 * @param intercept - returns position of zero thickness
+	 * @param slope - returns positions per cm
+	 * @return <tt>true</tt> if the fit is done, <tt>false</tt> otherwise
+	 */
+	bool thickness_model( double& intercept, double& slope) const;
+
+	/** Save calibration into binary file
+	 * @param filename - name of the file
+	 * @return <tt>true</tt> on success, <tt>false</tt> otherwise
+	 */
+	bool save(const char* filename) const;
+
+	/** Fit bregg peak position of the calorimeter profile: maximum
+	 * of the stop slice distribution refined by parabola
+	 * @param hits - events of the run
+	 * @param events - returns number of events with calorimeter hits
+	 * @return peak position (calorimeter slice + 1), -1 if there are
+	 * no events with calorimeter hits
+	 */
+	static double bragg_peak( const HitsPositionsVector& hits, size_t& events);
+
+private:
+	CalibrationRunsVector runs_;
+	CalibrationData data_;
+	double intercept_;
+	double slope_;
+};
+
+} // namespace TREC
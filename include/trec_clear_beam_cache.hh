@@ -0,0 +1,188 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include "trec_hits_positions.hh"
+#include "trec_system_configure.hh"
+
+namespace TREC {
+
+/** Class ClearBeamCache keeps per-slice PSET tables of the beam
+ * energies of a run. The clear bregg peak positions of all new
+ * energies of a batch are evaluated at once, then each table is
+ * built once per distinct energy. A mixed-energy run costs about
+ * the same as a single-energy one: PSET of a track is a table lookup.
+ *
+ * prepare() modifies the cache, PSET() is read only and can be called
+ * from several threads between prepare() calls.
+ */
+class ClearBeamCache {
+public:
+	/** Constructor
+	 * @param conf - calibration configuration
+	 */
+	ClearBeamCache(SharedConf conf = SystemConfigure::instance());
+
+	/** Build tables of the energies of the events which are not cached yet
+	 * @param tags - event tags
+	 */
+	void prepare(const EventTagsVector& tags);
+
+	/** Build tables of the energies which are not cached yet
+	 * @param energies - beam energies (MeV/u)
+	 */
+	void prepare(const std::vector<double>& energies);
+
+	/** Check if tables of all energies of the events are built
+	 * @param tags - event tags
+	 * @return <tt>true</tt> if prepare(tags) wouldn't modify the cache,
+	 * <tt>false</tt> otherwise
+	 */
+	bool prepared(const EventTagsVector& tags) const;
+
+	/** Polystyrene equivalent thickness
+	 * @param slice - calorimeter slice
+	 * @param energy - beam energy (MeV/u), 0 for the configuration energy
+	 * @return PSET (cm)
+	 */
+	double PSET( int slice, double energy) const;
+
+	/** Polystyrene equivalent thickness, linear interpolation between
+	 * slices for the sub-slice stop position
+	 * @param slice - calorimeter stop position
+	 * @param energy - beam energy (MeV/u), 0 for the configuration energy
+	 * @return PSET (cm)
+	 */
+	double PSET( double slice, double energy) const;
+
+	/** Polystyrene equivalent thickness of the event: sub-slice stop
+	 * position of the tag if it has calorimeter deposits, the slice
+	 * otherwise, at the beam energy of the tag
+	 * @param slice - calorimeter slice
+	 * @param tag - event tag
+	 * @return PSET (cm)
+	 */
+	double PSET( int slice, const EventTag& tag) const;
+
+	/** Stop position at the configuration energy with the same PSET,
+	 * the energy shifts the clear bregg peak by a slice offset
+	 * @param slice - calorimeter stop position
+	 * @param energy - beam energy (MeV/u), 0 for the configuration energy
+	 * @return stop position (slice)
+	 */
+	double equivalent_slice( double slice, double energy) const;
+
+	/** Stop position of the event at the configuration energy, see
+	 * PSET( int, const EventTag&)
+	 * @param slice - calorimeter slice
+	 * @param tag - event tag
+	 * @return stop position (slice)
+	 */
+	double equivalent_slice( int slice, const EventTag& tag) const;
+
+	/** Number of cached energies
+	 */
+	size_t energies() const { return tables_.size(); }
+
+	/** Remove all tables
+	 */
+	void clear() { tables_.clear(); offsets_.clear(); }
+
+private:
+	typedef std::map< double, std::vector<double> > TablesMap;
+	typedef std::map< double, double> OffsetsMap;
+
+	SharedConf conf_;
+	double clear_reference_; // clear bregg peak of the configuration energy
+	TablesMap tables_;
+	OffsetsMap offsets_; // slice offsets of the energies
+};
+
+inline
+double
+ClearBeamCache::PSET( int slice, double energy) const
+{
+	if (energy == 0.0)
+		return conf_->PSET(slice);
+
+	TablesMap::const_iterator iter = tables_.find(energy);
+	if (iter == tables_.end() || slice < 0 ||
+		slice >= int(iter->second.size()))
+		return conf_->PSET( slice, energy);
+
+	return iter->second[slice];
+}
+
+inline
+double
+ClearBeamCache::PSET( double slice, double energy) const
+{
+	if (energy == 0.0)
+		return conf_->PSET(slice);
+
+	TablesMap::const_iterator iter = tables_.find(energy);
+	if (iter == tables_.end() || slice < 0.0 ||
+		slice > iter->second.size() - 1.0)
+		return conf_->PSET( slice, energy);
+
+	const std::vector<double>& table = iter->second;
+	size_t i = static_cast<size_t>(slice);
+	if (i + 1 >= table.size())
+		return table.back();
+
+	return table[i] + (slice - i) * (table[i + 1] - table[i]);
+}
+
+inline
+double
+ClearBeamCache::PSET( int slice, const EventTag& tag) const
+{
+	return (tag.calorimeter_peak >= 0.0f) ?
+		PSET( double(tag.calorimeter_peak), tag.energy) :
+		PSET( slice, tag.energy);
+}
+
+inline
+double
+ClearBeamCache::equivalent_slice( double slice, double energy) const
+{
+	if (energy == 0.0)
+		return slice;
+
+	OffsetsMap::const_iterator iter = offsets_.find(energy);
+	if (iter == offsets_.end())
+		return slice + clear_reference_ - conf_->clear_position(energy);
+
+	return slice + iter->second;
+}
+
+inline
+double
+ClearBeamCache::equivalent_slice( int slice, const EventTag& tag) const
+{
+	return (tag.calorimeter_peak >= 0.0f) ?
+		equivalent_slice( double(tag.calorimeter_peak), tag.energy) :
+		equivalent_slice( double(slice), tag.energy);
+}
+
+} // namespace TREC
@@ -19,7 +19,12 @@
 
 #pragma once
 
-#define TREC_NUMBER_OF_SILICON_DETECTORS 8
+// XY tracking stations, 3 or 4
+#ifndef TREC_NUMBER_OF_STATIONS
+#define TREC_NUMBER_OF_STATIONS 3
+#endif
+// XY stations planes and U, V planes
+#define TREC_NUMBER_OF_SILICON_DETECTORS (2 * TREC_NUMBER_OF_STATIONS + 2)
 #define TREC_BINS_X 60
 #define TREC_BINS_Y 60
 
@@ -0,0 +1,207 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+
+#include "trec_hits_positions.hh"
+#include "trec_reconstruction_image.hh"
+#include "trec_system_configure.hh"
+
+namespace TREC {
+
+/** Xorshift128+ pseudo random numbers generator
+ */
+class FastRandom {
+public:
+	/** Constructor
+	 * @param seed - seed, any value (zero too)
+	 */
+	explicit FastRandom(uint64_t seed = 1);
+
+	/** Next 64 bits random value
+	 */
+	uint64_t next();
+
+	/** Uniform random value in [0, 1)
+	 */
+	double uniform();
+
+	/** Normal random value (mean 0, sigma 1)
+	 */
+	double gauss();
+
+private:
+	uint64_t s0_;
+	uint64_t s1_;
+	double spare_; // second value of the Box-Muller pair
+	bool has_spare_;
+};
+
+/** Object thickness map: polystyrene equivalent thickness of the
+ * object on the pixels grid of the object plane
+ */
+struct ThicknessMap {
+	ThicknessMap(const ImageBinning& binning = ImageBinning());
+
+	/** Thickness of the object (mm), 0 outside the map
+	 * @param x - x coordinate (mm)
+	 * @param y - y coordinate (mm)
+	 */
+	double thickness( double x, double y) const;
+
+	ImageBinning binning;
+	std::vector<float> values; // thickness of each pixel (mm)
+};
+
+/** Parameters of the generated beam and detectors response
+ */
+struct GeneratorParameters {
+	GeneratorParameters();
+
+	double beam_x; // beam spot center (mm)
+	double beam_y;
+	double beam_sigma; // beam spot sigma (mm)
+	double divergence; // beam angular sigma (rad)
+	double energy; // beam energy (MeV/u), 0 for the configuration energy
+	double object_z; // object plane position (mm)
+	double efficiency; // plane detection efficiency
+	double cluster_two; // probability of two strips cluster
+	double noise; // probability of a noise strip on a plane
+	double straggling; // stop position sigma (slices)
+	bool scattering; // multiple scattering in the object
+};
+
+/** Class EventGenerator produces hits of carbon ions without Geant4.
+ *
+ * The ion track is sampled from the beam spot and divergence, it gets
+ * a multiple scattering kick (Highland formula, entry energy) in the
+ * object plane according to the object thickness. The track is
+ * projected onto the runtime strip geometry planes to fire strips
+ * (plane efficiency, two strips clusters, noise strips). The stop
+ * slice of the calorimeter is the clear beam position of the
+ * calibration shifted by the object thickness, with straggling.
+ *
+ * Each block of events has own random stream, so output depends on
+ * the seed only, not on the number of threads.
+ */
+class EventGenerator {
+public:
+	/** Constructor
+	 * @param parameters - beam and detectors parameters
+	 * @param object - object thickness map, empty for the clear beam
+	 * @param conf - calibration configuration
+	 */
+	EventGenerator( const GeneratorParameters& parameters = GeneratorParameters(),
+		const ThicknessMap& object = ThicknessMap(),
+		SharedConf conf = SystemConfigure::instance());
+
+	/** Generate events and append them to the batch
+	 * @param events - number of events
+	 * @param hits - events batch
+	 * @param seed - random seed
+	 * @param threads - number of threads, 0 for all hardware threads
+	 */
+	void generate( size_t events, HitsPositionsVector& hits,
+		uint64_t seed = 1, unsigned int threads = 1) const;
+
+	/** Generate one event
+	 * @param random - random numbers generator
+	 * @param hits - returns the event
+	 */
+	void generate( FastRandom& random, HitsPositions& hits) const;
+
+	const GeneratorParameters& parameters() const { return parameters_; }
+
+private:
+	/** Fire strips of the plane crossed at the coordinate
+	 * @param random - random numbers generator
+	 * @param plane - plane index
+	 * @param u - coordinate (mm)
+	 * @param numbers - returns fired strips numbers
+	 */
+	void fire( FastRandom& random, int plane, double u,
+		NumbersVector& numbers) const;
+
+	SharedConf conf_;
+	GeneratorParameters parameters_;
+	ThicknessMap object_;
+	double energy_;
+	double clear_position_; // clear beam stop slice
+	double slices_per_mm_; // stop slice shift of the object thickness
+	double scattering_factor_; // Highland angle without thickness terms
+	int slices_;
+	int planes_;
+	StripGeometryType types_[TREC_NUMBER_OF_SILICON_DETECTORS];
+	PlaneTransform transforms_[TREC_NUMBER_OF_SILICON_DETECTORS];
+	int strips_[TREC_NUMBER_OF_SILICON_DETECTORS];
+	bool y_axis_[TREC_NUMBER_OF_SILICON_DETECTORS];
+};
+
+inline
+uint64_t
+FastRandom::next()
+{
+	uint64_t x = s0_;
+	uint64_t const y = s1_;
+	s0_ = y;
+	x ^= x << 23;
+	s1_ = x ^ y ^ (x >> 17) ^ (y >> 26);
+	return s1_ + y;
+}
+
+inline
+double
+FastRandom::uniform()
+{
+	// 53 random bits of the mantissa
+	return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+inline
+double
+FastRandom::gauss()
+{
+	if (has_spare_) {
+		has_spare_ = false;
+		return spare_;
+	}
+
+	double u = 1.0 - uniform(); // (0, 1]
+	double v = uniform();
+	double r = std::sqrt(-2.0 * std::log(u));
+	double phi = 2.0 * M_PI * v;
+
+	spare_ = r * std::sin(phi);
+	has_spare_ = true;
+	return r * std::cos(phi);
+}
+
+inline
+double
+ThicknessMap::thickness( double x, double y) const
+{
+	int pixel = binning.index( x, y);
+	return (pixel != -1 && pixel < int(values.size())) ? values[pixel] : 0.0;
+}
+
+} // namespace TREC
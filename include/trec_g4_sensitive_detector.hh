@@ -0,0 +1,117 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+#include <map>
+
+#include <G4VSensitiveDetector.hh>
+
+#include "trec_strip_digitizer.hh"
+#include "trec_system_configure.hh"
+
+class G4Step;
+class G4HCofThisEvent;
+class G4TouchableHistory;
+class G4LogicalVolume;
+
+namespace TREC {
+
+/** Class TrackerSensitiveDetector digitizes energy deposits of the
+ * silicon planes and calorimeter slices into HitsPositions (library
+ * part trec_g4), strips are digitized by StripDigitizer.
+ *
+ * Events are collected into the batch of the detector and the full
+ * batch is written into the sink, e.g. QueueSource of the pipeline
+ * or RingSink. Geant4 multithreading: the detector is created in
+ * ConstructSDandField() of each worker thread, so the batches and
+ * digitization buffers are per thread and there is no lock between
+ * the threads except the one of the sink. The sink shared by the
+ * threads is thread safe (QueueSource), RingSink is created for each
+ * thread.
+ */
+class TrackerSensitiveDetector : public G4VSensitiveDetector {
+public:
+	/** Constructor
+	 * @param name - sensitive detector name
+	 * @param sink - sink of the batches
+	 * @param calorimeter - logical volume name of the calorimeter
+	 * slice, slice number is the replica number
+	 * @param parameters - digitization parameters
+	 * @param conf - calibration configuration
+	 */
+	TrackerSensitiveDetector( const G4String& name, SharedSink sink,
+		const G4String& calorimeter,
+		const DigitizerParameters& parameters = DigitizerParameters(),
+		SharedConf conf = SystemConfigure::instance());
+
+	/** Writes the rest of the batch
+	 */
+	virtual ~TrackerSensitiveDetector();
+
+	/** Create the detector of the worker thread and attach it to the
+	 * logical volumes of all planes and calorimeter slices, called
+	 * from ConstructSDandField(). Mass geometry plane volumes are used,
+	 * parallel world divisions if there are no mass volumes.
+	 * @return detector, owned by G4SDManager
+	 */
+	static TrackerSensitiveDetector* attach( const G4String& name,
+		SharedSink sink, const G4String& calorimeter,
+		const DigitizerParameters& parameters = DigitizerParameters(),
+		SharedConf conf = SystemConfigure::instance());
+
+	/** Write the rest of the batch of the calling thread's detector,
+	 * e.g. from EndOfRunAction()
+	 * @param name - sensitive detector name
+	 * @return <tt>false</tt> if there is no such detector
+	 */
+	static bool flush(const G4String& name);
+
+	virtual void Initialize(G4HCofThisEvent*);
+	virtual G4bool ProcessHits( G4Step* step, G4TouchableHistory*);
+	virtual void EndOfEvent(G4HCofThisEvent*);
+
+	/** Write the rest of the batch into the sink
+	 */
+	void flush();
+
+private:
+	TrackerSensitiveDetector(const TrackerSensitiveDetector&);
+	TrackerSensitiveDetector& operator=(const TrackerSensitiveDetector&);
+
+	enum { CALORIMETER = -1, NOT_SENSITIVE = -2 };
+
+	/** Plane index of the volume, CALORIMETER or NOT_SENSITIVE
+	 */
+	int volume_index(const G4LogicalVolume* volume);
+
+	SharedSink sink_;
+	SharedConf conf_;
+	DigitizerParameters parameters_;
+	std::map< std::string, int> names_; // sensitive volumes names
+	std::map< const G4LogicalVolume*, int> volumes_; // names_ cache
+
+	StripDigitizer digitizer_;
+	std::vector<double> slices_; // calorimeter deposits (MeV)
+	DepositsVector deposits_;
+	HitsPositionsVector batch_;
+};
+
+} // namespace TREC
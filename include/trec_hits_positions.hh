@@ -22,6 +22,7 @@
 #include <vector>
 #include <map>
 #include <fstream>
+#include <tr1/memory>
 
 #include "trec_strip_geometry.hh"
 
@@ -29,6 +30,7 @@ namespace TREC {
 
 typedef std::vector<bool> HitsVector;
 typedef std::vector<unsigned int> NumbersVector;
+typedef std::vector<unsigned short> DepositsVector;
 
 typedef std::map< StripGeometryType, HitsVector > StripsHitsMap;
 typedef std::map< StripGeometryType, NumbersVector > StripsNumbersMap;
@@ -36,6 +38,24 @@ typedef std::map< StripGeometryType, NumbersVector > StripsNumbersMap;
 class HitsPositions;
 typedef std::vector<HitsPositions> HitsPositionsVector;
 
+/** Event tag: optional timing, beam and analog calorimeter
+ * information of the event
+ */
+struct EventTag {
+	EventTag() : spill(0), time(0), energy(0.0), calorimeter_peak(-1.0f) {}
+
+	bool empty() const {
+		return (spill == 0 && time == 0 && energy == 0.0 &&
+			calorimeter_peak < 0.0f);
+	}
+
+	unsigned int spill; // spill number
+	unsigned long long time; // event time stamp (ns)
+	double energy; // beam energy (MeV/u), 0 for the configuration energy
+	float calorimeter_peak; // sub-slice stop position, -1 if no deposits
+};
+typedef std::vector<EventTag> EventTagsVector;
+
 /** Class HitsPositions stores position of hits in silicon planes
  * and calorimeter
  *
@@ -72,33 +92,84 @@ public:
 	 */
 	void add_plane_hits( StripGeometryType type, const HitsVector& hits);
 
+	/** Add fired strips numbers in particular plane, no hits vector
+	 * conversion (fast path of generated events)
+	 * @param type - particular silicon plane type
+	 * @param numbers - fired strips numbers in ascending order
+	 */
+	void add_plane_numbers( StripGeometryType type, const NumbersVector& numbers);
+
 	/** Add hits in calorimeter slices
 	 * @param hits - hits vector in calorimeter slices
 	 */	
 	void add_calorimeter_hits(const HitsVector& hits);
 
+	/** Add analog energy deposits in calorimeter slices. Deposits
+	 * aren't kept, sub-slice stop position is found and stored in the
+	 * event tag. Hits are formed from the deposits if the event has no
+	 * calorimeter hits.
+	 * @param deposits - energy deposits in calorimeter slices (ADC counts)
+	 * @param threshold - minimum deposit of the slice hit (ADC counts)
+	 */
+	void add_calorimeter_deposits( const DepositsVector& deposits,
+		unsigned short threshold = 1);
+
 	/** Check if calorimeter hits is empty or not
 	 * @return true if hits is not empty, false otherwise
 	 */
 	bool calorimeter_empty() const;
 
+	/** Get event tag
+	 * @return event tag, empty if the event has no timing information
+	 */
+	const EventTag& tag() const { return tag_; }
+
+	/** Set event tag
+	 * @param tag - event tag (spill number, time stamp and beam energy)
+	 */
+	void set_tag(const EventTag& tag) { tag_ = tag; }
+
 	/** Return calorimeter hit position slice number
 	 * @return hit position slice number if calorimter hits is not empty,
 	 * or -1 otherwise
 	 */
 	int calorimeter_position() const;
 
-	/** Save vector of HitsPositions into file
+	/** Return sub-slice calorimeter stop position
+	 * @return stop position from the analog deposits if they were added,
+	 * calorimeter_position() otherwise
+	 */
+	double calorimeter_peak() const;
+
+	/** Find distal 50% edge of the bragg peak with sub-slice precision.
+	 * The position is in slice numbers, a sharp edge after slice N
+	 * gives N as calorimeter_position() does.
+	 * @param deposits - energy deposits in calorimeter slices
+	 * @param n - number of slices
+	 * @return edge position, -1 if there are no deposits
+	 */
+	static float distal_edge( const unsigned short* deposits, size_t n);
+
+	/** Size of the event record written by operator<< (bytes)
+	 */
+	size_t record_size() const;
+
+	/** Save vector of HitsPositions into file. If any of the events
+	 * has a tag, the file is written with event tags, otherwise
+	 * the plain format is used.
 	 * @param filename - name of the file
 	 * @param hits - vector of HitsPositions
 	 */
 	static void save( const char* filename, const HitsPositionsVector& hits);
 
-	/** Load vector of HitsPositions from file
+	/** Load vector of HitsPositions from file (with or without tags)
 	 * @param filename - name of the file
-	 * @param hits - vector of HitsPositions
+	 * @param hits - vector of HitsPositions, events read before
+	 * an error are kept
+	 * @return <tt>true</tt> if all events are read,
+	 * <tt>false</tt> otherwise
 	 */
-	static void load( const char* filename, HitsPositionsVector& hits);
+	static bool load( const char* filename, HitsPositionsVector& hits);
 
 private:
 	/** Transform plane hits position indexes to hits vector
@@ -115,6 +186,123 @@ private:
 
 	StripsNumbersMap strips_numbers_;
 	HitsVector calorimeter_hits_;
+	EventTag tag_;
+};
+
+/** Raw event records: layout of operator<<, then the tag
+ */
+struct EventRecords {
+	EventRecords() : data(0), tag_size(0), begin(0), end(0) {}
+
+	/** Number of records
+	 */
+	size_t size() const { return offsets.size(); }
+
+	/** Clear records, the capacity is kept
+	 */
+	void clear();
+
+	/** Write events with their tags into the buffer
+	 * @param hits - events
+	 */
+	void assign(const HitsPositionsVector& hits);
+
+	const char* data; // records, buffer or memory of the source
+	std::vector<size_t> offsets; // begins of the records in data
+	std::vector<size_t> sizes; // sizes of the records with tags (bytes)
+	std::vector<unsigned long long> times; // write time (ns, steady clock)
+		// of the records, empty if the source has no times
+	std::vector<char> buffer; // copy of the records if the source
+		// doesn't keep them
+	size_t tag_size; // size of the tag record, 0 if there are no tags
+	size_t begin; // position of the records in the source
+	size_t end;
+};
+
+/** Class EventSource is a source of raw event records, the records
+ * are decoded separately, so the decoding can run in parallel with
+ * the reading
+ */
+class EventSource {
+public:
+	virtual ~EventSource() {}
+
+	/** Take records of next events, a live source waits for the events
+	 * @param n - maximum number of events
+	 * @param records - returns records
+	 * @return number of events, 0 at the end of the source
+	 */
+	virtual size_t acquire( size_t n, EventRecords& records) = 0;
+
+	/** Records are decoded and aren't used any more, the source can
+	 * reuse their memory. Thread safe.
+	 * @param records - records from acquire()
+	 */
+	virtual void release(const EventRecords& records) {}
+
+	/** Decode records, thread safe
+	 * @param records - records from acquire()
+	 * @param hits - returns events
+	 * @return number of decoded events, records which can't be
+	 * decoded are skipped
+	 */
+	size_t decode( const EventRecords& records, HitsPositionsVector& hits) const;
+};
+
+/** Class HitsSink takes batches of events from a producer, e.g.
+ * the digitizer of a simulation
+ */
+class HitsSink {
+public:
+	virtual ~HitsSink() {}
+
+	/** Write batch of events, a sink shared by several threads
+	 * is thread safe
+	 * @param hits - events
+	 */
+	virtual void write(const HitsPositionsVector& hits) = 0;
+};
+typedef std::tr1::shared_ptr<HitsSink> SharedSink;
+
+/** Class HitsReader reads the file of HitsPositions (with or without
+ * tags) by portions of raw event records
+ */
+class HitsReader : public EventSource {
+public:
+	/** Constructor, reads the file header
+	 * @param filename - name of the file
+	 */
+	HitsReader(const char* filename);
+
+	/** Check if the file is opened and the header is read
+	 */
+	bool good() const { return good_; }
+
+	/** Number of events in the file
+	 */
+	size_t events() const { return events_; }
+
+	/** Read records of next events
+	 * @param n - maximum number of events
+	 * @param records - returns records
+	 * @return number of read events, 0 at the end of file or
+	 * in case of an error
+	 */
+	virtual size_t acquire( size_t n, EventRecords& records);
+
+private:
+	HitsReader(const HitsReader&);
+	HitsReader& operator=(const HitsReader&);
+
+	/** Append next bytes of the file into data
+	 */
+	bool copy( size_t n, std::vector<char>& data);
+
+	std::ifstream file_;
+	bool good_;
+	size_t events_; // number of events in the file
+	size_t read_; // number of read events
+	size_t tag_size_; // size of tag record, 0 for plain file
 };
 
 } // namespace TREC
@@ -0,0 +1,245 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#include "trec_defines.hh"
+#include "trec_strip_geometry.hh"
+
+namespace TREC {
+
+/** Processing stages of an event
+ */
+enum MetricsStage {
+	STAGE_READ, // events reading
+	STAGE_DECODE, // events decoding from the file records
+	STAGE_CLUSTER, // clusters and coordinates of the planes
+	STAGE_FIT, // main and full tracks fits
+	STAGE_GATE, // trajectory check of the full track
+	STAGE_BIN, // image binning of the tracks
+	METRICS_STAGES
+};
+
+/** Rejection reasons of a plane
+ */
+enum PlaneRejection {
+	REJECT_NO_HITS, // no fired strips
+	REJECT_CLUSTERS, // two or more clusters
+	PLANE_REJECTIONS
+};
+
+/** Rejection reasons of an event
+ */
+enum EventRejection {
+	REJECT_NO_MAIN, // XY1 or XY2 coordinates are missing
+	REJECT_NO_FULL, // coordinates of a station behind XY2 are missing
+	REJECT_TRAJECTORY, // full track is away from the main track
+	EVENT_REJECTIONS
+};
+
+const int metrics_buckets = 40; // log2 buckets of the stage call time
+
+/** Counters of one thread, padded to own cache lines so threads
+ * never share a line
+ */
+struct alignas(64) ThreadMetrics {
+	void clear();
+
+	/** Add stage call
+	 * @param stage - processing stage
+	 * @param cycles - call duration (cycles)
+	 * @param items - number of processed events or tracks
+	 */
+	void add( MetricsStage stage, uint64_t cycles, uint64_t items);
+
+	void reject( StripGeometryType plane, PlaneRejection reason);
+
+	void reject(EventRejection reason) { events_rejected[reason]++; }
+
+	uint64_t stage_cycles[METRICS_STAGES];
+	uint64_t stage_calls[METRICS_STAGES];
+	uint64_t stage_items[METRICS_STAGES];
+	uint64_t stage_histogram[METRICS_STAGES][metrics_buckets];
+	uint64_t planes_rejected[TREC_NUMBER_OF_SILICON_DETECTORS][PLANE_REJECTIONS];
+	uint64_t events_rejected[EVENT_REJECTIONS];
+	uint64_t main_tracks;
+	uint64_t full_tracks;
+};
+
+/** Sum of the counters of all threads
+ */
+struct MetricsReport {
+	MetricsReport();
+
+	/** Report as JSON object
+	 */
+	std::string json() const;
+
+	/** Report as text table
+	 */
+	std::string text() const;
+
+	/** Save report, JSON if the file name ends with ".json",
+	 * text otherwise
+	 * @param filename - name of the file
+	 * @return <tt>true</tt> on success, <tt>false</tt> otherwise
+	 */
+	bool save(const char* filename) const;
+
+	ThreadMetrics totals;
+	unsigned int threads; // number of threads with counters
+	double seconds; // wall time since metrics were enabled
+	double ns_per_cycle; // timer calibration
+};
+
+/** Class Metrics collects per-thread counters and cycle timers of the
+ * processing stages and rejection reasons of planes and events.
+ *
+ * Metrics are process wide and disabled by default, a disabled hook
+ * costs one relaxed atomic load. Each thread gets own padded counters
+ * on its first enabled hook, counters of finished threads are reused
+ * by new threads, so short-living parallel_for workers don't grow
+ * the registry.
+ */
+class Metrics {
+public:
+	/** Enable or disable collection, enabling starts the timer
+	 * calibration and the report wall time
+	 */
+	static void enable(bool on = true);
+
+	static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+	/** Counters of the calling thread
+	 * @return counters, 0 if metrics are disabled
+	 */
+	static ThreadMetrics* current();
+
+	/** Clear counters of all threads, call when no stage is running
+	 */
+	static void reset();
+
+	/** Sum counters of all threads
+	 */
+	static MetricsReport report();
+
+	/** Timestamp counter (or nanoseconds where there is no counter)
+	 */
+	static uint64_t cycles();
+
+private:
+	static ThreadMetrics* thread_counters();
+
+	static std::atomic<bool> enabled_;
+};
+
+/** Scoped timer of a processing stage, does nothing if metrics
+ * are disabled
+ */
+class StageTimer {
+public:
+	/** Constructor
+	 * @param stage - processing stage
+	 * @param items - number of processed events or tracks
+	 */
+	explicit StageTimer( MetricsStage stage, uint64_t items = 1);
+	~StageTimer();
+
+	/** Set number of processed items
+	 */
+	void items(uint64_t n) { items_ = n; }
+
+private:
+	StageTimer(const StageTimer&);
+	StageTimer& operator=(const StageTimer&);
+
+	ThreadMetrics* metrics_;
+	MetricsStage stage_;
+	uint64_t items_;
+	uint64_t start_;
+};
+
+inline
+ThreadMetrics*
+Metrics::current()
+{
+	return enabled() ? thread_counters() : 0;
+}
+
+inline
+uint64_t
+Metrics::cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline
+void
+ThreadMetrics::add( MetricsStage stage, uint64_t cycles, uint64_t items)
+{
+	stage_cycles[stage] += cycles;
+	stage_calls[stage]++;
+	stage_items[stage] += items;
+
+	int bucket = cycles ? 63 - __builtin_clzll(cycles) : 0;
+	stage_histogram[stage][(bucket < metrics_buckets) ? bucket : metrics_buckets - 1]++;
+}
+
+inline
+void
+ThreadMetrics::reject( StripGeometryType plane, PlaneRejection reason)
+{
+	int i = StripGeometry::index(plane);
+	if (i != -1)
+		planes_rejected[i][reason]++;
+}
+
+inline
+StageTimer::StageTimer( MetricsStage stage, uint64_t items)
+	:
+	metrics_(Metrics::current()),
+	stage_(stage),
+	items_(items),
+	start_(metrics_ ? Metrics::cycles() : 0)
+{
+}
+
+inline
+StageTimer::~StageTimer()
+{
+	if (metrics_)
+		metrics_->add( stage_, Metrics::cycles() - start_, items_);
+}
+
+} // namespace TREC
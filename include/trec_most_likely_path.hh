@@ -0,0 +1,150 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+#include <utility>
+
+#include "trec_track.hh"
+#include "trec_system_configure.hh"
+
+namespace TREC {
+
+typedef std::pair< double, double> PathPoint; // x, y (mm)
+typedef std::vector<PathPoint> PathPointsVector;
+
+/** Class MostLikelyPath estimates the curved path of an ion inside
+ * the object from the entry and exit tracks (Schulte formalism,
+ * multiple scattering by Highland formula).
+ *
+ * The object is a homogeneous polystyrene layer between entry and exit
+ * planes. In each projection the path position at depth u is
+ *
+ * x(u) = c0 * x_in + c1 * theta_in + c2 * x_out + c3 * theta_out
+ *
+ * The coefficients depend on the depth and the ion entry energy only,
+ * so they are tabulated over the depth and energy grid once in the
+ * constructor. Path evaluation of a track is a table lookup and a few
+ * multiply-adds.
+ *
+ * The entry track is the main track (XY1-XY2) on the entry plane.
+ * There is no tracker behind the object except XY3, so the exit track
+ * is the full track (XY1-XY2-XY3) on the exit plane.
+ */
+class MostLikelyPath {
+public:
+	/** Constructor
+	 * @param z_in - position z of the object entry plane (mm)
+	 * @param z_out - position z of the object exit plane (mm)
+	 * @param depths - number of depth points from z_in to z_out
+	 * @param energy_min - minimum entry energy of the table (MeV/u)
+	 * @param energy_max - maximum entry energy of the table (MeV/u)
+	 * @param energies - number of energy points
+	 * @param conf - calibration configuration
+	 */
+	MostLikelyPath( double z_in, double z_out, int depths = 101,
+		double energy_min = 180.0, double energy_max = 480.0,
+		int energies = 31, SharedConf conf = SystemConfigure::instance());
+
+	/** Number of depth points
+	 */
+	int depths() const { return depths_; }
+
+	/** Position z of the depth point (mm)
+	 * @param i - depth point index
+	 */
+	double depth(int i) const { return z_in_ + i * step_; }
+
+	/** Coefficients of path position at the depth
+	 * @param z - position z (mm), clamped to the object
+	 * @param energy - entry energy (MeV/u), clamped to the table
+	 * @param c - returns 4 coefficients
+	 */
+	void coefficients( double z, double energy, double* c) const;
+
+	/** Path position of one track at the depth
+	 * @param main - main track pair
+	 * @param full - full track pair
+	 * @param c - path coefficients
+	 * @return x, y position (mm)
+	 */
+	PathPoint position( const TrackXYPair& main, const TrackXYPair& full,
+		const double* c) const;
+
+	/** Path of one track at all depth points
+	 * @param main - main track pair
+	 * @param full - full track pair
+	 * @param energy - entry energy (MeV/u)
+	 * @param path - returns path positions
+	 */
+	void path( const TrackXYPair& main, const TrackXYPair& full,
+		double energy, PathPointsVector& path) const;
+
+	/** Path positions of tracks at the depth
+	 * @param main - vector of main track pairs
+	 * @param full - vector of full track pairs of the same ions
+	 * @param z - position z (mm)
+	 * @param energy - entry energy (MeV/u)
+	 * @param points - returns path positions
+	 * @param threads - number of threads, 0 for all hardware threads
+	 * @return <tt>true</tt> if the tracks vectors match,
+	 * <tt>false</tt> otherwise
+	 */
+	bool positions( const MainTracksVector& main, const FullTracksVector& full,
+		double z, double energy, PathPointsVector& points,
+		unsigned int threads = 0) const;
+
+private:
+	/** Fill coefficients table of one entry energy
+	 * @param energy - entry energy (MeV/u)
+	 * @param table - coefficients of all depth points
+	 */
+	void tabulate( double energy, double* table) const;
+
+	SharedConf conf_;
+	double z_in_;
+	double z_out_;
+	int depths_;
+	double step_; // depth step (mm)
+	double energy_min_;
+	double energy_step_;
+	int energies_;
+	std::vector<double> table_; // [energy][depth][4]
+};
+
+inline
+PathPoint
+MostLikelyPath::position( const TrackXYPair& main, const TrackXYPair& full,
+	const double* c) const
+{
+	const Track& main_x = main.first;
+	const Track& main_y = main.second;
+	const Track& full_x = full.first;
+	const Track& full_y = full.second;
+
+	double x = c[0] * (main_x.a() * z_in_ + main_x.b()) + c[1] * main_x.a() +
+		c[2] * (full_x.a() * z_out_ + full_x.b()) + c[3] * full_x.a();
+	double y = c[0] * (main_y.a() * z_in_ + main_y.b()) + c[1] * main_y.a() +
+		c[2] * (full_y.a() * z_out_ + full_y.b()) + c[3] * full_y.a();
+
+	return PathPoint( x, y);
+}
+
+} // namespace TREC
@@ -0,0 +1,116 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "trec_track.hh"
+#include "trec_system_configure.hh"
+#include "trec_clear_beam_cache.hh"
+#include "trec_reconstruction_image.hh"
+
+namespace TREC {
+
+/** Class MultiDepthReconstruction reconstructs a stack of 2D images
+ * (fluence and PSET) at several imaging planes in one pass over the
+ * tracks. Position of a track at each plane is taken from the linear
+ * track model, calibration lookup is done once per track.
+ */
+class MultiDepthReconstruction {
+public:
+	/** Constructor
+	 * @param binning - image binning (the same for all planes)
+	 * @param planes - z positions of the imaging planes (mm)
+	 * @param object_slice_min - minimum slice number of calorimeter
+	 * with object exposure
+	 * @param clear_slice_max - maximum slice number of calorimeter
+	 * without object exposure
+	 * @param conf - calibration configuration
+	 */
+	MultiDepthReconstruction( const ImageBinning& binning,
+		const std::vector<double>& planes,
+		int object_slice_min, int clear_slice_max,
+		SharedConf conf = SystemConfigure::instance());
+
+	/** Constructor
+	 * @param binning - image binning (the same for all planes)
+	 * @param z1 - position of the first imaging plane (mm)
+	 * @param z2 - position of the last imaging plane (mm)
+	 * @param step - distance between the planes (mm)
+	 * @param object_slice_min - minimum slice number of calorimeter
+	 * with object exposure
+	 * @param clear_slice_max - maximum slice number of calorimeter
+	 * without object exposure
+	 * @param conf - calibration configuration
+	 */
+	MultiDepthReconstruction( const ImageBinning& binning,
+		double z1, double z2, double step,
+		int object_slice_min, int clear_slice_max,
+		SharedConf conf = SystemConfigure::instance());
+
+	/** Add full tracks into the images of all planes
+	 * @param tracks - vector of full track pairs
+	 * @param threads - number of threads, 0 for all hardware threads
+	 */
+	void add_tracks( const FullTracksVector& tracks,
+		unsigned int threads = 0);
+
+	/** Add full tracks of a mixed-energy run into the images of all
+	 * planes, PSET of each track is taken at the beam energy of its
+	 * event and the sub-slice calorimeter peak, tracks without tag are
+	 * taken at the configuration energy
+	 * @param tracks - vector of full track pairs
+	 * @param tags - event tags of the tracks
+	 * @param threads - number of threads, 0 for all hardware threads
+	 */
+	void add_tracks( const FullTracksVector& tracks,
+		const EventTagsVector& tags, unsigned int threads = 0);
+
+	/** Clear accumulated data
+	 */
+	void reset();
+
+	/** Positions of the imaging planes
+	 */
+	const std::vector<double>& planes() const { return planes_; }
+
+	/** Get images stack
+	 * @return vector of images, one image per plane
+	 */
+	std::vector<ReconstructionImage> images() const;
+
+	/** Save images stack into file, histograms of a plane
+	 * are named with the plane index suffix
+	 *
+	 * @param filename - name of file
+	 */
+	void save(const char* filename = "reconstruct_depth.root") const;
+
+private:
+	SharedConf conf_;
+	ClearBeamCache cache_;
+	ImageBinning binning_;
+	std::vector<double> planes_;
+	std::vector<ImageAccumulator> accumulators_;
+	int object_pos_min_;
+	int clear_pos_max_;
+};
+
+} // namespace TREC
@@ -0,0 +1,94 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <mutex>
+
+#include "trec_track.hh"
+#include "trec_system_configure.hh"
+#include "trec_clear_beam_cache.hh"
+#include "trec_reconstruction_image.hh"
+
+namespace TREC {
+
+/** Class OnlineReconstruction reconstructs 2D image incrementally.
+ * Tracks are added batch by batch (e.g. spill by spill) into running
+ * accumulators, and an up-to-date fluence and PSET image can be
+ * taken at any moment of data acquisition.
+ *
+ * Methods are thread safe: snapshot() can be called from a monitoring
+ * thread while another thread adds tracks.
+ */
+class OnlineReconstruction {
+public:
+	/** Constructor
+	 * @param binning - image binning
+	 * @param object_slice_min - minimum slice number of calorimeter
+	 * with object exposure
+	 * @param clear_slice_max - maximum slice number of calorimeter
+	 * without object exposure
+	 * @param conf - calibration configuration
+	 */
+	OnlineReconstruction( const ImageBinning& binning,
+		int object_slice_min, int clear_slice_max,
+		SharedConf conf = SystemConfigure::instance());
+
+	/** Add batch of full tracks into the image
+	 * @param batch - vector of full track pairs
+	 */
+	void add_tracks(const FullTracksVector& batch);
+
+	/** Add batch of full tracks of a mixed-energy run into the image,
+	 * PSET of each track is taken at the beam energy of its event and
+	 * the sub-slice calorimeter peak, tracks without tag are taken at
+	 * the configuration energy
+	 * @param batch - vector of full track pairs
+	 * @param tags - event tags of the tracks
+	 */
+	void add_tracks(const FullTracksVector& batch,
+		const EventTagsVector& tags);
+
+	/** Get up-to-date image
+	 * @return image with fluence and mean PSET of each pixel
+	 */
+	ReconstructionImage snapshot() const;
+
+	/** Clear accumulated data
+	 */
+	void reset();
+
+	/** Number of tracks accumulated in the image
+	 */
+	size_t entries() const;
+
+private:
+	SharedConf conf_;
+	std::tr1::shared_ptr<const ClearBeamCache> cache_; // replaced by an
+		// updated copy for new energies, never modified
+	ImageAccumulator accumulator_;
+	int object_pos_min_;
+	int clear_pos_max_;
+	double plane_x_z_; // imaging plane position for X0Z track
+	double plane_y_z_; // imaging plane position for Y0Z track
+	mutable std::mutex mutex_;
+	std::mutex cache_mutex_; // guards replacement of the cache
+};
+
+} // namespace TREC
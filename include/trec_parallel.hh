@@ -0,0 +1,76 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+#include <thread>
+
+namespace TREC {
+
+/** Get number of worker threads
+ * @param threads - requested number of threads, 0 for all hardware threads
+ * @return number of threads (at least 1)
+ */
+inline
+unsigned int
+worker_threads(unsigned int threads = 0)
+{
+	if (!threads)
+		threads = std::thread::hardware_concurrency();
+	return threads ? threads : 1;
+}
+
+/** Split range [0, n) into contiguous chunks and process them in parallel
+ *
+ * @param n - number of elements
+ * @param threads - number of threads (see worker_threads)
+ * @param func - functor called as func( begin, end, thread_index)
+ * for each chunk, chunk of thread_index is processed by one thread only
+ */
+template<class Function>
+void
+parallel_for( size_t n, unsigned int threads, Function func)
+{
+	threads = worker_threads(threads);
+	if (threads > n)
+		threads = n ? n : 1;
+
+	if (threads == 1) {
+		func( size_t(0), n, 0u);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	workers.reserve(threads);
+
+	size_t chunk = n / threads;
+	size_t rest = n % threads;
+	size_t begin = 0;
+	for ( unsigned int t = 0; t < threads; ++t) {
+		size_t end = begin + chunk + ((t < rest) ? 1 : 0);
+		workers.push_back(std::thread( func, begin, end, t));
+		begin = end;
+	}
+
+	for ( size_t t = 0; t < workers.size(); ++t)
+		workers[t].join();
+}
+
+} // namespace TREC
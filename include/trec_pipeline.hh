@@ -0,0 +1,164 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+
+#include "trec_track.hh"
+#include "trec_hits_positions.hh"
+#include "trec_track_coordinates.hh"
+#include "trec_online_reconstruction.hh"
+#include "trec_queue.hh"
+
+namespace TREC {
+
+/** Pipeline stages, a batch goes through them in this order
+ */
+enum PipelineStage {
+	PIPELINE_READ, // raw records from the source
+	PIPELINE_DECODE, // records into events
+	PIPELINE_CLUSTER, // coordinates of the planes
+	PIPELINE_FIT, // main and full tracks
+	PIPELINE_GATE, // trajectory check of the full tracks
+	PIPELINE_BIN, // tracks into the image
+	PIPELINE_STAGES
+};
+
+/** Pipeline options
+ */
+struct PipelineOptions {
+	PipelineOptions();
+
+	size_t batch_size; // number of events in a batch
+	size_t batches; // number of batches in flight, limits memory
+	unsigned int threads[PIPELINE_STAGES]; // workers of the stage,
+		// the read stage has one worker
+};
+
+/** Pipeline run summary
+ */
+struct PipelineReport {
+	PipelineReport() : events(0), main(0), full(0), batches(0), errors(0),
+		seconds(0.0), latency_mean(0.0), latency_max(0.0) {}
+
+	/** Sustained rate (events/s)
+	 */
+	double rate() const { return (seconds > 0.0) ? events / seconds : 0.0; }
+
+	size_t events; // decoded events
+	size_t main; // events with main track
+	size_t full; // events with full track within the trajectory
+	size_t batches;
+	size_t errors; // records which aren't decoded
+	double seconds;
+	double latency_mean; // from the record write to the binning (s),
+	double latency_max; // sources with record times only
+};
+
+/** Batch of events, its buffers are reused by the next batches
+ */
+struct PipelineBatch {
+	void clear();
+
+	EventRecords records;
+	HitsPositionsVector hits;
+	std::vector<TrackCoordinates> coordinates;
+	std::vector<char> main_ok; // main track is found
+	std::vector<char> full_ok; // full track is found
+	FullTracksVector tracks; // full tracks passed the gate
+	EventTagsVector tags; // event tags of the tracks (beam energy and
+		// sub-slice calorimeter peak)
+};
+
+/** Class Pipeline reconstructs the image from events source in stages
+ * connected by bounded lock-free queues. Batches of events go
+ * read -> decode -> cluster -> fit -> gate -> bin, each stage has its
+ * own workers. Batches are taken from a fixed pool and returned into
+ * it after the bin stage, so the reading waits while all batches are
+ * in flight: memory is constant for any number of events, and the
+ * slowest stage sets the pace of the whole pipeline. Records of a live
+ * source are decoded in place and released after the decode stage.
+ *
+ * Batches are binned out of the file order, the image doesn't depend
+ * on the order.
+ */
+class Pipeline {
+public:
+	/** Constructor
+	 * @param image - image the tracks are binned into
+	 * @param options - pipeline options
+	 */
+	Pipeline( OnlineReconstruction& image,
+		const PipelineOptions& options = PipelineOptions());
+
+	/** Reconstruct events of the file
+	 * @param filename - name of the hits file (HitsPositions::save)
+	 * @return run summary
+	 */
+	PipelineReport run(const char* filename);
+
+	/** Reconstruct events of the source until its end
+	 * @param source - events source (file, ring buffer)
+	 * @return run summary
+	 */
+	PipelineReport run(EventSource& source);
+
+private:
+	typedef BoundedQueue<PipelineBatch*> BatchQueue;
+
+	/** Read batches until the end of the source
+	 */
+	void read( EventSource& source, BatchQueue& free, BatchQueue& out);
+
+	/** Worker of a stage after the read stage
+	 * @param stage - pipeline stage
+	 * @param source - events source (decoding)
+	 * @param in - input batches
+	 * @param out - output batches
+	 * @param active - number of running workers of the stage,
+	 * the last worker closes the output queue
+	 */
+	void work( PipelineStage stage, EventSource& source,
+		BatchQueue& in, BatchQueue& out, std::atomic<unsigned int>& active);
+
+	/** Process batch by a stage after the read stage
+	 */
+	void process( PipelineStage stage, EventSource& source,
+		PipelineBatch& batch);
+
+	/** Add latencies of the batch events
+	 */
+	void add_latency(const PipelineBatch& batch);
+
+	OnlineReconstruction& image_;
+	PipelineOptions options_;
+
+	std::atomic<size_t> events_;
+	std::atomic<size_t> main_;
+	std::atomic<size_t> full_;
+	std::atomic<size_t> batches_;
+	std::atomic<size_t> errors_;
+	std::atomic<unsigned long long> latency_sum_; // ns
+	std::atomic<unsigned long long> latency_max_; // ns
+	std::atomic<size_t> latency_events_;
+};
+
+} // namespace TREC
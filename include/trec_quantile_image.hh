@@ -0,0 +1,134 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "trec_track.hh"
+#include "trec_system_configure.hh"
+#include "trec_clear_beam_cache.hh"
+#include "trec_reconstruction_image.hh"
+
+namespace TREC {
+
+/** Class QuantileImage keeps per-pixel streaming quantile sketches of
+ * the calorimeter slice, so median or trimmed mean PSET images are
+ * formed in a single pass over the tracks.
+ *
+ * The measured value is an integer slice number within the
+ * [object_slice_min, clear_slice_max] window, therefore the sketch of
+ * each pixel is a fixed-size slice counts array. It has bounded memory,
+ * gives exact quantiles and merges exactly across threads and files.
+ */
+class QuantileImage {
+public:
+	/** Constructor
+	 * @param binning - image binning
+	 * @param object_slice_min - minimum slice number of calorimeter
+	 * with object exposure
+	 * @param clear_slice_max - maximum slice number of calorimeter
+	 * without object exposure
+	 * @param conf - calibration configuration
+	 */
+	QuantileImage( const ImageBinning& binning,
+		int object_slice_min, int clear_slice_max,
+		SharedConf conf = SystemConfigure::instance());
+
+	/** Add full tracks into the sketches
+	 * @param tracks - vector of full track pairs
+	 * @param threads - number of threads, 0 for all hardware threads
+	 */
+	void add_tracks( const FullTracksVector& tracks,
+		unsigned int threads = 0);
+
+	/** Add full tracks of a mixed-energy run into the sketches, the
+	 * sub-slice calorimeter peak of each event is shifted to the slice
+	 * with the same PSET at the configuration energy, tracks with the
+	 * shifted slice out of the window are skipped, tracks without
+	 * tag are taken as is
+	 * @param tracks - vector of full track pairs
+	 * @param tags - event tags of the tracks
+	 * @param threads - number of threads, 0 for all hardware threads
+	 */
+	void add_tracks( const FullTracksVector& tracks,
+		const EventTagsVector& tags, unsigned int threads = 0);
+
+	/** Add sketches of another image with the same binning and slices
+	 * @return <tt>true</tt> if images are compatible and merged,
+	 * <tt>false</tt> otherwise
+	 */
+	bool merge(const QuantileImage& src);
+
+	/** Clear all sketches
+	 */
+	void reset();
+
+	/** Get quantile of the pixel slice distribution
+	 * @param pixel - pixel index (see ImageBinning::index)
+	 * @param q - quantile [0, 1]
+	 * @return slice value with sub-slice interpolation,
+	 * or -1 if pixel has no tracks
+	 */
+	double quantile( int pixel, double q) const;
+
+	/** Form median PSET image
+	 */
+	ReconstructionImage median() const;
+
+	/** Form trimmed mean PSET image, tracks with slice outside
+	 * of [q_low, q_high] quantiles of the pixel are rejected.
+	 * @param q_low - low quantile, e.g. 0.1
+	 * @param q_high - high quantile, e.g. 0.9
+	 */
+	ReconstructionImage trimmed_mean( double q_low, double q_high) const;
+
+	/** Save sketches into file
+	 * @param filename - name of the file
+	 */
+	void save(const char* filename) const;
+
+	/** Load sketches from file and merge them with current ones
+	 * @param filename - name of the file
+	 * @return <tt>true</tt> if sketches are loaded and merged,
+	 * <tt>false</tt> otherwise
+	 */
+	bool load(const char* filename);
+
+private:
+	const unsigned int* counts(int pixel) const;
+
+	SharedConf conf_;
+	ClearBeamCache cache_;
+	ImageBinning binning_;
+	int object_pos_min_;
+	int clear_pos_max_;
+	int slices_; // number of slices in the window (sketch size)
+	std::vector<unsigned int> counts_; // [pixel][slice] counts
+	std::vector<unsigned int> entries_; // [pixel] counts
+};
+
+inline
+const unsigned int*
+QuantileImage::counts(int pixel) const
+{
+	return &counts_[static_cast<size_t>(pixel) * slices_];
+}
+
+} // namespace TREC
@@ -0,0 +1,196 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <stdint.h>
+
+namespace TREC {
+
+/** Wait step of a blocking call: spin, then yield, then sleep,
+ * so a waiting thread doesn't hold a core for long
+ * @param n - number of the failed attempts
+ */
+inline
+void
+backoff(unsigned int n)
+{
+	if (n < 64)
+		return; // spin
+	if (n < 128)
+		std::this_thread::yield();
+	else
+		std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+/** Bounded lock-free multi-producer multi-consumer queue
+ * (D. Vyukov's algorithm). Each cell has a sequence number, which
+ * tells producers and consumers whether the cell is free or full
+ * for their turn, so push and pop cost one CAS on the queue index
+ * and don't touch each other's cache lines.
+ *
+ * Blocking push() and pop() wait with backoff().
+ */
+template <class T>
+class BoundedQueue {
+public:
+	/** Constructor
+	 * @param capacity - maximum number of elements, rounded up to
+	 * the power of 2 (at least 2)
+	 */
+	explicit BoundedQueue(size_t capacity);
+
+	/** Push element if the queue isn't full
+	 * @return <tt>true</tt> if the element is pushed
+	 */
+	bool try_push(const T& value);
+
+	/** Pop element if the queue isn't empty
+	 * @return <tt>true</tt> if the element is popped
+	 */
+	bool try_pop(T& value);
+
+	/** Push element, wait while the queue is full
+	 */
+	void push(const T& value);
+
+	/** Pop element, wait while the queue is empty and isn't closed
+	 * @return <tt>false</tt> if the queue is closed and empty
+	 */
+	bool pop(T& value);
+
+	/** Close the queue, no more elements will be pushed
+	 */
+	void close() { closed_.store( true, std::memory_order_release); }
+
+	size_t capacity() const { return mask_ + 1; }
+
+private:
+	BoundedQueue(const BoundedQueue&);
+	BoundedQueue& operator=(const BoundedQueue&);
+
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Cell[]> cells_;
+	size_t mask_;
+	char pad0_[64];
+	std::atomic<size_t> enqueue_;
+	char pad1_[64];
+	std::atomic<size_t> dequeue_;
+	char pad2_[64];
+	std::atomic<bool> closed_;
+};
+
+template <class T>
+BoundedQueue<T>::BoundedQueue(size_t capacity)
+	:
+	mask_(1),
+	enqueue_(0),
+	dequeue_(0),
+	closed_(false)
+{
+	// the sequence check needs at least 2 cells
+	capacity = std::max( capacity, size_t(2));
+	while (mask_ < capacity)
+		mask_ <<= 1;
+
+	cells_.reset(new Cell[mask_]);
+	for ( size_t i = 0; i < mask_; ++i)
+		cells_[i].sequence.store( i, std::memory_order_relaxed);
+	--mask_;
+}
+
+template <class T>
+bool
+BoundedQueue<T>::try_push(const T& value)
+{
+	size_t pos = enqueue_.load(std::memory_order_relaxed);
+	for (;;) {
+		Cell& cell = cells_[pos & mask_];
+		size_t seq = cell.sequence.load(std::memory_order_acquire);
+		intptr_t diff = intptr_t(seq) - intptr_t(pos);
+		if (diff == 0) {
+			if (enqueue_.compare_exchange_weak( pos, pos + 1,
+				std::memory_order_relaxed)) {
+				cell.value = value;
+				cell.sequence.store( pos + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (diff < 0)
+			return false; // full
+		else
+			pos = enqueue_.load(std::memory_order_relaxed);
+	}
+}
+
+template <class T>
+bool
+BoundedQueue<T>::try_pop(T& value)
+{
+	size_t pos = dequeue_.load(std::memory_order_relaxed);
+	for (;;) {
+		Cell& cell = cells_[pos & mask_];
+		size_t seq = cell.sequence.load(std::memory_order_acquire);
+		intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+		if (diff == 0) {
+			if (dequeue_.compare_exchange_weak( pos, pos + 1,
+				std::memory_order_relaxed)) {
+				value = cell.value;
+				cell.sequence.store( pos + mask_ + 1, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (diff < 0)
+			return false; // empty
+		else
+			pos = dequeue_.load(std::memory_order_relaxed);
+	}
+}
+
+template <class T>
+void
+BoundedQueue<T>::push(const T& value)
+{
+	for ( unsigned int n = 0; !try_push(value); ++n)
+		backoff(n);
+}
+
+template <class T>
+bool
+BoundedQueue<T>::pop(T& value)
+{
+	for ( unsigned int n = 0; ; ++n) {
+		if (try_pop(value))
+			return true;
+		if (closed_.load(std::memory_order_acquire))
+			return try_pop(value); // pushed before close
+		backoff(n);
+	}
+}
+
+} // namespace TREC
@@ -0,0 +1,74 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <atomic>
+
+#include "trec_hits_positions.hh"
+#include "trec_queue.hh"
+
+namespace TREC {
+
+/** Class QueueSource passes batches of events from producer threads
+ * in the same process (e.g. Geant4 worker threads) to the pipeline.
+ * Each written batch is serialized into its own records buffer and
+ * pushed into the lock-free bounded queue, the producers wait while
+ * the queue is full.
+ */
+class QueueSource : public EventSource, public HitsSink {
+public:
+	/** Constructor
+	 * @param batches - queue capacity (batches), rounded up to
+	 * the power of 2 (at least 2)
+	 */
+	QueueSource(size_t batches = 64);
+
+	/** Removes batches which aren't acquired
+	 */
+	virtual ~QueueSource();
+
+	/** Write batch of events, thread safe
+	 * @param hits - events
+	 */
+	virtual void write(const HitsPositionsVector& hits);
+
+	/** Take the records of one written batch, waits for the batch
+	 * @param n - not used, the batch has the size of the producer's one
+	 * @param records - returns records with their write times
+	 * @return number of events, 0 if the source is closed and
+	 * the batches are consumed
+	 */
+	virtual size_t acquire( size_t n, EventRecords& records);
+
+	/** Close the source when all producers are finished,
+	 * acquire() returns 0 after the queued batches
+	 */
+	void close() { queue_.close(); }
+
+	/** Number of acquired events
+	 */
+	size_t events() const { return events_; }
+
+private:
+	BoundedQueue<EventRecords*> queue_;
+	std::atomic<size_t> events_;
+};
+
+} // namespace TREC
@@ -0,0 +1,177 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+
+namespace TREC {
+
+/** Image binning parameters (same meaning as TracksReconstruction
+ * constructor parameters)
+ */
+struct ImageBinning {
+	ImageBinning( double x1 = 0.0, double x2 = 0.0,
+		double y1 = 0.0, double y2 = 0.0, int bx = 0, int by = 0);
+
+	/** Get pixel index of the position
+	 * @param x - x coordinate
+	 * @param y - y coordinate
+	 * @return pixel index, or -1 if position is outside the image
+	 */
+	int index( double x, double y) const;
+
+	/** Number of pixels in the image
+	 */
+	int pixels() const { return bin_x * bin_y; }
+
+	double size_x1; // minimum x coordinate
+	double size_x2; // maximum x coordinate
+	double size_y1; // minimum y coordinate
+	double size_y2; // maximum y coordinate
+	int bin_x; // number of bins along x axis
+	int bin_y; // number of bins along y axis
+};
+
+/** Get position of the imaging plane (middle between XY2 and XY3 planes)
+ * @param z_x - returns plane position for X0Z tracks
+ * @param z_y - returns plane position for Y0Z tracks
+ */
+void image_plane( double& z_x, double& z_y);
+
+/** Class ReconstructionImage stores dense 2D image: fluence,
+ * mean value (PSET) and its error of each pixel.
+ */
+class ReconstructionImage {
+public:
+	/** Constructor
+	 * @param binning - image binning
+	 */
+	ReconstructionImage(const ImageBinning& binning = ImageBinning());
+
+	const ImageBinning& binning() const { return binning_; }
+
+	/** Fluence (number of tracks) of the pixel
+	 * @param i - pixel index along x axis, [0, bin_x)
+	 * @param j - pixel index along y axis, [0, bin_y)
+	 */
+	double fluence( int i, int j) const { return fluence_[pos( i, j)]; }
+
+	/** Mean value (PSET) of the pixel, 0 if pixel has no tracks
+	 */
+	double value( int i, int j) const { return value_[pos( i, j)]; }
+
+	/** Error of the mean value of the pixel
+	 */
+	double error( int i, int j) const { return error_[pos( i, j)]; }
+
+	/** Set pixel data
+	 * @param pixel - pixel index (see ImageBinning::index)
+	 */
+	void set( int pixel, double fluence, double value, double error);
+
+	/** Save image into file as fluence and position 2D histograms
+	 *
+	 * @param filename - name of file
+	 * @param suffix - suffix of histograms names
+	 * @param option - file open option, "UPDATE" to add into the file
+	 */
+	void save( const char* filename = "reconstruct.root",
+		const char* suffix = "object", const char* option = "RECREATE") const;
+
+private:
+	int pos( int i, int j) const { return j * binning_.bin_x + i; }
+
+	ImageBinning binning_;
+	std::vector<double> fluence_;
+	std::vector<double> value_;
+	std::vector<double> error_;
+};
+
+/** Class ImageAccumulator keeps running sums of fluence and value
+ * of each pixel, so the image can be formed at any moment.
+ */
+class ImageAccumulator {
+public:
+	/** Constructor
+	 * @param binning - image binning
+	 */
+	ImageAccumulator(const ImageBinning& binning = ImageBinning());
+
+	const ImageBinning& binning() const { return binning_; }
+
+	/** Add value into the pixel
+	 * @param pixel - pixel index (see ImageBinning::index)
+	 * @param value - value (PSET) of the track
+	 */
+	void add( int pixel, double value);
+
+	/** Add running sums of another accumulator with the same binning
+	 */
+	void merge(const ImageAccumulator& src);
+
+	/** Clear all running sums
+	 */
+	void reset();
+
+	/** Number of accumulated values
+	 */
+	size_t entries() const { return entries_; }
+
+	/** Form image from the running sums
+	 * @return image with mean value of each pixel
+	 */
+	ReconstructionImage image() const;
+
+private:
+	ImageBinning binning_;
+	std::vector<double> fluence_;
+	std::vector<double> sum_;
+	std::vector<double> sum2_;
+	size_t entries_;
+};
+
+inline
+int
+ImageBinning::index( double x, double y) const
+{
+	if (x < size_x1 || x >= size_x2 || y < size_y1 || y >= size_y2)
+		return -1;
+
+	int i = static_cast<int>((x - size_x1) / (size_x2 - size_x1) * bin_x);
+	int j = static_cast<int>((y - size_y1) / (size_y2 - size_y1) * bin_y);
+
+	// rounding at the upper edge
+	if (i >= bin_x) i = bin_x - 1;
+	if (j >= bin_y) j = bin_y - 1;
+
+	return j * bin_x + i;
+}
+
+inline
+void
+ImageAccumulator::add( int pixel, double value)
+{
+	fluence_[pixel] += 1.0;
+	sum_[pixel] += value;
+	sum2_[pixel] += value * value;
+	++entries_;
+}
+
+} // namespace TREC
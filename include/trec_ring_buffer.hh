@@ -0,0 +1,222 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <ostream>
+#include <stdint.h>
+
+#include "trec_hits_positions.hh"
+
+namespace TREC {
+
+class EventGenerator;
+
+struct RingHeader;
+
+/** Class RingWriter writes event records into the shared memory ring
+ * buffer created by RingReader, e.g. from the DAQ or a Geant4 process.
+ *
+ * Ring buffer protocol: the ring is a power of 2 bytes, positions are
+ * 64-bit counters of written bytes. A writer reserves the record space
+ * with one CAS on the head position, writes the record and its time,
+ * then publishes it by the record state (release). A record which
+ * doesn't fit before the end of the ring is preceded by a padding
+ * record. The reader consumes published records in the ring order,
+ * clears their memory and moves the tail position, so writers in
+ * several threads and processes (MPSC) share one ring without locks.
+ *
+ * A writer object is used by one thread, each thread (process) has
+ * its own writer.
+ */
+class RingWriter {
+public:
+	/** Constructor, attaches to the ring buffer
+	 * @param name - shared memory name of the ring ("/trec_ring")
+	 */
+	RingWriter(const char* name);
+
+	/** Detaches from the ring buffer, see close()
+	 */
+	~RingWriter();
+
+	/** Check if the writer is attached
+	 */
+	bool good() const { return header_ != 0; }
+
+	/** Write event record
+	 * @param hits - event
+	 * @param wait - wait for the free space if the ring is full,
+	 * the event is dropped otherwise
+	 * @return <tt>true</tt> if the event is written, <tt>false</tt>
+	 * if it is dropped or the writer isn't attached
+	 */
+	bool write( const HitsPositions& hits, bool wait = true);
+
+	/** Detach from the ring buffer, the reader finishes when all
+	 * writers are detached and the records are consumed
+	 */
+	void close();
+
+	/** Number of written events
+	 */
+	size_t written() const { return written_; }
+
+	/** Number of dropped events (ring is full)
+	 */
+	size_t dropped() const { return dropped_; }
+
+private:
+	RingWriter(const RingWriter&);
+	RingWriter& operator=(const RingWriter&);
+
+	RingHeader* header_;
+	char* ring_; // records memory
+	size_t mapped_; // size of the mapping (bytes)
+	size_t written_;
+	size_t dropped_;
+	std::ostream stream_; // serialization into the ring
+};
+
+/** Class RingSink writes batches of events into the ring buffer,
+ * the sink is used by one thread
+ */
+class RingSink : public HitsSink {
+public:
+	/** Constructor, attaches to the ring buffer
+	 * @param name - shared memory name of the ring ("/trec_ring")
+	 * @param wait - wait for the free space if the ring is full,
+	 * the events are dropped otherwise
+	 */
+	RingSink( const char* name, bool wait = true)
+		: writer_(name), wait_(wait) {}
+
+	/** Write batch of events
+	 * @param hits - events
+	 */
+	virtual void write(const HitsPositionsVector& hits);
+
+	/** Ring writer of the sink
+	 */
+	RingWriter& writer() { return writer_; }
+
+private:
+	RingWriter writer_;
+	bool wait_;
+};
+
+/** Class RingReader creates the shared memory ring buffer and feeds
+ * its records to the pipeline. Records are decoded in place (without
+ * copies), their memory is returned to the writers after the decoding.
+ */
+class RingReader : public EventSource {
+public:
+	/** Constructor, creates the ring buffer, old buffer of the same
+	 * name is removed
+	 * @param name - shared memory name of the ring ("/trec_ring")
+	 * @param capacity - ring size (bytes), rounded up to the power of 2
+	 */
+	RingReader( const char* name, size_t capacity = size_t(64) << 20);
+
+	/** Removes the ring buffer
+	 */
+	virtual ~RingReader();
+
+	/** Check if the ring buffer is created
+	 */
+	bool good() const { return header_ != 0; }
+
+	/** Take published records in place, waits for the records
+	 * @param n - maximum number of events
+	 * @param records - returns records with their write times
+	 * @return number of events, 0 if all writers are detached and
+	 * the records are consumed, the reader is stopped or a corrupted
+	 * record is found
+	 */
+	virtual size_t acquire( size_t n, EventRecords& records);
+
+	/** Return records memory to the writers, records can be released
+	 * in any order. Thread safe.
+	 * @param records - records from acquire()
+	 */
+	virtual void release(const EventRecords& records);
+
+	/** Stop reading, acquire() returns 0 after the call. Thread safe.
+	 */
+	void stop() { stop_ = true; }
+
+	/** Number of acquired events
+	 */
+	size_t events() const { return events_; }
+
+	/** Number of acquired bytes
+	 */
+	size_t bytes() const { return bytes_; }
+
+private:
+	RingReader(const RingReader&);
+	RingReader& operator=(const RingReader&);
+
+	std::string name_;
+	RingHeader* header_;
+	char* ring_; // records memory
+	size_t mapped_; // size of the mapping (bytes)
+	uint64_t read_; // position of the next record
+	size_t events_;
+	size_t bytes_;
+	std::atomic<bool> stop_;
+	bool corrupted_; // a record has a bad size, reading is stopped
+	std::mutex mutex_; // released spans
+	std::map< uint64_t, uint64_t> released_; // begin, end
+};
+
+/** Summary of the local producer
+ */
+struct ProducerReport {
+	ProducerReport() : events(0), dropped(0), seconds(0.0) {}
+
+	/** Sustained rate of the written events (events/s)
+	 */
+	double rate() const { return (seconds > 0.0) ? events / seconds : 0.0; }
+
+	size_t events; // written events
+	size_t dropped; // events dropped at the full ring
+	double seconds;
+};
+
+/** Local stand-in of the DAQ: writes generated events into the ring
+ * buffer at a given rate and detaches at the end
+ *
+ * @param name - shared memory name of the ring
+ * @param generator - events generator
+ * @param events - number of events
+ * @param rate - events per second, 0 for the maximum rate
+ * @param seed - random seed
+ * @param wait - wait at the full ring, drop events otherwise
+ * @return producer summary
+ */
+ProducerReport produce_events( const char* name, const EventGenerator& generator,
+	size_t events, double rate = 0.0, unsigned long long seed = 1,
+	bool wait = true);
+
+} // namespace TREC
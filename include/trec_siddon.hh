@@ -0,0 +1,190 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstring>
+
+#include "trec_track.hh"
+
+namespace TREC {
+
+/** Voxel grid of the reconstructed volume. The grid is centered
+ * at the rotation axis (isocenter) in the object coordinate system.
+ */
+struct VolumeGrid {
+	VolumeGrid( int x = 0, int y = 0, int z = 0,
+		double size_x = 1.0, double size_y = 1.0, double size_z = 1.0);
+
+	int voxels() const { return nx * ny * nz; }
+
+	int nx; // number of voxels along x axis
+	int ny; // number of voxels along y axis
+	int nz; // number of voxels along z axis
+	double dx; // voxel size along x axis (mm)
+	double dy; // voxel size along y axis (mm)
+	double dz; // voxel size along z axis (mm)
+};
+
+/** Tracks parameters in structure of arrays form
+ * X0Z: x = ax * z + bx
+ * Y0Z: y = ay * z + by
+ */
+struct TracksArrays {
+	/** Fill arrays from the track pairs
+	 */
+	void assign(const FullTracksVector& tracks);
+
+	/** Fill arrays from the range of track pairs
+	 * @param tracks - vector of full track pairs
+	 * @param begin - first track
+	 * @param end - track after the last one
+	 */
+	void assign( const FullTracksVector& tracks, size_t begin, size_t end);
+
+	size_t size() const { return ax.size(); }
+
+	std::vector<double> ax;
+	std::vector<double> bx;
+	std::vector<double> ay;
+	std::vector<double> by;
+};
+
+/** Sparse rows in compressed row form: voxel index (int32) and
+ * intersection length (float16) of each non-zero element
+ */
+struct SparseRows {
+	SparseRows() : row_ptr(1, 0) {}
+
+	size_t rows() const { return row_ptr.size() - 1; }
+
+	/** Length of element (mm)
+	 */
+	float length(size_t k) const;
+
+	void clear();
+
+	std::vector<size_t> row_ptr; // rows begins, rows() + 1 elements
+	std::vector<int> voxels;
+	std::vector<unsigned short> lengths; // half precision
+};
+
+/** Convert float into half precision value
+ */
+unsigned short float_to_half(float value);
+
+/** Convert half precision value into float
+ */
+float half_to_float(unsigned short value);
+
+/** Class SiddonTracer calculates intersection lengths of straight
+ * tracks with the voxel grid (incremental Siddon / Jacobs algorithm).
+ * Each voxel plane crossing costs one comparison and one addition,
+ * no crossings sorting is needed.
+ */
+class SiddonTracer {
+public:
+	/** Constructor
+	 * @param grid - voxel grid
+	 * @param isocenter - position z of the rotation axis (mm)
+	 */
+	SiddonTracer( const VolumeGrid& grid, double isocenter);
+
+	/** Trace tracks through the grid of the object rotated around
+	 * vertical (Y) axis. Each track gives one row, row of a track
+	 * which misses the grid is empty.
+	 *
+	 * @param tracks - tracks parameters
+	 * @param angle - rotation angle (rad)
+	 * @param rows - returns sparse rows
+	 * @param threads - number of threads, 0 for all hardware threads
+	 */
+	void trace( const TracksArrays& tracks, double angle,
+		SparseRows& rows, unsigned int threads = 0) const;
+
+	/** Trace one track through the grid
+	 * @param ax, bx, ay, by - track parameters
+	 * @param angle - rotation angle (rad)
+	 * @param voxels - returns voxel indexes
+	 * @param lengths - returns intersection lengths (mm)
+	 */
+	void trace( double ax, double bx, double ay, double by, double angle,
+		std::vector<int>& voxels, std::vector<float>& lengths) const;
+
+private:
+	VolumeGrid grid_;
+	double isocenter_;
+	double size_[3]; // grid sizes
+	double step_[3]; // voxel sizes
+	int n_[3]; // number of voxels
+	int stride_[3]; // voxel index strides
+	double radius_; // half diagonal of the grid
+};
+
+inline
+float
+SparseRows::length(size_t k) const
+{
+	return half_to_float(lengths[k]);
+}
+
+inline
+unsigned short
+float_to_half(float value)
+{
+	unsigned int f;
+	std::memcpy( &f, &value, sizeof(float));
+
+	unsigned int sign = (f >> 16) & 0x8000;
+	int exponent = static_cast<int>((f >> 23) & 0xff) - 127 + 15;
+	unsigned int mantissa = f & 0x7fffff;
+
+	if (exponent <= 0) // too small, flush to zero
+		return sign;
+	if (exponent >= 31) // too big, clamp to infinity
+		return sign | 0x7c00;
+
+	// round to nearest
+	unsigned int h = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)
+		++h;
+	return h;
+}
+
+inline
+float
+half_to_float(unsigned short value)
+{
+	unsigned int sign = (value & 0x8000) << 16;
+	unsigned int exponent = (value >> 10) & 0x1f;
+	unsigned int mantissa = value & 0x3ff;
+
+	unsigned int f = sign;
+	if (exponent == 0x1f)
+		f |= 0x7f800000 | (mantissa << 13);
+	else if (exponent)
+		f |= ((exponent - 15 + 127) << 23) | (mantissa << 13);
+
+	float result;
+	std::memcpy( &result, &f, sizeof(float));
+	return result;
+}
+
+} // namespace TREC
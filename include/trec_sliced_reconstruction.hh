@@ -0,0 +1,150 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <map>
+#include <deque>
+#include <chrono>
+
+#include "trec_track.hh"
+#include "trec_hits_positions.hh"
+#include "trec_system_configure.hh"
+#include "trec_clear_beam_cache.hh"
+#include "trec_reconstruction_image.hh"
+
+namespace TREC {
+
+/** Image of one time slice (spill or time window)
+ */
+struct TimeSliceImage {
+	unsigned long long slice; // spill number or time window number
+	ReconstructionImage image;
+	double latency; // time from the last track of the slice to the image (ms)
+	bool late; // latency is bigger than the target
+};
+
+/** Class SlicedReconstruction reconstructs one image per time slice.
+ * Slice of a track is taken from the event tag: spill number, or
+ * time stamp divided by the time window.
+ *
+ * A rolling set of accumulators is kept open for the late tracks.
+ * A slice is closed and its image formed when there are too many open
+ * slices, or when no tracks were added into it during the idle timeout.
+ * The idle timeout is shorter than the latency target, so a slice is
+ * late only if poll() isn't called often enough. Tracks of the already
+ * closed slices are dropped.
+ */
+class SlicedReconstruction {
+public:
+	enum SliceMode {
+		SLICE_SPILL, // one image per spill
+		SLICE_TIME // one image per time window
+	};
+
+	/** Constructor
+	 * @param binning - image binning
+	 * @param object_slice_min - minimum slice number of calorimeter
+	 * with object exposure
+	 * @param clear_slice_max - maximum slice number of calorimeter
+	 * without object exposure
+	 * @param mode - slice by spill number or by time window
+	 * @param window - time window (ns) for SLICE_TIME mode
+	 * @param open_slices - maximum number of open slices
+	 * @param latency_target - latency target (ms), 0 to close slices
+	 * by the number of open slices only
+	 * @param idle_timeout - time without tracks (ms) after which poll()
+	 * closes a slice, 0 for half of the latency target
+	 * @param conf - calibration configuration
+	 */
+	SlicedReconstruction( const ImageBinning& binning,
+		int object_slice_min, int clear_slice_max,
+		SliceMode mode = SLICE_SPILL, unsigned long long window = 0,
+		size_t open_slices = 2, double latency_target = 0.0,
+		double idle_timeout = 0.0,
+		SharedConf conf = SystemConfigure::instance());
+
+	/** Add batch of full tracks, PSET of a track is calculated
+	 * for the beam energy of its tag, and for the sub-slice stop
+	 * position if the tag has it
+	 * @param batch - vector of full track pairs
+	 * @param tags - event tags of the tracks (same size as batch)
+	 */
+	void add_tracks( const FullTracksVector& batch,
+		const EventTagsVector& tags);
+
+	/** Close slices which exceeded the idle timeout
+	 */
+	void poll();
+
+	/** Close all open slices (e.g. at the end of run)
+	 */
+	void flush();
+
+	/** Get the oldest finished slice image
+	 * @param image - returns slice image
+	 * @return <tt>true</tt> if there was a finished image,
+	 * <tt>false</tt> otherwise
+	 */
+	bool pop(TimeSliceImage& image);
+
+	/** Number of tracks dropped because their slice was already closed
+	 */
+	size_t dropped() const { return dropped_; }
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct OpenSlice {
+		OpenSlice(const ImageBinning& binning) : accumulator(binning) {}
+
+		ImageAccumulator accumulator;
+		Clock::time_point updated; // last track added
+	};
+	typedef std::map< unsigned long long, OpenSlice> OpenSlicesMap;
+
+	/** Get slice number of the event
+	 */
+	unsigned long long slice(const EventTag& tag) const;
+
+	/** Close the slice and form its image
+	 */
+	void close(OpenSlicesMap::iterator iter);
+
+	SharedConf conf_;
+	ClearBeamCache cache_; // PSET tables of the events energies
+	ImageBinning binning_;
+	int object_pos_min_;
+	int clear_pos_max_;
+	SliceMode mode_;
+	unsigned long long window_;
+	size_t open_slices_;
+	double latency_target_;
+	double idle_timeout_;
+	double plane_x_z_; // imaging plane position for X0Z track
+	double plane_y_z_; // imaging plane position for Y0Z track
+
+	OpenSlicesMap slices_;
+	std::deque<TimeSliceImage> finished_;
+	bool closed_; // at least one slice was closed
+	unsigned long long last_closed_;
+	size_t dropped_;
+};
+
+} // namespace TREC
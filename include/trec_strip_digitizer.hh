@@ -0,0 +1,121 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "trec_hits_positions.hh"
+
+namespace TREC {
+
+/** Parameters of the energy deposits digitization
+ */
+struct DigitizerParameters {
+	DigitizerParameters();
+
+	double strip_threshold; // minimum charge of the fired strip (MeV)
+	double charge_sharing; // width of the region between strips where
+		// the charge is shared by both strips (pitch units)
+	double cross_talk; // charge fraction induced on each neighbour strip
+	double adc_unit; // calorimeter deposit of one ADC count (MeV)
+	double calorimeter_threshold; // minimum deposit of the fired
+		// calorimeter slice (MeV)
+	size_t batch_size; // events of the sensitive detector batch
+};
+
+/** Class StripDigitizer converts energy deposits in the silicon
+ * planes into fired strips numbers of the event.
+ *
+ * Deposits are buffered per plane (structure of arrays) and mapped
+ * to strips at the end of the event in one branch free loop per plane,
+ * which the compiler vectorizes. Charges are accumulated in the dense
+ * per strip array of the plane, then the cross-talk and threshold are
+ * applied within the touched strips range only. All buffers are
+ * reused, so there are no allocations per deposit once the buffers
+ * have grown. The digitizer is used by one thread.
+ */
+class StripDigitizer {
+public:
+	/** Constructor, plane transforms are taken from StripGeometry
+	 * @param parameters - digitization parameters
+	 */
+	StripDigitizer(const DigitizerParameters& parameters = DigitizerParameters());
+
+	/** Add energy deposit
+	 * @param plane - plane index
+	 * @param x, y - deposit position (mm)
+	 * @param edep - deposit (MeV)
+	 */
+	void add( int plane, double x, double y, double edep);
+
+	/** Fired strips of the plane, the deposits of the plane are cleared
+	 * @param plane - plane index
+	 * @param numbers - returns strips numbers in ascending order
+	 */
+	void digitize( int plane, NumbersVector& numbers);
+
+	/** Fired strips of all planes, the deposits are cleared
+	 * @param hits - event, strips numbers of all planes are set
+	 */
+	void digitize(HitsPositions& hits);
+
+	/** Clear deposits of all planes
+	 */
+	void clear();
+
+	/** Digitization parameters
+	 */
+	const DigitizerParameters& parameters() const { return parameters_; }
+
+private:
+	/** Deposits of the plane and charges of its strips
+	 */
+	struct Plane {
+		double cx, cy, c0; // strip position f = cx * x + cy * y + c0
+		int strips;
+		std::vector<double> x; // deposits (mm)
+		std::vector<double> y;
+		std::vector<double> edep; // (MeV)
+		std::vector<double> charges; // charges of strips (MeV), zero
+			// between events, 2 guard strips on each side
+		std::vector<double> induced; // charges with the cross-talk
+	};
+
+	DigitizerParameters parameters_;
+	Plane planes_[TREC_NUMBER_OF_SILICON_DETECTORS];
+	NumbersVector numbers_;
+
+	// mapping of the deposits batch
+	std::vector<int> strip_;
+	std::vector<int> next_; // nearest neighbour strips
+	std::vector<double> shared_; // charges of the neighbours
+};
+
+inline
+void
+StripDigitizer::add( int plane, double x, double y, double edep)
+{
+	Plane& p = planes_[plane];
+	p.x.push_back(x);
+	p.y.push_back(y);
+	p.edep.push_back(edep);
+}
+
+} // namespace TREC
@@ -23,8 +23,7 @@
 #include <map>
 
 #include "trec_defines.hh"
-
-#include <G4SystemOfUnits.hh>
+#include "trec_units.hh"
 
 namespace TREC {
 
@@ -39,11 +38,77 @@ enum StripGeometryType {
 	MSD_Y3,
 	MSD_X3,
 	MSD__U,
-	MSD__V
+	MSD__V,
+	MSD_Y4, // fourth station, TREC_NUMBER_OF_STATIONS = 4
+	MSD_X4
+};
+
+static_assert( TREC_NUMBER_OF_STATIONS >= 3 && TREC_NUMBER_OF_STATIONS <= 4,
+	"Number of XY stations must be 3 or 4");
+
+/** Micro strips detector plane metadata known at compile time
+ */
+struct PlaneMetadata {
+	StripGeometryType type;
+	const char* name; // "Y1", "X1", ...
+	int station; // 1, 2, 3 for XY stations, 0 for U and V planes
+	bool y_axis; // Y axis is opposite to the strips numbers
+};
+
+/** Planes metadata in the planes index order
+ */
+constexpr PlaneMetadata plane_metadata_[TREC_NUMBER_OF_SILICON_DETECTORS] = {
+	{ MSD_Y1, "Y1", 1, true },
+	{ MSD_X1, "X1", 1, false },
+	{ MSD_Y2, "Y2", 2, true },
+	{ MSD_X2, "X2", 2, false },
+	{ MSD_Y3, "Y3", 3, true },
+	{ MSD_X3, "X3", 3, false },
+	{ MSD__U, "U", 0, false },
+	{ MSD__V, "V", 0, false }
+#if TREC_NUMBER_OF_STATIONS > 3
+	,
+	{ MSD_Y4, "Y4", 4, true },
+	{ MSD_X4, "X4", 4, false }
+#endif
+};
+
+/** Plane of the XY station
+ * @param station - station number from 1
+ * @param y_axis - <tt>true</tt> for Y plane, <tt>false</tt> for X plane
+ * @return plane type, MSD_ER if there is no such station
+ */
+constexpr
+StripGeometryType
+station_plane( int station, bool y_axis, int i = 0)
+{
+	return (i >= TREC_NUMBER_OF_SILICON_DETECTORS) ? MSD_ER :
+		(plane_metadata_[i].station == station &&
+		plane_metadata_[i].y_axis == y_axis) ? plane_metadata_[i].type :
+		station_plane( station, y_axis, i + 1);
+}
+
+/** Plane traits resolved at compile time
+ */
+template <StripGeometryType T>
+struct PlaneTraits {
+	static_assert( T > MSD_ER && T - MSD_Y1 < TREC_NUMBER_OF_SILICON_DETECTORS,
+		"Unknown plane type");
+
+	static constexpr int index = T - MSD_Y1;
+	static_assert( plane_metadata_[index].type == T,
+		"Planes metadata isn't in the planes index order");
+
+	static constexpr int station = plane_metadata_[index].station;
+	static constexpr bool y_axis = plane_metadata_[index].y_axis;
+	static constexpr double sign = y_axis ? -1.0 : 1.0;
+
+	static const char* name() { return plane_metadata_[index].name; }
 };
 
 struct StripGeometry;
 struct StripGeometryNames;
+struct PlaneTransform;
 
 typedef std::pair< StripGeometry, StripGeometryNames> StripGeometryPair;
 typedef std::map< StripGeometryType, StripGeometryNames> StripNamesMap;
@@ -68,112 +133,145 @@ struct StripGeometryNames {
 	std::string sensitive_detector_name;
 };
 
+/** Strip to coordinate transform of the plane compiled from the
+ * geometry and alignment. Coordinate of the strip is
+ * u = sign * (origin + strip * pitch), then the in-plane rotation
+ * is corrected with the coordinate of the other plane of the station.
+ */
+struct alignas(64) PlaneTransform {
+	double origin; // center of the first strip with offsets (mm)
+	double pitch; // pitch size (mm)
+	double sign; // -1 if the axis is opposite to the strips numbers
+	double cos_angle; // in-plane rotation correction
+	double sin_angle;
+	double z; // position z (mm)
+};
+
 /** Micro strips detector plane geometry parameters
  */
 const struct StripGeometry {
-	static int index(StripGeometryType); // get plane index from type
-	static StripGeometryType index(int); // get plane type from index
-	static StripGeometryMap create();
-	static StripGeometryNames create(StripGeometryType);
-	static StripNamesMap create_names();
+	static constexpr int index(StripGeometryType); // get plane index from type
+	static constexpr StripGeometryType index(int); // get plane type from index
+	static StripGeometryMap create(); // defined in trec_g4
+	static StripGeometryNames create(StripGeometryType); // defined in trec_g4
+	static StripNamesMap create_names(); // defined in trec_g4
 	static const StripGeometry* get(StripGeometryType);
-	static void load(const char* filename);
+	static const PlaneTransform* transform(StripGeometryType);
+	static constexpr const char* name(StripGeometryType); // "Y1", "X1", ...
+	static StripGeometryType type(const std::string& name);
+
+	/** Geometry and transform of the plane known at compile time
+	 */
+	template <StripGeometryType T> static const StripGeometry* get();
+	template <StripGeometryType T> static const PlaneTransform* transform();
+
+	/** Runtime geometries and transforms of all planes in the index order
+	 */
+	static const StripGeometry* geometries();
+	static const PlaneTransform* transforms();
+
+	/** Load geometry and alignment of planes from text file, planes
+	 * which aren't in the file keep their parameters. Must be called
+	 * before tracks reconstruction, tables aren't guarded.
+	 * @param filename - name of the file
+	 * @return <tt>true</tt> on success, <tt>false</tt> otherwise
+	 */
+	static bool load(const char* filename);
+
+	/** Replace geometry of the plane and compile its transform.
+	 * Must be called before tracks reconstruction, tables aren't guarded.
+	 * @param type - plane type
+	 * @param geometry - new plane geometry
+	 * @return <tt>true</tt> on success, <tt>false</tt> for unknown plane
+	 */
+	static bool set( StripGeometryType type, const StripGeometry& geometry);
+
+	/** Save geometry and alignment of all planes into text file
+	 * @param filename - name of the file
+	 * @return <tt>true</tt> on success, <tt>false</tt> otherwise
+	 */
+	static bool save(const char* filename);
 
 	double z; // position z (mm)
 	double angle; // angle of the detector (degree)
-	double offset; // pitch offset (um) -- reserved
-	double angle_diff; // angle corrections (degree) -- reserved
+	double offset; // pitch offset (um)
+	double angle_diff; // in-plane rotation correction (degree)
 	double phi_diff; // reserved
 	double sigma; // sigma multiple scattering + alingment (um) -- reserved
 	double t; // detector thickness (um)
 	double x; // half size of square detector (mm)
 	int strips; // number of strips
 	double pitch; // pitch size (um)
-	double dx; // detector offset (um) -- reserved
+	double dx; // detector offset (um)
 } strip_geometry_[] = {
-	{  -52. * CLHEP::mm, 180.0 * CLHEP::deg, 0.0, 0.0, 0.0, 0.0, 300. * CLHEP::um, 30. * CLHEP::mm, 300, 200. * CLHEP::um, 0. },
-	{  -50. * CLHEP::mm,  90.0 * CLHEP::deg, 0.0, 0.0, 0.0, 0.0, 300. * CLHEP::um, 30. * CLHEP::mm, 300, 200. * CLHEP::um, 0. },
-	{  298. * CLHEP::mm, 180.0 * CLHEP::deg, 0.0, 0.0, 0.0, 0.0, 300. * CLHEP::um, 30. * CLHEP::mm, 300, 200. * CLHEP::um, 0. },
-	{  300. * CLHEP::mm,  90.0 * CLHEP::deg, 0.0, 0.0, 0.0, 0.0, 300. * CLHEP::um, 30. * CLHEP::mm, 300, 200. * CLHEP::um, 0. },
-	{ 1300. * CLHEP::mm, 180.0 * CLHEP::deg, 0.0, 0.0, 0.0, 0.0, 300. * CLHEP::um, 30. * CLHEP::mm, 300, 200. * CLHEP::um, 0. },
-	{ 1302. * CLHEP::mm,  90.0 * CLHEP::deg, 0.0, 0.0, 0.0, 0.0, 300. * CLHEP::um, 30. * CLHEP::mm, 300, 200. * CLHEP::um, 0. },
-	{ 1320. * CLHEP::mm, -10.5 * CLHEP::deg, 0.0, 0.0, 0.0, 0.0, 300. * CLHEP::um, 30. * CLHEP::mm, 300, 200. * CLHEP::um, 0. },
-	{ 1322. * CLHEP::mm,  10.5 * CLHEP::deg, 0.0, 0.0, 0.0, 0.0, 300. * CLHEP::um, 30. * CLHEP::mm, 300, 200. * CLHEP::um, 0. }
+	{  -52. * units::mm, 180.0 * units::deg, 0.0, 0.0, 0.0, 0.0, 300. * units::um, 30. * units::mm, 300, 200. * units::um, 0. },
+	{  -50. * units::mm,  90.0 * units::deg, 0.0, 0.0, 0.0, 0.0, 300. * units::um, 30. * units::mm, 300, 200. * units::um, 0. },
+	{  298. * units::mm, 180.0 * units::deg, 0.0, 0.0, 0.0, 0.0, 300. * units::um, 30. * units::mm, 300, 200. * units::um, 0. },
+	{  300. * units::mm,  90.0 * units::deg, 0.0, 0.0, 0.0, 0.0, 300. * units::um, 30. * units::mm, 300, 200. * units::um, 0. },
+	{ 1300. * units::mm, 180.0 * units::deg, 0.0, 0.0, 0.0, 0.0, 300. * units::um, 30. * units::mm, 300, 200. * units::um, 0. },
+	{ 1302. * units::mm,  90.0 * units::deg, 0.0, 0.0, 0.0, 0.0, 300. * units::um, 30. * units::mm, 300, 200. * units::um, 0. },
+	{ 1320. * units::mm, -10.5 * units::deg, 0.0, 0.0, 0.0, 0.0, 300. * units::um, 30. * units::mm, 300, 200. * units::um, 0. },
+	{ 1322. * units::mm,  10.5 * units::deg, 0.0, 0.0, 0.0, 0.0, 300. * units::um, 30. * units::mm, 300, 200. * units::um, 0. }
+#if TREC_NUMBER_OF_STATIONS > 3
+	,
+	{ 1340. * units::mm, 180.0 * units::deg, 0.0, 0.0, 0.0, 0.0, 300. * units::um, 30. * units::mm, 300, 200. * units::um, 0. },
+	{ 1342. * units::mm,  90.0 * units::deg, 0.0, 0.0, 0.0, 0.0, 300. * units::um, 30. * units::mm, 300, 200. * units::um, 0. }
+#endif
 };
 
-inline
+constexpr
 int
 StripGeometry::index(StripGeometryType type)
 {
-	int pos = -1;
-
-	switch (type) {
-	case MSD_Y1:
-		pos = 0;
-		break;
-	case MSD_X1:
-		pos = 1;
-		break;
-	case MSD_Y2:
-		pos = 2;
-		break;
-	case MSD_X2:
-		pos = 3;
-		break;
-	case MSD_Y3:
-		pos = 4;
-		break;
-	case MSD_X3:
-		pos = 5;
-		break;
-	case MSD__U:
-		pos = 6;
-		break;
-	case MSD__V:
-		pos = 7;
-		break;
-	case MSD_ER:
-	default:
-		break;
-	}
-	return pos;
+	return (type > MSD_ER && type - MSD_Y1 < TREC_NUMBER_OF_SILICON_DETECTORS) ?
+		type - MSD_Y1 : -1;
 }
 
-inline
+constexpr
 StripGeometryType
 StripGeometry::index(int pos)
 {
-	StripGeometryType type = MSD_ER;
-
-	switch (pos) {
-	case 0:
-		type = MSD_Y1;
-		break;
-	case 1:
-		type = MSD_X1;
-		break;
-	case 2:
-		type = MSD_Y2;
-		break;
-	case 3:
-		type = MSD_X2;
-		break;
-	case 4:
-		type = MSD_Y3;
-		break;
-	case 5:
-		type = MSD_X3;
-		break;
-	case 6:
-		type = MSD__U;
-		break;
-	case 7:
-		type = MSD__V;
-		break;
-	default:
-		break;
-	}
-	return type;
+	return (pos >= 0 && pos < TREC_NUMBER_OF_SILICON_DETECTORS) ?
+		plane_metadata_[pos].type : MSD_ER;
+}
+
+constexpr
+const char*
+StripGeometry::name(StripGeometryType type)
+{
+	return (index(type) != -1) ? plane_metadata_[index(type)].name : "";
+}
+
+inline
+const StripGeometry*
+StripGeometry::get(StripGeometryType type)
+{
+	int i = index(type);
+	return (i != -1) ? geometries() + i : 0;
+}
+
+inline
+const PlaneTransform*
+StripGeometry::transform(StripGeometryType type)
+{
+	int i = index(type);
+	return (i != -1) ? transforms() + i : 0;
+}
+
+template <StripGeometryType T>
+inline
+const StripGeometry*
+StripGeometry::get()
+{
+	return geometries() + PlaneTraits<T>::index;
+}
+
+template <StripGeometryType T>
+inline
+const PlaneTransform*
+StripGeometry::transform()
+{
+	return transforms() + PlaneTraits<T>::index;
 }
 
 } // namespace TREC
@@ -24,14 +24,26 @@
 #include <tr1/memory>
 #include <boost/noncopyable.hpp>
 
+#include "trec_calibration.hh"
+
 namespace TREC {
 
 class SystemConfigure;
-typedef std::tr1::shared_ptr<SystemConfigure> SharedConf;
+typedef std::tr1::shared_ptr<const SystemConfigure> SharedConf;
 
+/** Class SystemConfigure keeps calibration of the setup.
+ * An object is immutable after construction, so it can be shared
+ * by any number of threads without locking. Engines take the
+ * configuration as a constructor parameter, so reconstructions with
+ * different calibrations can run in one process. Reload of the global
+ * instance does not affect engines holding the previous configuration.
+ */
 class SystemConfigure : private boost::noncopyable  {
 public:
 	virtual ~SystemConfigure();
+	// Make new independent configuration, built-in calibration if
+	// the filename is empty (or the file can't be loaded, with error)
+	static SharedConf create( const char* filename, double energy = 455.0);
 	// Get object instance only
 	static SharedConf instance();
 	// Make & Get instance
@@ -44,19 +56,46 @@ public:
 	void strip_planes_sigma( double& sigma_xy1, 
 		double& sigma_xy2, double& sigma_xy3) const;
 
+	// Polystyrene, water equivalent thickness and water equivalent
+	// path length of the object (cm), tabulated for each slice
 	double PSET(int calorimeter_slice) const; // cm
 	double WET(int calorimeter_slice) const; // cm
-	double WEPL(int calorimeter_slice) const;
+	double WEPL(int calorimeter_slice) const; // cm
+	// Linear interpolation between slices
+	double PSET(double calorimeter_slice) const; // cm
+	double WET(double calorimeter_slice) const; // cm
+	double WEPL(double calorimeter_slice) const; // cm
+	// Polystyrene equivalent thickness for the beam energy (MeV/u)
+	double PSET( int calorimeter_slice, double energy) const; // cm
+	double PSET( double calorimeter_slice, double energy) const; // cm
+
+	// Clear bregg peak position (slice) for the beam energy (MeV/u)
+	double clear_position(double energy) const;
+	// Clear bregg peak positions of many energies at once
+	void clear_positions( const double* energies, double* positions,
+		size_t n) const;
+
+	const CalibrationData& calibration() const { return calibration_; }
+	double energy() const { return energy_; } // MeV/u
+	// Range in polystyrene (mm) of the ion with kinetic energy (MeV/u)
+	double range(double energy) const;
+	// Kinetic energy (MeV/u) after polystyrene layer (mm)
+	double residual_energy( double energy, double thickness) const;
 
 private:
-	SystemConfigure(const char* filename);
+	SystemConfigure( const char* filename, double energy);
 	void calculate_position_2_wet();
 	void calculate_position_2_pset();
 	void calculate_position_2_wepl();
 	void calculate_calorimeter_wepl();
 	void calculate_wet_2_wepl();
+	void calculate_range_energy();
+	double compute_pset(double calorimeter_slice) const;
+	double compute_wepl(double calorimeter_slice) const;
+	static double interpolate( const std::vector<double>& table, double slice);
 
 	static SharedConf instance_;
+	CalibrationData calibration_;
 	int calorimeter_slices_;
 	double calorimeter_slice_size_;
 	std::map< double, unsigned int> energy_slice_map_;
@@ -69,6 +108,18 @@ private:
 	double* material_position_; // object thickness - bregg peak position spline
 	int material_points_;
 	double energy_;
+	double range_alpha_; // range = alpha * energy^power (Bragg-Kleeman)
+	double range_power_;
+	double water_alpha_; // water range = alpha * energy^power
+	double water_power_;
+	double slice_clear_; // clear bregg peak position
+	double water_ratio_; // water / polystyrene ranges ratio
+	std::vector<double> pset_; // per slice tables
+	std::vector<double> wet_;
+	std::vector<double> wepl_;
+	std::vector<double> clear_table_; // clear bregg peak position - energy
+	double clear_table_energy_; // energy of the first table point
+	double clear_table_step_; // energy step of the table
 };
 
 } // namespace TREC
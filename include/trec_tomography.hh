@@ -0,0 +1,154 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <ios>
+
+#include "trec_track.hh"
+#include "trec_system_configure.hh"
+#include "trec_siddon.hh"
+
+namespace TREC {
+
+/** Reconstruction statistics of one iteration
+ */
+struct IterationReport {
+	int iteration;
+	double residual; // RMS of the projections residuals (mm)
+	double seconds; // iteration time
+	double rows_per_second; // system matrix rows throughput
+};
+typedef std::vector<IterationReport> IterationReportsVector;
+
+/** Class Tomography reconstructs 3D relative stopping power volume
+ * (relative to the polystyrene of calorimeter) from track sets taken
+ * at several projection angles.
+ *
+ * The object is rotated by the projection angle around the vertical
+ * (Y) axis which crosses the beam axis at the isocenter. Each track
+ * with its PSET forms one row of the sparse system matrix: intersection
+ * lengths of the track path with the voxels. Rows are traced and written
+ * into a file by chunks of tracks when the projection is added and
+ * streamed back by chunks of rows at each iteration, so the memory is
+ * bounded by the volume size and the chunks.
+ *
+ * Rows are stored compact: int32 voxel index and float16 length.
+ *
+ * Reconstruction uses ordered subsets SART: projections are split into
+ * subsets, rows of a subset are processed by several threads and the
+ * volume is updated after each subset. Corrections of a chunk of rows
+ * are accumulated into one volume: each thread owns a slab of voxel
+ * planes along z and takes the part of every row within its slab.
+ */
+class Tomography {
+public:
+	/** Constructor
+	 * @param grid - voxel grid
+	 * @param isocenter - position z of the rotation axis (mm)
+	 * @param object_slice_min - minimum slice number of calorimeter
+	 * with object exposure
+	 * @param clear_slice_max - maximum slice number of calorimeter
+	 * without object exposure
+	 * @param prefix - name prefix of the system matrix file, the file
+	 * name is unique for each object (mkstemp)
+	 * @param conf - calibration configuration
+	 */
+	Tomography( const VolumeGrid& grid, double isocenter,
+		int object_slice_min, int clear_slice_max,
+		const char* prefix = "/tmp/trec_system_matrix_",
+		SharedConf conf = SystemConfigure::instance());
+
+	/** Removes the system matrix file
+	 */
+	virtual ~Tomography();
+
+	/** Trace tracks of one projection through the voxel grid and
+	 * store the system matrix rows
+	 * @param tracks - vector of full track pairs
+	 * @param angle - projection angle (rad)
+	 * @param threads - number of threads, 0 for all hardware threads
+	 * @param chunk - number of tracks traced at once
+	 * @return <tt>true</tt> if the rows are written, <tt>false</tt>
+	 * otherwise
+	 */
+	bool add_projection( const FullTracksVector& tracks, double angle,
+		unsigned int threads = 0, size_t chunk = 65536);
+
+	/** Reconstruct volume with ordered subsets SART
+	 * @param iterations - number of iterations
+	 * @param subsets - number of projections subsets
+	 * @param lambda - relaxation parameter
+	 * @param threads - number of threads, 0 for all hardware threads
+	 * @param chunk - number of rows read from the file at once
+	 * @return <tt>true</tt> on success, <tt>false</tt> if the system
+	 * matrix file is truncated or corrupted
+	 */
+	bool reconstruct( int iterations, int subsets = 1,
+		double lambda = 0.5, unsigned int threads = 0, size_t chunk = 65536);
+
+	/** Name of the system matrix file
+	 */
+	const std::string& filename() const { return filename_; }
+
+	/** Reconstructed volume, index = (k * ny + j) * nx + i
+	 */
+	const std::vector<double>& volume() const { return volume_; }
+
+	/** Reports of all iterations
+	 */
+	const IterationReportsVector& reports() const { return reports_; }
+
+	/** Number of system matrix rows
+	 */
+	size_t rows() const { return rows_; }
+
+	/** Save reconstructed volume into file as 3D histogram
+	 * @param filename - name of file
+	 */
+	void save(const char* filename = "tomography.root") const;
+
+private:
+	Tomography(const Tomography&);
+	Tomography& operator=(const Tomography&);
+
+	/** Block of rows of one projection in the system matrix file
+	 */
+	struct RowsBlock {
+		double angle;
+		std::streamoff offset; // position in file
+		size_t rows; // number of rows
+		size_t size; // size in bytes
+	};
+
+	SharedConf conf_;
+	VolumeGrid grid_;
+	SiddonTracer tracer_;
+	int object_pos_min_;
+	int clear_pos_max_;
+	std::string filename_;
+	std::vector<RowsBlock> blocks_;
+	size_t rows_;
+	std::vector<double> volume_;
+	IterationReportsVector reports_;
+};
+
+} // namespace TREC
@@ -21,6 +21,7 @@
 
 #include <vector>
 #include <utility>
+#include <iostream>
 
 namespace TREC {
 
@@ -110,6 +111,17 @@ public:
 	 * @return Track object
 	 */
 	static Track create( double* z, double* f, double* w, int n);
+
+	/** Create Track object from N points with weight, the fit is
+	 * unrolled at compile time (same estimates as the GSL fit).
+	 * 
+	 * @param z - Z-axis coordinates array
+	 * @param f - X-axis or Y-axis coordinates array
+	 * @param w - weights array
+	 * @return Track object
+	 */
+	template <int N>
+	static Track create( const double* z, const double* f, const double* w);
 private:
 	double a_;
 	double b_;
@@ -216,4 +228,66 @@ Track::empty() const
 	return (b1 && b2);
 }
 
+/** Weighted sums of the line fit over the first N points,
+ * recursion is unrolled by the compiler
+ */
+template <int N>
+struct LineFitSums {
+	/** Sums of weights, weighted z and weighted f
+	 */
+	static void moments( const double* z, const double* f, const double* w,
+		double& sw, double& swz, double& swf)
+	{
+		LineFitSums<N - 1>::moments( z, f, w, sw, swz, swf);
+		sw += w[N - 1];
+		swz += w[N - 1] * z[N - 1];
+		swf += w[N - 1] * f[N - 1];
+	}
+
+	/** Weighted sums of squared z and z * f deviations from the means
+	 */
+	static void deviations( const double* z, const double* f, const double* w,
+		double mz, double mf, double& szz, double& szf)
+	{
+		LineFitSums<N - 1>::deviations( z, f, w, mz, mf, szz, szf);
+		double dz = z[N - 1] - mz;
+		szz += w[N - 1] * dz * dz;
+		szf += w[N - 1] * dz * (f[N - 1] - mf);
+	}
+};
+
+template <>
+struct LineFitSums<0> {
+	static void moments( const double*, const double*, const double*,
+		double&, double&, double&) {}
+	static void deviations( const double*, const double*, const double*,
+		double, double, double&, double&) {}
+};
+
+template <int N>
+inline
+Track
+Track::create( const double* z, const double* f, const double* w)
+{
+	static_assert( N >= 2, "Line fit needs two points at least");
+
+	double sw = 0.0, swz = 0.0, swf = 0.0;
+	LineFitSums<N>::moments( z, f, w, sw, swz, swf);
+	double mz = swz / sw;
+	double mf = swf / sw;
+
+	double szz = 0.0, szf = 0.0;
+	LineFitSums<N>::deviations( z, f, w, mz, mf, szz, szf);
+
+	double a = szf / szz;
+	double b = mf - a * mz;
+
+	// covariance of the intercept and the slope
+	double cov00 = (1.0 + mz * mz * sw / szz) / sw;
+	double cov01 = -mz / szz;
+	double cov11 = 1.0 / szz;
+
+	return Track( a, b, cov00, cov01, cov11);
+}
+
 } // namespace TREC
@@ -27,7 +27,8 @@
 namespace TREC {
 
 /** Class TrackCoordinates calculate tracks parameters
- * of the main (XY1-XY2) and full (XY1-XY2-XY3) tracks 
+ * of the main (XY1-XY2) and full (XY1-XY2-XY3, and XY4 if it's built)
+ * tracks
  */
 class TrackCoordinates {
 public:
@@ -52,6 +53,24 @@ public:
 	 */	
 	void calculate_tracks( bool& main, bool& full);
 
+	/** Fit main and full tracks, first step of calculate_tracks
+	 * 
+	 * @param main - returns <tt>true</tt> if main track parameters
+	 * are successfully found, otherwise returns <tt>false</tt>
+	 * 
+	 * @param full - returns <tt>true</tt> if full track parameters
+	 * are found, the trajectory isn't checked yet
+	 */
+	void fit_tracks( bool& main, bool& full);
+
+	/** Check the fitted full track within the trajectory of the main
+	 * track, second step of calculate_tracks
+	 * 
+	 * @param full - full track state from fit_tracks, returns
+	 * <tt>false</tt> if the track is away from the trajectory
+	 */
+	void gate_tracks(bool& full) const;
+
 	/** Get main and full tracks parameteres pairs
 	 * 
 	 * @param track_main - main track pair
@@ -67,12 +86,13 @@ public:
 	 */	
 	TrackXYPair get_track(bool type) const;
 
-private:
-	/** Calculate tracks coordinates using hits positions 
-	 * 
-	 * @param hits - hits positions of the track
-	 */	
-	void calculate_coordinates(const HitsPositions& hits);
+	/** Get measured coordinate on a plane
+	 * @param type - plane type (X1, Y1, X2, Y2, X3 or Y3)
+	 * @param value - returns coordinate (mm)
+	 * @return <tt>true</tt> if the coordinate is found on the plane,
+	 * <tt>false</tt> otherwise
+	 */
+	bool coordinate( StripGeometryType type, double& value) const;
 
 	/** Check if it is a one single of multistrip cluster on a plane
 	 * 
@@ -81,11 +101,25 @@ private:
 	 * @param end - end iterator of the cluster
 	 * if <tt>end</tt> = <tt>si_plane_hits.begin()</tt> it is a single strip cluster
 	 * 
-	 * @return 0 if it is a one single of multistrip cluster, -1 otherwise
+	 * @return 0 if it is a one single of multistrip cluster, 1 if there
+	 * are no hits, -1 otherwise
 	 */	
-	int check_one_cluster( const HitsVector& si_plane_hits,
+	static int check_one_cluster( const HitsVector& si_plane_hits,
 		HitsVector::const_iterator& begin,
-		HitsVector::const_iterator& end) const;
+		HitsVector::const_iterator& end);
+
+private:
+	/** Calculate tracks coordinates using hits positions 
+	 * 
+	 * @param hits - hits positions of the track
+	 */	
+	void calculate_coordinates(const HitsPositions& hits);
+
+	/** Correct in-plane rotations of the station planes
+	 * @param station - station index from 0
+	 */
+	void correct_rotation(int station);
+
 	
 	/** Check if the full track within a trajectory
 	 */
@@ -129,6 +163,17 @@ private:
 	 */
 	int find_coordinate( StripGeometryType, const HitsVector& si_plane_hits);
 
+	/** Find coordinate of the track on the plane known at compile time,
+	 * the plane sign and station are resolved by PlaneTraits
+	 * 
+	 * @param plane_hits - hits data on the plane
+	 * 
+	 * @return 0 if coordinates are found, 1 if there are no hits on the plane
+	 * -1 in sace of an error
+	 */
+	template <StripGeometryType T>
+	int find_coordinate(const HitsVector& si_plane_hits);
+
 	/** Calculate main track coordinates
 	 * @param type - <tt>true</tt> of X0Z axis, <tt>false</tt> of Y0Z axis, 
 	 */
@@ -139,12 +184,9 @@ private:
 	 */	
 	void calculate_full_track(bool);
 
-	std::pair< double, double> xy1_; // coordinate
-	std::pair< bool, bool> xy1_ok_; // state
-	std::pair< double, double> xy2_; // coordinate
-	std::pair< bool, bool> xy2_ok_; // state
-	std::pair< double, double> xy3_; // coordinate
-	std::pair< bool, bool> xy3_ok_; // state
+	// XY stations from the first one
+	std::pair< double, double> xy_[TREC_NUMBER_OF_STATIONS]; // coordinate
+	std::pair< bool, bool> xy_ok_[TREC_NUMBER_OF_STATIONS]; // state
 
 	TrackXYPair main_track_;
 	TrackXYPair full_track_;
@@ -166,4 +208,21 @@ TrackCoordinates::get_track(bool type) const
 	return type ? full_track_ : main_track_;
 }
 
+inline
+bool
+TrackCoordinates::coordinate( StripGeometryType type, double& value) const
+{
+	int i = StripGeometry::index(type);
+	if (i == -1 || plane_metadata_[i].station == 0)
+		return false;
+
+	int s = plane_metadata_[i].station - 1;
+	if (plane_metadata_[i].y_axis) {
+		value = xy_[s].second;
+		return xy_ok_[s].second;
+	}
+	value = xy_[s].first;
+	return xy_ok_[s].first;
+}
+
 } // namespace TREC
@@ -0,0 +1,168 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+
+#include "trec_track.hh"
+#include "trec_system_configure.hh"
+#include "trec_clear_beam_cache.hh"
+#include "trec_reconstruction_image.hh"
+
+namespace TREC {
+
+/** Running mean and variance (Welford algorithm)
+ */
+struct RunningStatistics {
+	RunningStatistics() : n(0.0), mean(0.0), m2(0.0) {}
+
+	/** Add value
+	 */
+	void add(double x);
+
+	/** Add statistics of another set of values (Chan et al.)
+	 */
+	void merge(const RunningStatistics& src);
+
+	/** Standard deviation of the values
+	 */
+	double sigma() const { return (n > 1.0) ? std::sqrt(m2 / (n - 1.0)) : 0.0; }
+
+	/** Check if value within [mean - k * sigma, mean + k * sigma]
+	 */
+	bool within( double x, double k) const;
+
+	double n;
+	double mean;
+	double m2; // sum of squares of differences from the mean
+};
+
+/** Class TracksCuts reconstructs 2D image with the cuts on track angles
+ * and calorimeter slice. A track is rejected if one of its X0Z angle,
+ * Y0Z angle or slice is outside of +-N sigma of the pixel distribution.
+ *
+ * First streaming pass projects tracks into a compact cache and gathers
+ * per-pixel mean and variance, second pass applies the cuts on the cache.
+ * Both passes are parallel.
+ */
+class TracksCuts {
+public:
+	/** Constructor
+	 * @param binning - image binning
+	 * @param object_slice_min - minimum slice number of calorimeter
+	 * with object exposure
+	 * @param clear_slice_max - maximum slice number of calorimeter
+	 * without object exposure
+	 * @param sigmas - cut width in number of sigmas
+	 * @param conf - calibration configuration
+	 */
+	TracksCuts( const ImageBinning& binning,
+		int object_slice_min, int clear_slice_max, double sigmas = 3.0,
+		SharedConf conf = SystemConfigure::instance());
+
+	/** Reconstruct image with the cuts
+	 * @param tracks - vector of full track pairs
+	 * @param threads - number of threads, 0 for all hardware threads
+	 */
+	void reconstruct( const FullTracksVector& tracks,
+		unsigned int threads = 0);
+
+	/** Reconstruct image of a mixed-energy run with the cuts, the slice
+	 * cut and PSET use the sub-slice calorimeter peak of each event
+	 * shifted to the configuration energy, tracks without tag are
+	 * taken as is
+	 * @param tracks - vector of full track pairs
+	 * @param tags - event tags of the tracks
+	 * @param threads - number of threads, 0 for all hardware threads
+	 */
+	void reconstruct( const FullTracksVector& tracks,
+		const EventTagsVector& tags, unsigned int threads = 0);
+
+	/** Get reconstructed image (accepted tracks only)
+	 */
+	ReconstructionImage image() const { return accumulator_.image(); }
+
+	/** Number of accepted tracks
+	 */
+	size_t accepted() const { return accumulator_.entries(); }
+
+	/** Number of tracks rejected by the angles cut
+	 */
+	size_t rejected_angle() const { return rejected_angle_; }
+
+	/** Number of tracks rejected by the calorimeter slice cut
+	 */
+	size_t rejected_slice() const { return rejected_slice_; }
+
+private:
+	enum {
+		ANGLE_X,
+		ANGLE_Y,
+		SLICE,
+		VALUES
+	};
+
+	/** First pass: project tracks and gather per-pixel statistics
+	 */
+	void gather( const FullTracksVector& tracks,
+		const EventTagsVector& tags, unsigned int threads);
+
+	/** Second pass: apply cuts and accumulate accepted tracks
+	 */
+	void apply(unsigned int threads);
+
+	SharedConf conf_;
+	ClearBeamCache cache_;
+	ImageAccumulator accumulator_;
+	int object_pos_min_;
+	int clear_pos_max_;
+	double sigmas_;
+	size_t rejected_angle_;
+	size_t rejected_slice_;
+
+	// per-pixel statistics [pixel * VALUES + value]
+	std::vector<RunningStatistics> statistics_;
+
+	// compact projected tracks cache
+	std::vector<int> pixel_;
+	std::vector<float> angle_x_;
+	std::vector<float> angle_y_;
+	std::vector<float> slice_; // slice at the configuration energy
+};
+
+inline
+void
+RunningStatistics::add(double x)
+{
+	n += 1.0;
+	double delta = x - mean;
+	mean += delta / n;
+	m2 += delta * (x - mean);
+}
+
+inline
+bool
+RunningStatistics::within( double x, double k) const
+{
+	return std::fabs(x - mean) <= k * sigma();
+}
+
+} // namespace TREC
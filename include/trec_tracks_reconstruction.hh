@@ -21,6 +21,7 @@
 
 #include "trec_defines.hh"
 #include "trec_track.hh"
+#include "trec_system_configure.hh"
 
 class TH1I;
 class TH1D;
@@ -44,12 +45,14 @@ public:
 	* @param size_y2 - maximum y coordinate
 	* @param bin_x - number of bins along x axis
 	* @param bin_y - number of bins along y axis
+	* @param conf - calibration configuration
 	*/
 	TracksReconstruction( const MainTracksVector& main_tracks_object,
 		const FullTracksVector& full_tracks_object,
 		double size_x1, double size_x2,
 		double size_y1, double size_y2,
-		int bin_x, int bin_y);
+		int bin_x, int bin_y,
+		SharedConf conf = SystemConfigure::instance());
 
 	virtual ~TracksReconstruction();
 
@@ -85,6 +88,7 @@ private:
 	 */
 	void form_object_tracks_data(const FullTracksVector& object_tracks);
 
+	SharedConf conf_;
 	const MainTracksVector& tracks_main_;
 	const FullTracksVector& tracks_full_;
 	TH1I* clear_slice_;
@@ -111,8 +115,9 @@ inline
 TracksReconstruction::TracksReconstruction( const MainTracksVector& main,
 	const FullTracksVector& full,
 	double pos_x1, double pos_x2, double pos_y1,
-		double pos_y2, int bins_x, int bins_y)
+		double pos_y2, int bins_x, int bins_y, SharedConf conf)
 	:
+	conf_(conf),
 	tracks_main_(main),
 	tracks_full_(full),
 	clear_slice_(0),
@@ -0,0 +1,45 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#pragma once
+
+namespace TREC {
+
+/** Units of the library, same values as CLHEP units of Geant4
+ * (millimeter, radian and MeV are 1), so values can be passed
+ * to and from Geant4 without conversion
+ */
+namespace units {
+
+constexpr double millimeter = 1.0;
+constexpr double mm = millimeter;
+constexpr double um = 1e-3 * millimeter;
+constexpr double cm = 10.0 * millimeter;
+constexpr double m = 1000.0 * millimeter;
+
+constexpr double radian = 1.0;
+constexpr double rad = radian;
+constexpr double mrad = 1e-3 * radian;
+constexpr double deg = 3.14159265358979323846 / 180.0 * radian;
+
+constexpr double MeV = 1.0;
+
+} // namespace units
+
+} // namespace TREC
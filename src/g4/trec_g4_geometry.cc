@@ -0,0 +1,91 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <string>
+
+#include "trec_strip_geometry.hh"
+
+namespace {
+
+const std::string Silicon("Silicon");
+const std::string Log("Log");
+const std::string Phys("Phys");
+const std::string Parallel("Parallel");
+const std::string Division("Division");
+const std::string Sensitive("Sensitive");
+const std::string Detector("Detector");
+
+const int planes = TREC_NUMBER_OF_SILICON_DETECTORS;
+
+} // namespace
+
+namespace TREC {
+
+StripGeometryMap
+StripGeometry::create()
+{
+	StripGeometryMap map;
+
+	const StripGeometry* geometry = geometries();
+	for ( int i = 0; i < planes; ++i) {
+		StripGeometryType type = plane_metadata_[i].type;
+		map[type] = StripGeometryPair( geometry[i], create(type));
+	}
+
+	return map;
+}
+
+StripNamesMap
+StripGeometry::create_names()
+{
+	StripNamesMap map;
+
+	for ( int i = 0; i < planes; ++i) {
+		StripGeometryType type = plane_metadata_[i].type;
+		map[type] = create(type);
+	}
+
+	return map;
+}
+
+StripGeometryNames
+StripGeometry::create(StripGeometryType type)
+{
+	StripGeometryNames names;
+	int i = index(type);
+	if (i == -1)
+		return names; // error - no value
+
+	const std::string value(plane_metadata_[i].name);
+	names.body_name = Silicon + value;
+	names.logical_name = Silicon + value + Log;
+	names.physical_name = Silicon + value + Phys;
+	names.parallel_body_name = Silicon + value + Parallel;
+	names.parallel_logical_name = Silicon + value + Log + Parallel;
+	names.parallel_physical_name = Silicon + value + Phys + Parallel;
+	names.body_devision_name = Silicon + value + Division + Parallel;
+	names.logical_devision_name = Silicon + value + Log + Division + Parallel;
+	names.physical_devision_name = Silicon + value + Phys + Division + Parallel;
+	names.functional_detector_name = Detector + value;
+	names.sensitive_detector_name = Sensitive + Detector + value;
+
+	return names;
+}
+
+} // namespace TREC
@@ -0,0 +1,197 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#include <G4Step.hh>
+#include <G4VTouchable.hh>
+#include <G4VPhysicalVolume.hh>
+#include <G4LogicalVolume.hh>
+#include <G4LogicalVolumeStore.hh>
+#include <G4SDManager.hh>
+
+#include "trec_g4_sensitive_detector.hh"
+
+namespace {
+
+const int planes = TREC_NUMBER_OF_SILICON_DETECTORS;
+const unsigned int adc_max = 65535;
+
+} // namespace
+
+namespace TREC {
+
+TrackerSensitiveDetector::TrackerSensitiveDetector( const G4String& name,
+	SharedSink sink, const G4String& calorimeter,
+	const DigitizerParameters& parameters, SharedConf conf)
+	:
+	G4VSensitiveDetector(name),
+	sink_(sink),
+	conf_(conf),
+	parameters_(parameters),
+	digitizer_(parameters),
+	slices_( conf->calorimeter_slices(), 0.0)
+{
+	StripNamesMap names = StripGeometry::create_names();
+	for ( int i = 0; i < planes; ++i) {
+		const StripGeometryNames& n = names[plane_metadata_[i].type];
+		names_[n.logical_name] = i;
+		names_[n.logical_devision_name] = i;
+	}
+	names_[calorimeter] = CALORIMETER;
+
+	batch_.reserve(parameters_.batch_size);
+}
+
+TrackerSensitiveDetector::~TrackerSensitiveDetector()
+{
+	flush();
+}
+
+TrackerSensitiveDetector*
+TrackerSensitiveDetector::attach( const G4String& name, SharedSink sink,
+	const G4String& calorimeter, const DigitizerParameters& parameters,
+	SharedConf conf)
+{
+	TrackerSensitiveDetector* detector = new TrackerSensitiveDetector( name,
+		sink, calorimeter, parameters, conf);
+	G4SDManager::GetSDMpointer()->AddNewDetector(detector);
+
+	// logical volumes are shared, their detectors are per thread
+	G4LogicalVolumeStore* store = G4LogicalVolumeStore::GetInstance();
+	StripNamesMap names = StripGeometry::create_names();
+	for ( StripNamesMap::const_iterator it = names.begin();
+		it != names.end(); ++it) {
+		G4LogicalVolume* volume = store->GetVolume( it->second.logical_name, false);
+		if (!volume)
+			volume = store->GetVolume( it->second.logical_devision_name, false);
+		if (volume)
+			volume->SetSensitiveDetector(detector);
+		else
+			std::cerr << "No logical volume of plane " <<
+				StripGeometry::name(it->first) << std::endl;
+	}
+
+	G4LogicalVolume* volume = store->GetVolume( calorimeter, false);
+	if (volume)
+		volume->SetSensitiveDetector(detector);
+	else
+		std::cerr << "No calorimeter logical volume " << calorimeter << std::endl;
+
+	return detector;
+}
+
+bool
+TrackerSensitiveDetector::flush(const G4String& name)
+{
+	TrackerSensitiveDetector* detector = dynamic_cast<TrackerSensitiveDetector *>(
+		G4SDManager::GetSDMpointer()->FindSensitiveDetector( name, false));
+	if (!detector)
+		return false;
+
+	detector->flush();
+	return true;
+}
+
+void
+TrackerSensitiveDetector::Initialize(G4HCofThisEvent*)
+{
+	// deposits of the aborted event
+	digitizer_.clear();
+	std::fill( slices_.begin(), slices_.end(), 0.0);
+}
+
+int
+TrackerSensitiveDetector::volume_index(const G4LogicalVolume* volume)
+{
+	std::map< const G4LogicalVolume*, int>::const_iterator it = volumes_.find(volume);
+	if (it != volumes_.end())
+		return it->second;
+
+	std::map< std::string, int>::const_iterator n = names_.find(volume->GetName());
+	int index = (n != names_.end()) ? n->second : NOT_SENSITIVE;
+	volumes_[volume] = index;
+	return index;
+}
+
+G4bool
+TrackerSensitiveDetector::ProcessHits( G4Step* step, G4TouchableHistory*)
+{
+	double edep = step->GetTotalEnergyDeposit();
+	if (edep <= 0.0)
+		return false;
+
+	const G4StepPoint* pre = step->GetPreStepPoint();
+	const G4VTouchable* touchable = pre->GetTouchable();
+	int index = volume_index(touchable->GetVolume()->GetLogicalVolume());
+
+	if (index == CALORIMETER) {
+		int slice = touchable->GetReplicaNumber();
+		if (slice >= 0 && slice < int(slices_.size()))
+			slices_[slice] += edep;
+		return true;
+	}
+	if (index == NOT_SENSITIVE)
+		return false;
+
+	// Geant4 length unit is mm as the library one
+	G4ThreeVector position = 0.5 * (pre->GetPosition() +
+		step->GetPostStepPoint()->GetPosition());
+	digitizer_.add( index, position.x(), position.y(), edep);
+	return true;
+}
+
+void
+TrackerSensitiveDetector::EndOfEvent(G4HCofThisEvent*)
+{
+	batch_.push_back(HitsPositions());
+	HitsPositions& hits = batch_.back();
+
+	digitizer_.digitize(hits);
+
+	deposits_.resize(slices_.size());
+	for ( size_t s = 0; s < slices_.size(); ++s) {
+		double adc = std::floor(slices_[s] / parameters_.adc_unit + 0.5);
+		deposits_[s] = static_cast<unsigned short>(std::min( adc, double(adc_max)));
+		slices_[s] = 0.0;
+	}
+	// binary slice hits are formed above the threshold, so low
+	// deposits of the secondaries don't move the stop slice
+	double threshold = std::ceil(parameters_.calorimeter_threshold /
+		parameters_.adc_unit);
+	hits.add_calorimeter_deposits( deposits_, static_cast<unsigned short>(
+		std::min( std::max( threshold, 1.0), double(adc_max))));
+
+	if (batch_.size() >= parameters_.batch_size)
+		flush();
+}
+
+void
+TrackerSensitiveDetector::flush()
+{
+	if (batch_.empty())
+		return;
+
+	sink_->write(batch_);
+	batch_.clear();
+}
+
+} // namespace TREC
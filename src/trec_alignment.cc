@@ -0,0 +1,332 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "trec_parallel.hh"
+#include "trec_track_coordinates.hh"
+#include "trec_alignment.hh"
+
+namespace {
+
+const TREC::StripGeometryType reference[4] = {
+	TREC::MSD_X1, TREC::MSD_Y1, TREC::MSD_X2, TREC::MSD_Y2
+};
+
+bool
+y_plane(TREC::StripGeometryType type)
+{
+	int i = TREC::StripGeometry::index(type);
+	return (i != -1 && TREC::plane_metadata_[i].y_axis);
+}
+
+/** Solve linear system by Gauss elimination with partial pivoting
+ * @param a - matrix n x n, destroyed
+ * @param b - right side, returns solution
+ * @return <tt>false</tt> if the matrix is singular
+ */
+bool
+solve_system( std::vector<double>& a, std::vector<double>& b, size_t n)
+{
+	for ( size_t k = 0; k < n; ++k) {
+		size_t p = k;
+		for ( size_t i = k + 1; i < n; ++i) {
+			if (std::fabs(a[i * n + k]) > std::fabs(a[p * n + k]))
+				p = i;
+		}
+		if (std::fabs(a[p * n + k]) < 1e-12)
+			return false;
+
+		if (p != k) {
+			for ( size_t j = 0; j < n; ++j)
+				std::swap( a[k * n + j], a[p * n + j]);
+			std::swap( b[k], b[p]);
+		}
+
+		for ( size_t i = k + 1; i < n; ++i) {
+			double f = a[i * n + k] / a[k * n + k];
+			for ( size_t j = k; j < n; ++j)
+				a[i * n + j] -= f * a[k * n + j];
+			b[i] -= f * b[k];
+		}
+	}
+
+	for ( size_t k = n; k-- > 0; ) {
+		double s = b[k];
+		for ( size_t j = k + 1; j < n; ++j)
+			s -= a[k * n + j] * b[j];
+		b[k] = s / a[k * n + k];
+	}
+	return true;
+}
+
+} // namespace
+
+namespace TREC {
+
+Alignment::Alignment( const std::vector<StripGeometryType>& planes,
+	double max_residual)
+	:
+	planes_(planes),
+	max_residual_(max_residual)
+{
+	if (planes_.empty()) {
+		planes_.push_back(MSD_X3);
+		planes_.push_back(MSD_Y3);
+	}
+
+	for ( int k = 0; k < 4; ++k)
+		ref_z_[k] = StripGeometry::transform(reference[k])->z;
+
+	for ( size_t p = 0; p < planes_.size(); ++p)
+		z_.push_back(StripGeometry::transform(planes_[p])->z);
+
+	u_.resize(planes_.size());
+	shift_.assign( planes_.size(), 0.0);
+	rotation_.assign( planes_.size(), 0.0);
+}
+
+size_t
+Alignment::add_events( const HitsPositionsVector& hits, unsigned int threads)
+{
+	threads = worker_threads(threads);
+
+	size_t planes = planes_.size();
+	size_t width = 4 + planes;
+
+	if (base_.empty()) {
+		for ( size_t p = 0; p < planes; ++p)
+			base_.push_back(*StripGeometry::get(planes_[p]));
+	}
+	std::vector< std::vector<double> > local(threads);
+
+	parallel_for( hits.size(), threads,
+		[&]( size_t begin, size_t end, unsigned int t) {
+		std::vector<double>& rows = local[t];
+		std::vector<double> row(width);
+
+		for ( size_t i = begin; i < end; ++i) {
+			TrackCoordinates coords(hits[i]);
+
+			bool ok = true;
+			for ( int k = 0; k < 4 && ok; ++k)
+				ok = coords.coordinate( reference[k], row[k]);
+			for ( size_t p = 0; p < planes && ok; ++p)
+				ok = coords.coordinate( planes_[p], row[4 + p]);
+
+			if (ok)
+				rows.insert( rows.end(), row.begin(), row.end());
+		}
+	});
+
+	size_t added = 0;
+	for ( size_t t = 0; t < local.size(); ++t) {
+		const std::vector<double>& rows = local[t];
+		for ( size_t r = 0; r < rows.size(); r += width) {
+			for ( int k = 0; k < 4; ++k)
+				ref_[k].push_back(rows[r + k]);
+			for ( size_t p = 0; p < planes; ++p)
+				u_[p].push_back(rows[r + 4 + p]);
+			++added;
+		}
+	}
+	return added;
+}
+
+bool
+Alignment::iterate(unsigned int threads)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	Clock::time_point start = Clock::now();
+	threads = worker_threads(threads);
+
+	size_t planes = planes_.size();
+	size_t n = 2 * planes; // shift and rotation of each plane
+
+	struct Sums {
+		std::vector<double> a;
+		std::vector<double> b;
+		double ssq;
+		size_t count;
+		size_t tracks;
+	};
+	std::vector<Sums> sums(threads);
+
+	// X1 and X2, Y1 and Y2 positions are used for the prediction
+	double zx1 = ref_z_[0], zy1 = ref_z_[1];
+	double dzx = ref_z_[2] - zx1, dzy = ref_z_[3] - zy1;
+
+	parallel_for( tracks(), threads,
+		[&]( size_t begin, size_t end, unsigned int t) {
+		Sums& s = sums[t];
+		s.a.assign( n * n, 0.0);
+		s.b.assign( n, 0.0);
+		s.ssq = 0.0;
+		s.count = 0;
+		s.tracks = 0;
+
+		for ( size_t i = begin; i < end; ++i) {
+			double ax = (ref_[2][i] - ref_[0][i]) / dzx;
+			double ay = (ref_[3][i] - ref_[1][i]) / dzy;
+			bool used = false;
+
+			for ( size_t p = 0; p < planes; ++p) {
+				double z = z_[p];
+				double x = ref_[0][i] + ax * (z - zx1);
+				double y = ref_[1][i] + ay * (z - zy1);
+
+				bool yp = y_plane(planes_[p]);
+				double r = u_[p][i] - (yp ? y : x);
+				if (std::fabs(r) > max_residual_)
+					continue;
+
+				// derivatives by the shift and the rotation
+				double d0 = 1.0, d1 = yp ? -x : y;
+				size_t k = 2 * p;
+				s.a[k * n + k] += d0 * d0;
+				s.a[k * n + k + 1] += d0 * d1;
+				s.a[(k + 1) * n + k] += d1 * d0;
+				s.a[(k + 1) * n + k + 1] += d1 * d1;
+				s.b[k] += d0 * r;
+				s.b[k + 1] += d1 * r;
+				s.ssq += r * r;
+				s.count++;
+				used = true;
+			}
+			if (used)
+				s.tracks++;
+		}
+	});
+
+	std::vector<double> a( n * n, 0.0), b( n, 0.0);
+	double ssq = 0.0;
+	size_t count = 0, used = 0;
+	for ( size_t t = 0; t < sums.size(); ++t) {
+		if (sums[t].a.empty())
+			continue;
+		for ( size_t k = 0; k < n * n; ++k)
+			a[k] += sums[t].a[k];
+		for ( size_t k = 0; k < n; ++k)
+			b[k] += sums[t].b[k];
+		ssq += sums[t].ssq;
+		count += sums[t].count;
+		used += sums[t].tracks;
+	}
+
+	if (!solve_system( a, b, n)) {
+		std::cerr << "Alignment system is singular" << std::endl;
+		return false;
+	}
+
+	// corrections of the cached coordinates
+	parallel_for( tracks(), threads,
+		[&]( size_t begin, size_t end, unsigned int) {
+		for ( size_t i = begin; i < end; ++i) {
+			double ax = (ref_[2][i] - ref_[0][i]) / dzx;
+			double ay = (ref_[3][i] - ref_[1][i]) / dzy;
+			for ( size_t p = 0; p < planes; ++p) {
+				double z = z_[p];
+				if (y_plane(planes_[p])) {
+					double x = ref_[0][i] + ax * (z - zx1);
+					u_[p][i] -= b[2 * p] - b[2 * p + 1] * x;
+				}
+				else {
+					double y = ref_[1][i] + ay * (z - zy1);
+					u_[p][i] -= b[2 * p] + b[2 * p + 1] * y;
+				}
+			}
+		}
+	});
+
+	double correction = 0.0;
+	for ( size_t p = 0; p < planes; ++p) {
+		shift_[p] += b[2 * p];
+		rotation_[p] += b[2 * p + 1];
+		correction = std::max( correction, std::fabs(b[2 * p]));
+	}
+
+	std::chrono::duration<double> elapsed = Clock::now() - start;
+
+	AlignmentReport report;
+	report.iteration = reports_.size() + 1;
+	report.tracks = used;
+	report.rms = count ? std::sqrt(ssq / count) : 0.0;
+	report.correction = correction;
+	report.seconds = elapsed.count();
+	reports_.push_back(report);
+
+	std::cout << "Alignment iteration " << report.iteration << ": ";
+	std::cout << report.tracks << " tracks, residual RMS " << report.rms;
+	std::cout << " mm, correction " << report.correction << " mm, ";
+	std::cout << report.seconds << " s" << std::endl;
+
+	return true;
+}
+
+bool
+Alignment::solve( int iterations, double tolerance, unsigned int threads)
+{
+	for ( int i = 0; i < iterations; ++i) {
+		if (!iterate(threads))
+			return false;
+		if (reports_.back().correction < tolerance)
+			return true;
+	}
+	return false;
+}
+
+bool
+Alignment::corrections( StripGeometryType type, double& shift,
+	double& rotation) const
+{
+	for ( size_t p = 0; p < planes_.size(); ++p) {
+		if (planes_[p] == type) {
+			shift = shift_[p];
+			rotation = rotation_[p];
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+Alignment::apply() const
+{
+	for ( size_t p = 0; p < base_.size(); ++p) {
+		const PlaneTransform* t = StripGeometry::transform(planes_[p]);
+		StripGeometry geometry = base_[p];
+
+		// coordinate = sign * (origin + strip * pitch)
+		geometry.dx -= t->sign * shift_[p];
+		geometry.angle_diff += rotation_[p];
+		StripGeometry::set( planes_[p], geometry);
+	}
+}
+
+bool
+Alignment::save(const char* filename) const
+{
+	return StripGeometry::save(filename);
+}
+
+} // namespace TREC
@@ -0,0 +1,386 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+#include "trec_parallel.hh"
+#include "trec_calibration.hh"
+
+namespace {
+
+// first word of the calibration file ("TRECCALB")
+const unsigned long long calibration_format = 0x5452454343414C42ULL;
+const unsigned int calibration_version = 1;
+const unsigned long long max_points = 100000;
+
+// calorimeter slice = 1.5 mm in G4_POLYSTYRENE
+const TREC::CalibrationPoint ps_epdata[] = {
+	{ 180.0, 44 },
+	{ 280.0, 96 },
+	{ 380.0, 159 },
+	{ 455.0, 213 },
+	{ 480.0, 232 }
+};
+
+// calorimeter slice = 1.5 mm in G4_WATER
+const TREC::CalibrationPoint water_epdata[] = {
+	{ 180.0, 46 },
+	{ 280.0, 100 },
+	{ 380.0, 166 },
+	{ 455.0, 223 },
+	{ 480.0, 243 }
+};
+
+// (455 MeV/u) G4_POLYSTYRENE object and calorimeter
+const TREC::CalibrationPoint ps_ps_tpdata[] = {
+	{ 3.0, 193 },
+	{ 6.0, 173 },
+	{ 10.0, 147 },
+	{ 15.0, 113 },
+	{ 20.0, 80 },
+	{ 25.0, 47 },
+	{ 30.0, 13 }
+};
+
+// (455 MeV/u) G4_POLYSTYRENE object and G4_WATER calorimeter
+const TREC::CalibrationPoint ps_water_tpdata[] = {
+	{ 6.0, 173 },
+	{ 10.0, 153 },
+	{ 20.0, 84 },
+	{ 25.0, 49 },
+	{ 30.0, 14 }
+};
+
+template<size_t N>
+TREC::CalibrationPointsVector
+table(const TREC::CalibrationPoint (&data)[N])
+{
+	return TREC::CalibrationPointsVector( data, data + N);
+}
+
+bool
+write_table( std::ofstream& file, const TREC::CalibrationPointsVector& points)
+{
+	unsigned long long n = points.size();
+	file.write( (char *)&n, sizeof(n));
+	if (n)
+		file.write( (char *)&points[0], n * sizeof(TREC::CalibrationPoint));
+	return file.good();
+}
+
+bool
+read_table( std::ifstream& file, TREC::CalibrationPointsVector& points)
+{
+	unsigned long long n = 0;
+	file.read( (char *)&n, sizeof(n));
+	if (!file.good() || n > max_points)
+		return false;
+
+	points.resize(n);
+	if (n)
+		file.read( (char *)&points[0], n * sizeof(TREC::CalibrationPoint));
+	return file.good();
+}
+
+bool
+point_less( const TREC::CalibrationPoint& p1, const TREC::CalibrationPoint& p2)
+{
+	return p1.value < p2.value;
+}
+
+/** Sort points by value, points of the same value are averaged
+ */
+void
+merge_points(TREC::CalibrationPointsVector& points)
+{
+	std::sort( points.begin(), points.end(), point_less);
+
+	TREC::CalibrationPointsVector merged;
+	for ( size_t i = 0; i < points.size(); ) {
+		size_t j = i;
+		double sum = 0.0;
+		for ( ; j < points.size() && points[j].value == points[i].value; ++j)
+			sum += points[j].position;
+
+		TREC::CalibrationPoint point = { points[i].value, sum / (j - i) };
+		merged.push_back(point);
+		i = j;
+	}
+	points.swap(merged);
+}
+
+} // namespace
+
+namespace TREC {
+
+bool
+CalibrationData::valid() const
+{
+	return (ps_energy.size() >= 3 && water_energy.size() >= 3 &&
+		ps_thickness.size() >= 2);
+}
+
+bool
+CalibrationData::save(const char* filename) const
+{
+	std::ofstream file( filename, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		std::cerr << "Can't open calibration file " << filename << std::endl;
+		return false;
+	}
+
+	file.write( (char *)&calibration_format, sizeof(calibration_format));
+	file.write( (char *)&calibration_version, sizeof(calibration_version));
+
+	bool ok = write_table( file, ps_energy) &&
+		write_table( file, water_energy) &&
+		write_table( file, ps_thickness) &&
+		write_table( file, water_thickness);
+
+	if (!ok)
+		std::cerr << "Can't write calibration file " << filename << std::endl;
+	return ok;
+}
+
+bool
+CalibrationData::load(const char* filename)
+{
+	std::ifstream file( filename, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	unsigned long long format = 0;
+	unsigned int version = 0;
+	file.read( (char *)&format, sizeof(format));
+	file.read( (char *)&version, sizeof(version));
+	if (format != calibration_format)
+		return false; // not a calibration file
+
+	if (version != calibration_version) {
+		std::cerr << "Unknown calibration file version " << version << std::endl;
+		return false;
+	}
+
+	CalibrationData data;
+	bool ok = read_table( file, data.ps_energy) &&
+		read_table( file, data.water_energy) &&
+		read_table( file, data.ps_thickness) &&
+		read_table( file, data.water_thickness);
+
+	if (!ok || !data.valid()) {
+		std::cerr << "Calibration file " << filename << " is corrupted" << std::endl;
+		return false;
+	}
+
+	*this = data;
+	return true;
+}
+
+CalibrationData
+CalibrationData::builtin()
+{
+	CalibrationData data;
+	data.ps_energy = table(ps_epdata);
+	data.water_energy = table(water_epdata);
+	data.ps_thickness = table(ps_ps_tpdata);
+	data.water_thickness = table(ps_water_tpdata);
+	return data;
+}
+
+CalibrationFit::CalibrationFit()
+	:
+	intercept_(0.0),
+	slope_(0.0)
+{
+}
+
+void
+CalibrationFit::add_run( const char* filename, CalibrationRunType type,
+	double value, bool water)
+{
+	CalibrationRun run;
+	run.filename = filename;
+	run.type = type;
+	run.value = value;
+	run.water = water;
+	run.peak = -1.0;
+	run.events = 0;
+	run.loaded = false;
+	run.ok = false;
+
+	runs_.push_back(run);
+}
+
+double
+CalibrationFit::bragg_peak( const HitsPositionsVector& hits, size_t& events)
+{
+	std::vector<size_t> profile;
+	events = 0;
+
+	for ( size_t i = 0; i < hits.size(); ++i) {
+		int pos = hits[i].calorimeter_position();
+		if (pos < 0)
+			continue;
+		if (size_t(pos) >= profile.size())
+			profile.resize( pos + 1, 0);
+		profile[pos]++;
+		events++;
+	}
+
+	if (!events)
+		return -1.0;
+
+	size_t m = std::distance( profile.begin(),
+		std::max_element( profile.begin(), profile.end()));
+
+	// parabola through the maximum and its neighbours
+	double delta = 0.0;
+	if (m > 0 && m + 1 < profile.size()) {
+		double c1 = profile[m - 1], c2 = profile[m], c3 = profile[m + 1];
+		double d = c1 - 2.0 * c2 + c3;
+		if (d < 0.0)
+			delta = 0.5 * (c1 - c3) / d;
+	}
+
+	return m + delta + 1.0;
+}
+
+bool
+CalibrationFit::fit(unsigned int threads)
+{
+	intercept_ = 0.0;
+	slope_ = 0.0;
+
+	// bregg peaks of the runs
+	parallel_for( runs_.size(), worker_threads(threads),
+		[&]( size_t begin, size_t end, unsigned int) {
+		for ( size_t i = begin; i < end; ++i) {
+			CalibrationRun& run = runs_[i];
+
+			HitsPositionsVector hits;
+			run.loaded = HitsPositions::load( run.filename.c_str(), hits);
+
+			run.peak = bragg_peak( hits, run.events);
+			run.ok = (run.loaded && run.peak >= 0.0);
+		}
+	});
+
+	data_ = CalibrationData();
+	for ( size_t i = 0; i < runs_.size(); ++i) {
+		const CalibrationRun& run = runs_[i];
+
+		std::cout << "Run " << run.filename << ": ";
+		if (!run.loaded) {
+			std::cout << "can't load hits file" << std::endl;
+			continue;
+		}
+		if (!run.ok) {
+			std::cout << "no calorimeter hits" << std::endl;
+			continue;
+		}
+		std::cout << run.value << ((run.type == CALIBRATION_ENERGY) ?
+			" MeV/u" : " cm") << ", peak " << run.peak << ", ";
+		std::cout << run.events << " events" << std::endl;
+
+		CalibrationPoint point = { run.value, run.peak };
+		if (run.type == CALIBRATION_ENERGY)
+			(run.water ? data_.water_energy : data_.ps_energy).push_back(point);
+		else
+			(run.water ? data_.water_thickness : data_.ps_thickness).push_back(point);
+	}
+
+	merge_points(data_.ps_energy);
+	merge_points(data_.water_energy);
+	merge_points(data_.ps_thickness);
+	merge_points(data_.water_thickness);
+
+	// the water calorimeter is optional, it is used for the WET only
+	if (data_.water_energy.empty()) {
+		std::cout << "No water calorimeter runs, built-in tables are used" << std::endl;
+		CalibrationData builtin = CalibrationData::builtin();
+		data_.water_energy = builtin.water_energy;
+		data_.water_thickness = builtin.water_thickness;
+	}
+
+	if (!data_.valid()) {
+		std::cerr << "Not enough calibration runs" << std::endl;
+		return false;
+	}
+
+	// energy model: bregg peak moves deeper with energy
+	for ( size_t i = 1; i < data_.ps_energy.size(); ++i) {
+		if (data_.ps_energy[i].position <= data_.ps_energy[i - 1].position) {
+			std::cerr << "Bregg peak position isn't increasing with energy at ";
+			std::cerr << data_.ps_energy[i].value << " MeV/u" << std::endl;
+			return false;
+		}
+	}
+
+	// thickness model: least squares line
+	const CalibrationPointsVector& t = data_.ps_thickness;
+	double n = t.size(), sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+	for ( size_t i = 0; i < t.size(); ++i) {
+		sx += t[i].value;
+		sy += t[i].position;
+		sxx += t[i].value * t[i].value;
+		sxy += t[i].value * t[i].position;
+	}
+	double det = n * sxx - sx * sx;
+	if (det == 0.0) {
+		std::cerr << "Thickness model fit failed" << std::endl;
+		return false;
+	}
+	slope_ = (n * sxy - sx * sy) / det;
+	intercept_ = (sy - slope_ * sx) / n;
+
+	std::cout << "Thickness model: position = " << intercept_ << " + ";
+	std::cout << slope_ << " * thickness" << std::endl;
+
+	if (slope_ >= 0.0) {
+		std::cerr << "Bregg peak position isn't decreasing with thickness" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool
+CalibrationFit::thickness_model( double& intercept, double& slope) const
+{
+	if (slope_ == 0.0)
+		return false;
+
+	intercept = intercept_;
+	slope = slope_;
+	return true;
+}
+
+bool
+CalibrationFit::save(const char* filename) const
+{
+	if (!data_.valid()) {
+		std::cerr << "Calibration isn't fitted" << std::endl;
+		return false;
+	}
+	return data_.save(filename);
+}
+
+} // namespace TREC
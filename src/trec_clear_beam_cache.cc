@@ -0,0 +1,97 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <algorithm>
+
+#include "trec_clear_beam_cache.hh"
+
+namespace TREC {
+
+ClearBeamCache::ClearBeamCache(SharedConf conf)
+	:
+	conf_(conf),
+	clear_reference_(conf->clear_position(conf->energy()))
+{
+}
+
+void
+ClearBeamCache::prepare(const EventTagsVector& tags)
+{
+	std::vector<double> energies;
+	double last = 0.0;
+	for ( size_t i = 0; i < tags.size(); ++i) {
+		double energy = tags[i].energy;
+		// events of a spill have the same energy
+		if (energy == 0.0 || energy == last)
+			continue;
+		last = energy;
+		if (tables_.find(energy) == tables_.end())
+			energies.push_back(energy);
+	}
+
+	prepare(energies);
+}
+
+bool
+ClearBeamCache::prepared(const EventTagsVector& tags) const
+{
+	double last = 0.0;
+	for ( size_t i = 0; i < tags.size(); ++i) {
+		double energy = tags[i].energy;
+		if (energy == 0.0 || energy == last)
+			continue;
+		last = energy;
+		if (tables_.find(energy) == tables_.end())
+			return false;
+	}
+	return true;
+}
+
+void
+ClearBeamCache::prepare(const std::vector<double>& values)
+{
+	std::vector<double> energies;
+	for ( size_t i = 0; i < values.size(); ++i) {
+		if (values[i] != 0.0 && tables_.find(values[i]) == tables_.end())
+			energies.push_back(values[i]);
+	}
+	std::sort( energies.begin(), energies.end());
+	energies.erase( std::unique( energies.begin(), energies.end()),
+		energies.end());
+
+	if (energies.empty())
+		return;
+
+	std::vector<double> positions(energies.size());
+	conf_->clear_positions( &energies[0], &positions[0], energies.size());
+
+	// PSET is linear in the slice, the energy shifts the clear bregg
+	// peak, so a table is the configuration table with a slice offset
+	int slices = conf_->calorimeter_slices();
+	for ( size_t e = 0; e < energies.size(); ++e) {
+		double offset = clear_reference_ - positions[e];
+		offsets_[energies[e]] = offset;
+		std::vector<double>& table = tables_[energies[e]];
+		table.resize(slices);
+		for ( int s = 0; s < slices; ++s)
+			table[s] = conf_->PSET(double(s) + offset);
+	}
+}
+
+} // namespace TREC
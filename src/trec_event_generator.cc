@@ -0,0 +1,221 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "trec_units.hh"
+#include "trec_parallel.hh"
+#include "trec_event_generator.hh"
+
+namespace {
+
+const double highland_energy = 13.6; // MeV
+const double ion_charge = 6.0; // carbon
+const double ion_nucleons = 12.0;
+const double nucleon_mass = 931.494; // MeV
+const double radiation_length = 413.1; // G4_POLYSTYRENE (mm)
+const size_t block_events = 4096; // events of one random stream
+
+/** SplitMix64 step, spreads seeds of the random streams
+ */
+uint64_t
+split_mix(uint64_t& state)
+{
+	uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+} // namespace
+
+namespace TREC {
+
+FastRandom::FastRandom(uint64_t seed)
+	:
+	spare_(0.0),
+	has_spare_(false)
+{
+	uint64_t state = seed;
+	s0_ = split_mix(state);
+	s1_ = split_mix(state);
+}
+
+ThicknessMap::ThicknessMap(const ImageBinning& pixels)
+	:
+	binning(pixels),
+	values( std::max( pixels.pixels(), 0), 0.0f)
+{
+}
+
+GeneratorParameters::GeneratorParameters()
+	:
+	beam_x(0.0),
+	beam_y(0.0),
+	beam_sigma(8.0),
+	divergence(0.001),
+	energy(0.0),
+	object_z(0.0),
+	efficiency(0.995),
+	cluster_two(0.2),
+	noise(0.001),
+	straggling(1.0),
+	scattering(true)
+{
+	double z_y;
+	image_plane( object_z, z_y);
+}
+
+EventGenerator::EventGenerator( const GeneratorParameters& parameters,
+	const ThicknessMap& object, SharedConf conf)
+	:
+	conf_(conf),
+	parameters_(parameters),
+	object_(object),
+	energy_((parameters.energy > 0.0) ? parameters.energy : conf->energy()),
+	slices_(conf->calorimeter_slices()),
+	planes_(2 * TREC_NUMBER_OF_STATIONS)
+{
+	clear_position_ = conf_->clear_position(energy_);
+
+	// PSET of the stop slice is linear in the slice
+	double pset_per_slice = (conf_->PSET( 1.0, energy_) -
+		conf_->PSET( 0.0, energy_)) * units::cm;
+	slices_per_mm_ = (pset_per_slice != 0.0) ? 1.0 / pset_per_slice : 0.0;
+
+	double t = energy_;
+	double pv = ion_nucleons * t * (t + 2.0 * nucleon_mass) / (t + nucleon_mass);
+	scattering_factor_ = highland_energy * ion_charge / pv;
+
+	// XY stations planes, transforms are copied so the generator
+	// doesn't depend on later geometry changes
+	for ( int i = 0; i < planes_; ++i) {
+		StripGeometryType type = station_plane( i / 2 + 1, i % 2 == 0);
+		types_[i] = type;
+		transforms_[i] = *StripGeometry::transform(type);
+		strips_[i] = StripGeometry::get(type)->strips;
+		y_axis_[i] = (i % 2 == 0);
+	}
+}
+
+void
+EventGenerator::generate( size_t events, HitsPositionsVector& hits,
+	uint64_t seed, unsigned int threads) const
+{
+	size_t offset = hits.size();
+	hits.resize(offset + events);
+
+	size_t blocks = (events + block_events - 1) / block_events;
+	parallel_for( blocks, worker_threads(threads),
+		[&]( size_t begin, size_t end, unsigned int) {
+		for ( size_t b = begin; b < end; ++b) {
+			FastRandom random(seed ^ (b * 0xD1B54A32D192ED03ULL));
+			size_t last = std::min( (b + 1) * block_events, events);
+			for ( size_t i = b * block_events; i < last; ++i)
+				generate( random, hits[offset + i]);
+		}
+	});
+}
+
+void
+EventGenerator::generate( FastRandom& random, HitsPositions& hits) const
+{
+	const GeneratorParameters& p = parameters_;
+
+	// track at z = 0 and its angles
+	double x0 = p.beam_x + p.beam_sigma * random.gauss();
+	double y0 = p.beam_y + p.beam_sigma * random.gauss();
+	double ax = p.divergence * random.gauss();
+	double ay = p.divergence * random.gauss();
+
+	// object crossing and multiple scattering kick
+	double zo = p.object_z;
+	double thickness = object_.thickness( x0 + ax * zo, y0 + ay * zo);
+	double kx = 0.0, ky = 0.0;
+	if (p.scattering && thickness > 0.0) {
+		double l = thickness / radiation_length;
+		double theta = scattering_factor_ * std::sqrt(l) *
+			(1.0 + 0.038 * std::log(l));
+		kx = theta * random.gauss();
+		ky = theta * random.gauss();
+	}
+
+	NumbersVector numbers;
+	for ( int i = 0; i < planes_; ++i) {
+		double z = transforms_[i].z;
+		double dz = std::max( z - zo, 0.0);
+		double x = x0 + ax * z + kx * dz;
+		double y = y0 + ay * z + ky * dz;
+
+		// measured coordinate with the in-plane rotation
+		const PlaneTransform& t = transforms_[i];
+		double u = y_axis_[i] ? (y * t.cos_angle - x * t.sin_angle) :
+			(x * t.cos_angle + y * t.sin_angle);
+
+		numbers.clear();
+		fire( random, i, u, numbers);
+		hits.add_plane_numbers( types_[i], numbers);
+	}
+
+	// stop slice of the ion
+	double stop = clear_position_ + thickness * slices_per_mm_ +
+		p.straggling * random.gauss();
+	int slice = std::min( static_cast<int>(std::floor(stop)), slices_ - 2);
+
+	HitsVector calorimeter( slices_, false);
+	if (slice >= 0)
+		std::fill( calorimeter.begin(), calorimeter.begin() + slice + 1, true);
+	hits.add_calorimeter_hits(calorimeter);
+}
+
+void
+EventGenerator::fire( FastRandom& random, int plane, double u,
+	NumbersVector& numbers) const
+{
+	const GeneratorParameters& p = parameters_;
+	const PlaneTransform& t = transforms_[plane];
+	int strips = strips_[plane];
+
+	if (random.uniform() < p.efficiency) {
+		double f = (t.sign * u - t.origin) / t.pitch;
+		int strip = static_cast<int>(std::floor(f + 0.5));
+		if (strip >= 0 && strip < strips) {
+			numbers.push_back(strip);
+
+			// charge sharing with the nearest neighbour strip
+			if (random.uniform() < p.cluster_two) {
+				int next = (f > strip) ? strip + 1 : strip - 1;
+				if (next >= 0 && next < strips)
+					numbers.push_back(next);
+			}
+		}
+	}
+
+	if (p.noise > 0.0 && random.uniform() < p.noise)
+		numbers.push_back(static_cast<unsigned int>(random.uniform() * strips));
+
+	if (numbers.size() > 1) {
+		std::sort( numbers.begin(), numbers.end());
+		numbers.erase( std::unique( numbers.begin(), numbers.end()),
+			numbers.end());
+	}
+}
+
+} // namespace TREC
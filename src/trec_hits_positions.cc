@@ -17,14 +17,95 @@
  * 
  */
 
+#include <iostream>
 #include <fstream>
+#include <streambuf>
+#include <cstring>
 #include <algorithm>
 #include <numeric>
+#include <stdint.h>
 
 #include "trec_defines.hh"
 #include "trec_constants.hh"
 #include "trec_strip_geometry.hh"
 #include "trec_hits_positions.hh"
+#include "trec_metrics.hh"
+
+namespace {
+
+// first 8 bytes of the file with event tags ("TRECTAGS"), then
+// 8 bytes tag size and 8 bytes number of events; plain file starts
+// with the number of events (size_t)
+const uint64_t tags_format = 0x5452454354414753ULL;
+
+// limits of the sizes in an event record, a bigger size means
+// a corrupted record
+const size_t calorimeter_slices_max = TREC_SIZE_CALORIMETER_THICKNESS * 1000 /
+	TREC_SIZE_CALORIMETER_SLICE_THICKNESS;
+const size_t tag_size_max = 4096;
+
+/** Check hits number of the plane in an event record
+ * @param index - plane index
+ * @param numsize - number of fired strips
+ * @return <tt>true</tt> if the plane exists and has so many strips,
+ * <tt>false</tt> otherwise
+ */
+bool
+valid_plane( unsigned int index, size_t numsize)
+{
+	const TREC::StripGeometry* geometry = (index < TREC_NUMBER_OF_SILICON_DETECTORS) ?
+		TREC::StripGeometry::geometries() + index : 0;
+	return geometry && numsize <= static_cast<size_t>(geometry->strips);
+}
+
+/** Read header of the hits file, with or without tags
+ * @param file - file stream at the beginning
+ * @param events - returns number of events
+ * @param tag_size - returns size of the tag, 0 for plain file
+ */
+void
+read_header( std::istream& file, size_t& events, size_t& tag_size)
+{
+	uint64_t format = 0;
+	file.read( (char *)&format, sizeof(format));
+	if (file.good() && format == tags_format) {
+		uint64_t size = 0, count = 0;
+		file.read( (char *)&size, sizeof(size));
+		file.read( (char *)&count, sizeof(count));
+		tag_size = size;
+		events = count;
+		return;
+	}
+
+	// plain file, the first word is shorter than 8 bytes
+	// if size_t is 32-bit
+	file.clear();
+	file.seekg(0);
+	tag_size = 0;
+	events = 0;
+	file.read( (char *)&events, sizeof(size_t));
+}
+
+/** Read only stream buffer of a memory block
+ */
+class MemoryBuffer : public std::streambuf {
+public:
+	void assign( const char* data, size_t size) {
+		char* p = const_cast<char*>(data);
+		setg( p, p, p + size);
+	}
+};
+
+/** Write only stream buffer of a memory block
+ */
+class OutputBuffer : public std::streambuf {
+public:
+	void assign( char* data, size_t size) {
+		setp( data, data + size);
+	}
+};
+
+} // namespace
 
 namespace TREC {
 
@@ -41,7 +122,8 @@ HitsPositions::HitsPositions(const HitsVector& calorimeter_hits)
 HitsPositions::HitsPositions(const HitsPositions& src)
 	:
 	strips_numbers_(src.strips_numbers_),
-	calorimeter_hits_(src.calorimeter_hits_)
+	calorimeter_hits_(src.calorimeter_hits_),
+	tag_(src.tag_)
 {
 }
 
@@ -54,7 +136,8 @@ HitsPositions::operator=(const HitsPositions& src)
 {
 	this->strips_numbers_ = src.strips_numbers_;
 	this->calorimeter_hits_ = src.calorimeter_hits_;
-	
+	this->tag_ = src.tag_;
+
 	return *this;
 }
 
@@ -83,6 +166,13 @@ HitsPositions::add_plane_hits( StripGeometryType type,
 	strips_numbers_[type] = num;
 }
 
+void
+HitsPositions::add_plane_numbers( StripGeometryType type,
+	const NumbersVector& numbers)
+{
+	strips_numbers_[type] = numbers;
+}
+
 void
 HitsPositions::add_calorimeter_hits(const HitsVector& hits)
 {
@@ -135,6 +225,56 @@ HitsPositions::calorimeter_empty() const
 	return (values == 0);
 }
 
+void
+HitsPositions::add_calorimeter_deposits( const DepositsVector& deposits,
+	unsigned short threshold)
+{
+	tag_.calorimeter_peak = deposits.empty() ? -1.0f :
+		distal_edge( &deposits[0], deposits.size());
+
+	if (calorimeter_empty()) {
+		calorimeter_hits_.resize(deposits.size());
+		for ( size_t i = 0; i < deposits.size(); ++i)
+			calorimeter_hits_[i] = (deposits[i] >= threshold);
+	}
+}
+
+float
+HitsPositions::distal_edge( const unsigned short* deposits, size_t n)
+{
+	// both loops are branch free and vectorized by the compiler
+	unsigned int peak = 0;
+	for ( size_t i = 0; i < n; ++i)
+		peak = std::max( peak, static_cast<unsigned int>(deposits[i]));
+
+	if (!peak)
+		return -1.0f;
+
+	// last slice at or above the half maximum
+	size_t last = 0;
+	for ( size_t i = 0; i < n; ++i)
+		last = (2u * deposits[i] >= peak) ? i : last;
+
+	if (last + 1 >= n)
+		return float(last); // edge is beyond the calorimeter
+
+	// linear interpolation of the half maximum crossing,
+	// shifted by half slice to match the hit slice numbers
+	float half = 0.5f * peak;
+	float d1 = deposits[last];
+	float d2 = deposits[last + 1];
+	return last + (d1 - half) / (d1 - d2) - 0.5f;
+}
+
+double
+HitsPositions::calorimeter_peak() const
+{
+	if (tag_.calorimeter_peak >= 0.0f)
+		return tag_.calorimeter_peak;
+
+	return calorimeter_position();
+}
+
 int
 HitsPositions::calorimeter_position() const
 {
@@ -149,6 +289,18 @@ HitsPositions::calorimeter_position() const
 	return pos;
 }
 
+size_t
+HitsPositions::record_size() const
+{
+	size_t size = 2 * sizeof(size_t); // planes and calorimeter sizes
+	for ( StripsNumbersMap::const_iterator iter = strips_numbers_.begin();
+		iter != strips_numbers_.end(); ++iter) {
+		size += sizeof(unsigned int) + sizeof(size_t) +
+			iter->second.size() * sizeof(NumbersVector::value_type);
+	}
+	return size + calorimeter_hits_.size() * sizeof(HitsVector::value_type);
+}
+
 void
 HitsPositions::save( const char* filename, const HitsPositionsVector& hits)
 {
@@ -157,33 +309,262 @@ HitsPositions::save( const char* filename, const HitsPositionsVector& hits)
 
 	size_t hits_size = hits.size();
 
-	dump.write( (char *)&hits_size, sizeof(size_t));
+	bool tags = false;
+	for ( HitsPositionsVector::const_iterator iter = hits.begin();
+		iter != hits.end() && !tags; ++iter)
+		tags = !iter->tag_.empty();
+
+	if (tags) {
+		uint64_t tag_size = sizeof(EventTag);
+		uint64_t count = hits_size;
+		dump.write( (char *)&tags_format, sizeof(tags_format));
+		dump.write( (char *)&tag_size, sizeof(tag_size));
+		dump.write( (char *)&count, sizeof(count));
+	}
+	else
+		dump.write( (char *)&hits_size, sizeof(size_t));
 
 	for ( HitsPositionsVector::const_iterator iter = hits.begin();
 		iter != hits.end(); ++iter)
 	{
 		dump << *iter;
+		if (tags)
+			dump.write( (char *)&iter->tag_, sizeof(EventTag));
 	}
 	dump.close();
 }
 
-void
+bool
 HitsPositions::load( const char* filename, HitsPositionsVector& hits)
 {
+	hits.clear();
+
 	// dump data
-	std::ifstream dump(filename);
+	std::ifstream dump( filename, std::ios::binary);
+	if (!dump.is_open()) {
+		std::cerr << "Can't open hits file " << filename << std::endl;
+		return false;
+	}
 
 	size_t hits_size = 0;
+	size_t tag_size = 0;
+
+	// file with event tags stores the tag size, so the files
+	// with a shorter or a longer tag can be read as well
+	read_header( dump, hits_size, tag_size);
+	if (!dump || tag_size > tag_size_max) {
+		std::cerr << "Can't read header of hits file " << filename << std::endl;
+		return false;
+	}
 
-	dump.read( (char *)&hits_size, sizeof(size_t));
-	hits.resize(hits_size);
-
-	for ( HitsPositionsVector::iterator iter = hits.begin();
-		iter != hits.end(); ++iter)
-	{
-		dump >> *iter;
+	StageTimer timer( STAGE_READ, hits_size);
+
+	std::vector<char> tag(tag_size);
+	size_t tag_read = std::min( tag_size, sizeof(EventTag));
+
+	// events are added as they are read, so a corrupted number
+	// of events doesn't allocate the whole vector
+	for ( size_t i = 0; i < hits_size; ++i) {
+		hits.push_back(HitsPositions());
+		HitsPositions& event = hits.back();
+		dump >> event;
+		if (tag_size) {
+			dump.read( &tag[0], tag_size);
+			std::copy( tag.begin(), tag.begin() + tag_read,
+				(char *)&event.tag_);
+		}
+		if (!dump) {
+			hits.pop_back();
+			std::cerr << "Hits file " << filename <<
+				" is truncated or corrupted after event " << i << std::endl;
+			return false;
+		}
 	}
 	dump.close();
+	return true;
+}
+
+void
+EventRecords::clear()
+{
+	data = 0;
+	offsets.clear();
+	sizes.clear();
+	times.clear();
+	buffer.clear();
+	tag_size = 0;
+	begin = end = 0;
+}
+
+void
+EventRecords::assign(const HitsPositionsVector& hits)
+{
+	clear();
+	tag_size = sizeof(EventTag);
+
+	size_t size = 0;
+	offsets.resize(hits.size());
+	sizes.resize(hits.size());
+	for ( size_t i = 0; i < hits.size(); ++i) {
+		offsets[i] = size;
+		sizes[i] = hits[i].record_size() + tag_size;
+		size += sizes[i];
+	}
+	buffer.resize(size);
+
+	OutputBuffer output;
+	std::ostream stream(0);
+	for ( size_t i = 0; i < hits.size(); ++i) {
+		char* record = &buffer[offsets[i]];
+		output.assign( record, sizes[i] - tag_size);
+		stream.rdbuf(&output);
+		stream << hits[i];
+
+		EventTag tag = hits[i].tag();
+		memcpy( record + sizes[i] - tag_size, (const char *)&tag, tag_size);
+	}
+
+	data = buffer.empty() ? 0 : &buffer[0];
+	end = hits.size();
+}
+
+size_t
+EventSource::decode( const EventRecords& records,
+	HitsPositionsVector& hits) const
+{
+	size_t n = records.size();
+	size_t tag_size = records.tag_size;
+	hits.resize(n);
+
+	// one stream for all records, the buffer is switched per record
+	MemoryBuffer buffer;
+	std::istream stream(0);
+
+	size_t k = 0;
+	for ( size_t i = 0; i < n; ++i) {
+		const char* record = records.data + records.offsets[i];
+		size_t size = records.sizes[i];
+		if (size < tag_size)
+			continue;
+
+		buffer.assign( record, size - tag_size);
+		stream.rdbuf(&buffer); // clears the stream state
+
+		HitsPositions& event = hits[k];
+		event = HitsPositions();
+		stream >> event;
+		if (stream.fail())
+			continue;
+
+		if (tag_size) {
+			EventTag tag;
+			memcpy( (char *)&tag, record + size - tag_size,
+				std::min( tag_size, sizeof(EventTag)));
+			event.set_tag(tag);
+		}
+		++k;
+	}
+
+	hits.resize(k);
+	return k;
+}
+
+HitsReader::HitsReader(const char* filename)
+	:
+	file_( filename, std::ios::binary),
+	good_(false),
+	events_(0),
+	read_(0),
+	tag_size_(0)
+{
+	if (!file_.is_open()) {
+		std::cerr << "Can't open hits file " << filename << std::endl;
+		return;
+	}
+
+	read_header( file_, events_, tag_size_);
+	good_ = file_.good() && tag_size_ <= tag_size_max;
+	if (!good_)
+		std::cerr << "Can't read header of hits file " << filename << std::endl;
+}
+
+bool
+HitsReader::copy( size_t n, std::vector<char>& data)
+{
+	size_t pos = data.size();
+	data.resize(pos + n);
+	if (n)
+		file_.read( &data[pos], n);
+	return file_.good();
+}
+
+size_t
+HitsReader::acquire( size_t n, EventRecords& records)
+{
+	records.clear();
+	records.tag_size = tag_size_;
+	records.begin = records.end = read_;
+
+	if (!good_)
+		return 0;
+
+	std::vector<char>& data = records.buffer;
+
+	n = std::min( n, events_ - read_);
+	for ( size_t i = 0; i < n; ++i) {
+		// record layout is the one of operator<<, then the tag
+		size_t begin = data.size();
+		size_t pos = begin;
+		if (!copy( sizeof(size_t), data)) {
+			good_ = false;
+			break;
+		}
+		size_t planes;
+		memcpy( &planes, &data[pos], sizeof(size_t));
+		good_ = (planes <= TREC_NUMBER_OF_SILICON_DETECTORS);
+
+		// sizes are checked before the copy, a corrupted size
+		// would resize the buffer to any size
+		for ( size_t j = 0; good_ && j < planes; ++j) {
+			pos = data.size();
+			good_ = copy( sizeof(unsigned int) + sizeof(size_t), data);
+			if (good_) {
+				unsigned int index;
+				size_t numsize;
+				memcpy( &index, &data[pos], sizeof(unsigned int));
+				memcpy( &numsize, &data[pos + sizeof(unsigned int)], sizeof(size_t));
+				good_ = valid_plane( index, numsize) &&
+					copy( numsize * sizeof(NumbersVector::value_type), data);
+			}
+		}
+
+		if (good_) {
+			pos = data.size();
+			good_ = copy( sizeof(size_t), data);
+		}
+		if (good_) {
+			size_t calosize;
+			memcpy( &calosize, &data[pos], sizeof(size_t));
+			good_ = (calosize <= calorimeter_slices_max) &&
+				copy( calosize * sizeof(HitsVector::value_type) + tag_size_, data);
+		}
+
+		if (!good_) {
+			data.resize(begin);
+			break;
+		}
+		records.offsets.push_back(begin);
+		records.sizes.push_back(data.size() - begin);
+	}
+
+	if (!good_)
+		std::cerr << "Hits file is truncated or corrupted after event " <<
+			read_ + records.size() << std::endl;
+
+	records.data = data.empty() ? 0 : &data[0];
+	read_ += records.size();
+	records.end = read_;
+	return records.size();
 }
 
 std::ostream&
@@ -237,8 +618,12 @@ operator>>( std::istream& s, HitsPositions& obj)
 	StripsNumbersMap& hitmap = obj.strips_numbers_;
 
 	// load map size
-	size_t strips_size;
+	size_t strips_size = 0;
 	s.read( (char *)&strips_size, sizeof(size_t));
+	if (strips_size > TREC_NUMBER_OF_SILICON_DETECTORS) {
+		s.setstate(std::ios::failbit);
+		return s;
+	}
 
 	for ( size_t i = 0; i < strips_size; ++i) {
 		// load plane index
@@ -247,8 +632,12 @@ operator>>( std::istream& s, HitsPositions& obj)
 		StripGeometryType type = StripGeometry::index(ind);
 		
 		// load plane hits positions size
-		size_t numsize;
+		size_t numsize = 0;
 		s.read( (char *)&numsize, sizeof(size_t));
+		if (!s || !valid_plane( ind, numsize)) {
+			s.setstate(std::ios::failbit);
+			return s;
+		}
 
 		NumbersVector num;
 		if (numsize > 0) {
@@ -266,6 +655,10 @@ operator>>( std::istream& s, HitsPositions& obj)
 	// load calorimeter size
 	size_t calosize = 0;
 	s.read( (char *)&calosize, sizeof(size_t));
+	if (calosize > calorimeter_slices_max) {
+		s.setstate(std::ios::failbit);
+		return s;
+	}
 
 	if (calosize > 0) {
 		HitsVector& calo = obj.calorimeter_hits_;
@@ -0,0 +1,341 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "trec_metrics.hh"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const char* stage_names[TREC::METRICS_STAGES] = {
+	"read", "decode", "cluster", "fit", "gate", "bin"
+};
+
+const char* plane_rejection_names[TREC::PLANE_REJECTIONS] = {
+	"no_hits", "clusters"
+};
+
+const char* event_rejection_names[TREC::EVENT_REJECTIONS] = {
+	"no_main", "no_full", "trajectory"
+};
+
+/** Counters of all threads
+ */
+struct Registry {
+	Registry() : start_cycles(0) {}
+	~Registry();
+
+	TREC::ThreadMetrics* acquire();
+	void release(TREC::ThreadMetrics* metrics);
+
+	std::mutex mutex;
+	std::vector<TREC::ThreadMetrics*> counters; // all counters
+	std::vector<TREC::ThreadMetrics*> unused; // counters of finished threads
+	uint64_t start_cycles;
+	Clock::time_point start_time;
+};
+
+Registry::~Registry()
+{
+	for ( size_t i = 0; i < counters.size(); ++i)
+		std::free(counters[i]);
+}
+
+TREC::ThreadMetrics*
+Registry::acquire()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!unused.empty()) {
+		TREC::ThreadMetrics* metrics = unused.back();
+		unused.pop_back();
+		return metrics;
+	}
+
+	// cache line aligned, plain new doesn't align it before C++17
+	void* memory = 0;
+	if (posix_memalign( &memory, alignof(TREC::ThreadMetrics),
+		sizeof(TREC::ThreadMetrics)))
+		throw std::bad_alloc();
+
+	TREC::ThreadMetrics* metrics = new (memory) TREC::ThreadMetrics;
+	metrics->clear();
+	counters.push_back(metrics);
+	return metrics;
+}
+
+void
+Registry::release(TREC::ThreadMetrics* metrics)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	unused.push_back(metrics);
+}
+
+Registry&
+registry()
+{
+	static Registry counters;
+	return counters;
+}
+
+/** Counters of the thread, given back to the registry on thread exit
+ */
+struct ThreadSlot {
+	ThreadSlot() : metrics(0) {}
+	~ThreadSlot() { if (metrics) registry().release(metrics); }
+
+	TREC::ThreadMetrics* metrics;
+};
+
+thread_local ThreadSlot thread_slot;
+
+} // namespace
+
+namespace TREC {
+
+std::atomic<bool> Metrics::enabled_(false);
+
+void
+ThreadMetrics::clear()
+{
+	std::memset( stage_cycles, 0, sizeof(stage_cycles));
+	std::memset( stage_calls, 0, sizeof(stage_calls));
+	std::memset( stage_items, 0, sizeof(stage_items));
+	std::memset( stage_histogram, 0, sizeof(stage_histogram));
+	std::memset( planes_rejected, 0, sizeof(planes_rejected));
+	std::memset( events_rejected, 0, sizeof(events_rejected));
+	main_tracks = 0;
+	full_tracks = 0;
+}
+
+void
+Metrics::enable(bool on)
+{
+	Registry& r = registry();
+	if (on && !enabled()) {
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.start_cycles = cycles();
+		r.start_time = Clock::now();
+	}
+	enabled_.store( on, std::memory_order_relaxed);
+}
+
+ThreadMetrics*
+Metrics::thread_counters()
+{
+	ThreadSlot& slot = thread_slot;
+	if (!slot.metrics)
+		slot.metrics = registry().acquire();
+	return slot.metrics;
+}
+
+void
+Metrics::reset()
+{
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	for ( size_t i = 0; i < r.counters.size(); ++i)
+		r.counters[i]->clear();
+	r.start_cycles = cycles();
+	r.start_time = Clock::now();
+}
+
+MetricsReport
+Metrics::report()
+{
+	MetricsReport report;
+
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+
+	ThreadMetrics& sum = report.totals;
+	for ( size_t t = 0; t < r.counters.size(); ++t) {
+		const ThreadMetrics& m = *r.counters[t];
+		for ( int s = 0; s < METRICS_STAGES; ++s) {
+			sum.stage_cycles[s] += m.stage_cycles[s];
+			sum.stage_calls[s] += m.stage_calls[s];
+			sum.stage_items[s] += m.stage_items[s];
+			for ( int b = 0; b < metrics_buckets; ++b)
+				sum.stage_histogram[s][b] += m.stage_histogram[s][b];
+		}
+		for ( int p = 0; p < TREC_NUMBER_OF_SILICON_DETECTORS; ++p) {
+			for ( int k = 0; k < PLANE_REJECTIONS; ++k)
+				sum.planes_rejected[p][k] += m.planes_rejected[p][k];
+		}
+		for ( int k = 0; k < EVENT_REJECTIONS; ++k)
+			sum.events_rejected[k] += m.events_rejected[k];
+		sum.main_tracks += m.main_tracks;
+		sum.full_tracks += m.full_tracks;
+	}
+	report.threads = r.counters.size();
+
+	std::chrono::duration<double> elapsed = Clock::now() - r.start_time;
+	report.seconds = elapsed.count();
+
+#if defined(__x86_64__) || defined(__i386__)
+	uint64_t ticks = cycles() - r.start_cycles;
+	if (ticks && report.seconds > 0.0)
+		report.ns_per_cycle = report.seconds * 1e9 / ticks;
+#endif
+
+	return report;
+}
+
+MetricsReport::MetricsReport()
+	:
+	threads(0),
+	seconds(0.0),
+	ns_per_cycle(1.0)
+{
+	totals.clear();
+}
+
+std::string
+MetricsReport::json() const
+{
+	const ThreadMetrics& m = totals;
+	std::ostringstream out;
+	out.precision(10);
+
+	out << "{" << std::endl;
+	out << "  \"seconds\": " << seconds << "," << std::endl;
+	out << "  \"threads\": " << threads << "," << std::endl;
+	out << "  \"ns_per_cycle\": " << ns_per_cycle << "," << std::endl;
+
+	out << "  \"stages\": [" << std::endl;
+	for ( int s = 0; s < METRICS_STAGES; ++s) {
+		double time = m.stage_cycles[s] * ns_per_cycle * 1e-9;
+		out << "    {\"name\": \"" << stage_names[s] << "\"";
+		out << ", \"calls\": " << m.stage_calls[s];
+		out << ", \"items\": " << m.stage_items[s];
+		out << ", \"seconds\": " << time;
+		out << ", \"items_per_second\": ";
+		out << ((time > 0.0) ? m.stage_items[s] / time : 0.0);
+		out << ", \"ns_per_item\": ";
+		out << (m.stage_items[s] ? time * 1e9 / m.stage_items[s] : 0.0);
+
+		// call durations histogram: lower bucket edge (ns) and calls
+		out << ", \"histogram\": [";
+		bool first = true;
+		for ( int b = 0; b < metrics_buckets; ++b) {
+			if (!m.stage_histogram[s][b])
+				continue;
+			out << (first ? "" : ", ") << "[" << (b ? double(1ULL << b) : 0.0) * ns_per_cycle;
+			out << ", " << m.stage_histogram[s][b] << "]";
+			first = false;
+		}
+		out << "]}" << ((s + 1 < METRICS_STAGES) ? "," : "") << std::endl;
+	}
+	out << "  ]," << std::endl;
+
+	out << "  \"planes\": [" << std::endl;
+	for ( int p = 0; p < TREC_NUMBER_OF_SILICON_DETECTORS; ++p) {
+		out << "    {\"name\": \"" << plane_metadata_[p].name << "\"";
+		for ( int k = 0; k < PLANE_REJECTIONS; ++k) {
+			out << ", \"" << plane_rejection_names[k] << "\": ";
+			out << m.planes_rejected[p][k];
+		}
+		out << "}" << ((p + 1 < TREC_NUMBER_OF_SILICON_DETECTORS) ? "," : "");
+		out << std::endl;
+	}
+	out << "  ]," << std::endl;
+
+	out << "  \"events\": {\"main_tracks\": " << m.main_tracks;
+	out << ", \"full_tracks\": " << m.full_tracks;
+	for ( int k = 0; k < EVENT_REJECTIONS; ++k) {
+		out << ", \"" << event_rejection_names[k] << "\": ";
+		out << m.events_rejected[k];
+	}
+	out << "}" << std::endl;
+	out << "}" << std::endl;
+
+	return out.str();
+}
+
+std::string
+MetricsReport::text() const
+{
+	const ThreadMetrics& m = totals;
+	std::ostringstream out;
+
+	out << "Metrics: " << seconds << " s, " << threads << " threads" << std::endl;
+	out << std::left << std::setw(10) << "stage" << std::right;
+	out << std::setw(14) << "calls" << std::setw(14) << "items";
+	out << std::setw(12) << "seconds" << std::setw(16) << "items/s";
+	out << std::setw(12) << "ns/item" << std::endl;
+	for ( int s = 0; s < METRICS_STAGES; ++s) {
+		double time = m.stage_cycles[s] * ns_per_cycle * 1e-9;
+		out << std::left << std::setw(10) << stage_names[s] << std::right;
+		out << std::setw(14) << m.stage_calls[s];
+		out << std::setw(14) << m.stage_items[s];
+		out << std::fixed << std::setprecision(4) << std::setw(12) << time;
+		out << std::setprecision(0) << std::setw(16);
+		out << ((time > 0.0) ? m.stage_items[s] / time : 0.0);
+		out << std::setprecision(1) << std::setw(12);
+		out << (m.stage_items[s] ? time * 1e9 / m.stage_items[s] : 0.0);
+		out << std::endl;
+	}
+
+	out << std::left << std::setw(10) << "plane" << std::right;
+	for ( int k = 0; k < PLANE_REJECTIONS; ++k)
+		out << std::setw(14) << plane_rejection_names[k];
+	out << std::endl;
+	for ( int p = 0; p < TREC_NUMBER_OF_SILICON_DETECTORS; ++p) {
+		out << std::left << std::setw(10) << plane_metadata_[p].name << std::right;
+		for ( int k = 0; k < PLANE_REJECTIONS; ++k)
+			out << std::setw(14) << m.planes_rejected[p][k];
+		out << std::endl;
+	}
+
+	out << "main tracks " << m.main_tracks << ", full tracks " << m.full_tracks;
+	for ( int k = 0; k < EVENT_REJECTIONS; ++k)
+		out << ", " << event_rejection_names[k] << " " << m.events_rejected[k];
+	out << std::endl;
+
+	return out.str();
+}
+
+bool
+MetricsReport::save(const char* filename) const
+{
+	std::ofstream file(filename);
+	if (!file.is_open()) {
+		std::cerr << "Can't open metrics file " << filename << std::endl;
+		return false;
+	}
+
+	std::string name(filename);
+	bool json_format = (name.size() >= 5 &&
+		name.compare( name.size() - 5, 5, ".json") == 0);
+	file << (json_format ? json() : text());
+
+	return file.good();
+}
+
+} // namespace TREC
@@ -0,0 +1,225 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+#include "trec_parallel.hh"
+#include "trec_most_likely_path.hh"
+
+namespace {
+
+const double highland_energy = 13.6; // MeV
+const double ion_charge = 6.0; // carbon
+const double ion_nucleons = 12.0;
+const double nucleon_mass = 931.494; // MeV
+const double radiation_length = 413.1; // G4_POLYSTYRENE (mm)
+const double energy_cutoff = 1.0; // MeV/u, ion stops below
+const int substeps = 8; // integration steps within a depth step
+
+/** Highland scattering power factor of the layer
+ * @param length - layer thickness (mm)
+ */
+double
+highland(double length)
+{
+	if (length <= 0.0)
+		return 0.0;
+
+	double log_term = 1.0 + 0.038 * std::log(length / radiation_length);
+	double e0 = highland_energy * ion_charge;
+	return e0 * e0 * log_term * log_term / radiation_length;
+}
+
+/** Inverse squared momentum-velocity product of the ion (1/MeV^2)
+ * @param energy - kinetic energy (MeV/u)
+ */
+double
+inverse_pv2(double energy)
+{
+	double t = std::max( energy, energy_cutoff);
+	double pv = ion_nucleons * t * (t + 2.0 * nucleon_mass) / (t + nucleon_mass);
+	return 1.0 / (pv * pv);
+}
+
+} // namespace
+
+namespace TREC {
+
+MostLikelyPath::MostLikelyPath( double z_in, double z_out, int depths,
+	double energy_min, double energy_max, int energies, SharedConf conf)
+	:
+	conf_(conf),
+	z_in_(z_in),
+	z_out_(z_out),
+	depths_(std::max( depths, 2)),
+	step_((z_out - z_in) / (depths_ - 1)),
+	energy_min_(energy_min),
+	energy_step_(0.0),
+	energies_(std::max( energies, 1)),
+	table_( energies_ * depths_ * 4, 0.0)
+{
+	if (energies_ > 1)
+		energy_step_ = (energy_max - energy_min) / (energies_ - 1);
+
+	size_t row = depths_ * 4;
+	parallel_for( energies_, worker_threads(0),
+		[&]( size_t begin, size_t end, unsigned int) {
+		for ( size_t e = begin; e < end; ++e)
+			tabulate( energy_min_ + e * energy_step_, &table_[e * row]);
+	});
+}
+
+void
+MostLikelyPath::tabulate( double energy, double* table) const
+{
+	int n = (depths_ - 1) * substeps;
+	double h = step_ / substeps;
+	double length = z_out_ - z_in_;
+
+	// moments of the scattering power from the entry plane:
+	// m_k(u) = integral of s^k / (pv)^2 from 0 to u
+	std::vector<double> m0( n + 1, 0.0), m1( n + 1, 0.0), m2( n + 1, 0.0);
+	double s0 = 0.0;
+	double f0 = inverse_pv2(energy);
+	for ( int i = 1; i <= n; ++i) {
+		double s1 = i * h;
+		double f1 = inverse_pv2(conf_->residual_energy( energy, s1));
+		m0[i] = m0[i - 1] + 0.5 * h * (f0 + f1);
+		m1[i] = m1[i - 1] + 0.5 * h * (s0 * f0 + s1 * f1);
+		m2[i] = m2[i - 1] + 0.5 * h * (s0 * s0 * f0 + s1 * s1 * f1);
+		s0 = s1;
+		f0 = f1;
+	}
+
+	for ( int d = 0; d < depths_; ++d) {
+		int k = d * substeps;
+		double u = d * step_;
+		double w = length - u;
+
+		// scattering matrix from the entry plane to the depth
+		double a0 = m0[k], a1 = m1[k], a2 = m2[k];
+		double g1 = highland(u);
+		double p1 = g1 * (u * u * a0 - 2.0 * u * a1 + a2);
+		double q1 = g1 * (u * a0 - a1);
+		double r1 = g1 * a0;
+
+		// scattering matrix from the depth to the exit plane
+		double b0 = m0[n] - a0, b1 = m1[n] - a1, b2 = m2[n] - a2;
+		double g2 = highland(w);
+		double p2 = g2 * (length * length * b0 - 2.0 * length * b1 + b2);
+		double q2 = g2 * (length * b0 - b1);
+		double r2 = g2 * b0;
+
+		// exit track propagated back to the depth
+		double p = p2 - 2.0 * w * q2 + w * w * r2;
+		double q = q2 - w * r2;
+		double r = r2;
+
+		// gain K = S1 * (S1 + S2)^-1 of the two estimates combination
+		double k00, k01;
+		double sp = p1 + p, sq = q1 + q, sr = r1 + r;
+		double det = sp * sr - sq * sq;
+		if (det > 0.0) {
+			k00 = (p1 * sr - q1 * sq) / det;
+			k01 = (q1 * sp - p1 * sq) / det;
+		}
+		else {
+			// no scattering, straight line between the planes
+			k00 = (length > 0.0) ? u / length : 0.0;
+			k01 = 0.0;
+		}
+
+		double* c = table + d * 4;
+		c[0] = 1.0 - k00;
+		c[1] = (1.0 - k00) * u - k01;
+		c[2] = k00;
+		c[3] = k01 - k00 * w;
+	}
+}
+
+void
+MostLikelyPath::coefficients( double z, double energy, double* c) const
+{
+	double fd = std::min( std::max( (z - z_in_) / step_, 0.0),
+		double(depths_ - 1));
+	int d = std::min( int(fd), depths_ - 2);
+	double wd = fd - d;
+
+	int e = 0;
+	double we = 0.0;
+	if (energies_ > 1 && energy_step_ != 0.0) {
+		double fe = std::min( std::max( (energy - energy_min_) / energy_step_,
+			0.0), double(energies_ - 1));
+		e = std::min( int(fe), energies_ - 2);
+		we = fe - e;
+	}
+	int e2 = (energies_ > 1) ? e + 1 : e;
+
+	const double* c00 = &table_[(e * depths_ + d) * 4];
+	const double* c01 = c00 + 4;
+	const double* c10 = &table_[(e2 * depths_ + d) * 4];
+	const double* c11 = c10 + 4;
+
+	for ( int i = 0; i < 4; ++i) {
+		double lo = c00[i] + wd * (c01[i] - c00[i]);
+		double hi = c10[i] + wd * (c11[i] - c10[i]);
+		c[i] = lo + we * (hi - lo);
+	}
+}
+
+void
+MostLikelyPath::path( const TrackXYPair& main, const TrackXYPair& full,
+	double energy, PathPointsVector& path) const
+{
+	path.resize(depths_);
+
+	double c[4];
+	for ( int d = 0; d < depths_; ++d) {
+		coefficients( depth(d), energy, c);
+		path[d] = position( main, full, c);
+	}
+}
+
+bool
+MostLikelyPath::positions( const MainTracksVector& main,
+	const FullTracksVector& full, double z, double energy,
+	PathPointsVector& points, unsigned int threads) const
+{
+	if (main.size() != full.size()) {
+		std::cerr << "Main and full tracks vectors sizes mismatch" << std::endl;
+		return false;
+	}
+
+	double c[4];
+	coefficients( z, energy, c);
+
+	points.resize(main.size());
+
+	parallel_for( main.size(), worker_threads(threads),
+		[&]( size_t begin, size_t end, unsigned int) {
+		for ( size_t i = begin; i < end; ++i)
+			points[i] = position( main[i], full[i].first, c);
+	});
+
+	return true;
+}
+
+} // namespace TREC
@@ -0,0 +1,143 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <sstream>
+
+#include "trec_parallel.hh"
+#include "trec_multi_depth_reconstruction.hh"
+
+namespace TREC {
+
+MultiDepthReconstruction::MultiDepthReconstruction(
+	const ImageBinning& binning, const std::vector<double>& planes,
+	int object_slice_min, int clear_slice_max, SharedConf conf)
+	:
+	conf_(conf),
+	cache_(conf),
+	binning_(binning),
+	planes_(planes),
+	accumulators_( planes.size(), ImageAccumulator(binning)),
+	object_pos_min_(object_slice_min),
+	clear_pos_max_(clear_slice_max)
+{
+}
+
+MultiDepthReconstruction::MultiDepthReconstruction(
+	const ImageBinning& binning, double z1, double z2, double step,
+	int object_slice_min, int clear_slice_max, SharedConf conf)
+	:
+	conf_(conf),
+	cache_(conf),
+	binning_(binning),
+	object_pos_min_(object_slice_min),
+	clear_pos_max_(clear_slice_max)
+{
+	if (step > 0.0) {
+		int n = static_cast<int>((z2 - z1) / step + 1e-9) + 1;
+		for ( int i = 0; i < n; ++i)
+			planes_.push_back(z1 + i * step);
+	}
+	else
+		planes_.push_back(z1);
+
+	accumulators_.resize( planes_.size(), ImageAccumulator(binning));
+}
+
+void
+MultiDepthReconstruction::add_tracks( const FullTracksVector& tracks,
+	unsigned int threads)
+{
+	add_tracks( tracks, EventTagsVector(), threads);
+}
+
+void
+MultiDepthReconstruction::add_tracks( const FullTracksVector& tracks,
+	const EventTagsVector& tags, unsigned int threads)
+{
+	threads = worker_threads(threads);
+	cache_.prepare(tags);
+
+	size_t depths = planes_.size();
+	std::vector< std::vector<ImageAccumulator> > local(threads);
+
+	parallel_for( tracks.size(), threads,
+		[&]( size_t begin, size_t end, unsigned int t) {
+		std::vector<ImageAccumulator>& acc = local[t];
+		acc.resize( depths, ImageAccumulator(binning_));
+
+		for ( size_t i = begin; i < end; ++i) {
+			const Track& full_x = tracks[i].first.first;
+			const Track& full_y = tracks[i].first.second;
+			const int& position = tracks[i].second;
+
+			if (position > clear_pos_max_ || position < object_pos_min_)
+				continue;
+
+			double pset = (i < tags.size()) ?
+				cache_.PSET( position, tags[i]) : conf_->PSET(position);
+			double ax = full_x.a(), bx = full_x.b();
+			double ay = full_y.a(), by = full_y.b();
+
+			for ( size_t d = 0; d < depths; ++d) {
+				double z = planes_[d];
+				int pixel = binning_.index( ax * z + bx, ay * z + by);
+				if (pixel != -1)
+					acc[d].add( pixel, pset);
+			}
+		}
+	});
+
+	for ( size_t t = 0; t < local.size(); ++t) {
+		for ( size_t d = 0; d < local[t].size(); ++d)
+			accumulators_[d].merge(local[t][d]);
+	}
+}
+
+void
+MultiDepthReconstruction::reset()
+{
+	for ( size_t d = 0; d < accumulators_.size(); ++d)
+		accumulators_[d].reset();
+}
+
+std::vector<ReconstructionImage>
+MultiDepthReconstruction::images() const
+{
+	std::vector<ReconstructionImage> stack;
+	stack.reserve(accumulators_.size());
+
+	for ( size_t d = 0; d < accumulators_.size(); ++d)
+		stack.push_back(accumulators_[d].image());
+
+	return stack;
+}
+
+void
+MultiDepthReconstruction::save(const char* filename) const
+{
+	for ( size_t d = 0; d < accumulators_.size(); ++d) {
+		std::ostringstream suffix;
+		suffix << "object_" << d;
+
+		accumulators_[d].image().save( filename, suffix.str().c_str(),
+			d ? "UPDATE" : "RECREATE");
+	}
+}
+
+} // namespace TREC
@@ -0,0 +1,122 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <vector>
+#include <utility>
+
+#include "trec_metrics.hh"
+#include "trec_online_reconstruction.hh"
+
+namespace TREC {
+
+OnlineReconstruction::OnlineReconstruction( const ImageBinning& binning,
+	int object_slice_min, int clear_slice_max, SharedConf conf)
+	:
+	conf_(conf),
+	cache_(new ClearBeamCache(conf)),
+	accumulator_(binning),
+	object_pos_min_(object_slice_min),
+	clear_pos_max_(clear_slice_max),
+	plane_x_z_(0.0),
+	plane_y_z_(0.0)
+{
+	// same imaging plane as in TracksReconstruction
+	image_plane( plane_x_z_, plane_y_z_);
+}
+
+void
+OnlineReconstruction::add_tracks(const FullTracksVector& batch)
+{
+	add_tracks( batch, EventTagsVector());
+}
+
+void
+OnlineReconstruction::add_tracks(const FullTracksVector& batch,
+	const EventTagsVector& tags)
+{
+	StageTimer timer( STAGE_BIN, batch.size());
+
+	const ImageBinning& binning = accumulator_.binning();
+
+	// tables of new energies are built into a copy of the cache,
+	// so concurrent batches read their own version without the lock
+	std::tr1::shared_ptr<const ClearBeamCache> cache;
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex_);
+		if (!cache_->prepared(tags)) {
+			ClearBeamCache* updated = new ClearBeamCache(*cache_);
+			updated->prepare(tags);
+			cache_.reset(updated);
+		}
+		cache = cache_;
+	}
+
+	// project tracks outside of the lock, so the snapshot
+	// is never blocked for the whole batch processing
+	std::vector< std::pair< int, double> > points;
+	points.reserve(batch.size());
+
+	for ( size_t i = 0; i < batch.size(); ++i) {
+		const Track& full_x = batch[i].first.first;
+		const Track& full_y = batch[i].first.second;
+		const int& position = batch[i].second;
+
+		if (position > clear_pos_max_ || position < object_pos_min_)
+			continue;
+
+		// full track (xy1-xy2-xy3) coordinates
+		double fx = full_x.fit(plane_x_z_);
+		double fy = full_y.fit(plane_y_z_);
+
+		int pixel = binning.index( fx, fy);
+		if (pixel == -1)
+			continue;
+
+		double pset = (i < tags.size()) ?
+			cache->PSET( position, tags[i]) : conf_->PSET(position);
+		points.push_back(std::make_pair( pixel, pset));
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	for ( size_t i = 0; i < points.size(); ++i)
+		accumulator_.add( points[i].first, points[i].second);
+}
+
+ReconstructionImage
+OnlineReconstruction::snapshot() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return accumulator_.image();
+}
+
+void
+OnlineReconstruction::reset()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	accumulator_.reset();
+}
+
+size_t
+OnlineReconstruction::entries() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return accumulator_.entries();
+}
+
+} // namespace TREC
@@ -0,0 +1,272 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "trec_parallel.hh"
+#include "trec_metrics.hh"
+#include "trec_pipeline.hh"
+
+namespace TREC {
+
+PipelineOptions::PipelineOptions()
+	:
+	batch_size(1024),
+	batches(16)
+{
+	// clustering and fits are the most expensive stages
+	unsigned int half = std::max( worker_threads(0) / 2, 1u);
+
+	std::fill( threads, threads + PIPELINE_STAGES, 1u);
+	threads[PIPELINE_CLUSTER] = half;
+	threads[PIPELINE_FIT] = half;
+}
+
+void
+PipelineBatch::clear()
+{
+	// sizes only, the capacity is kept for the next batch
+	records.clear();
+	coordinates.clear();
+	main_ok.clear();
+	full_ok.clear();
+	tracks.clear();
+	tags.clear();
+}
+
+Pipeline::Pipeline( OnlineReconstruction& image,
+	const PipelineOptions& options)
+	:
+	image_(image),
+	options_(options),
+	events_(0),
+	main_(0),
+	full_(0),
+	batches_(0),
+	errors_(0),
+	latency_sum_(0),
+	latency_max_(0),
+	latency_events_(0)
+{
+	options_.batch_size = std::max( options_.batch_size, size_t(1));
+	options_.batches = std::max( options_.batches, size_t(2));
+	options_.threads[PIPELINE_READ] = 1;
+	for ( int s = PIPELINE_DECODE; s < PIPELINE_STAGES; ++s)
+		options_.threads[s] = std::max( options_.threads[s], 1u);
+}
+
+PipelineReport
+Pipeline::run(const char* filename)
+{
+	HitsReader reader(filename);
+	if (!reader.good())
+		return PipelineReport();
+
+	return run(reader);
+}
+
+PipelineReport
+Pipeline::run(EventSource& source)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	PipelineReport report;
+	Clock::time_point start = Clock::now();
+
+	events_ = 0;
+	main_ = 0;
+	full_ = 0;
+	batches_ = 0;
+	errors_ = 0;
+	latency_sum_ = 0;
+	latency_max_ = 0;
+	latency_events_ = 0;
+
+	// queue of each stage input, the bin stage returns batches into
+	// the free queue of the read stage
+	std::vector<PipelineBatch> pool(options_.batches);
+	std::vector< std::unique_ptr<BatchQueue> > queues;
+	for ( int s = 0; s < PIPELINE_STAGES; ++s)
+		queues.push_back(std::unique_ptr<BatchQueue>(
+			new BatchQueue(options_.batches)));
+
+	BatchQueue& free = *queues[PIPELINE_READ];
+	for ( size_t i = 0; i < pool.size(); ++i)
+		free.push(&pool[i]);
+
+	std::atomic<unsigned int> active[PIPELINE_STAGES];
+	std::vector<std::thread> workers;
+
+	for ( int s = PIPELINE_DECODE; s < PIPELINE_STAGES; ++s) {
+		PipelineStage stage = static_cast<PipelineStage>(s);
+		BatchQueue& in = *queues[s];
+		BatchQueue& out = *queues[(s + 1) % PIPELINE_STAGES];
+
+		active[s] = options_.threads[s];
+		for ( unsigned int t = 0; t < options_.threads[s]; ++t)
+			workers.push_back(std::thread( &Pipeline::work, this, stage,
+				std::ref(source), std::ref(in), std::ref(out),
+				std::ref(active[s])));
+	}
+
+	read( source, free, *queues[PIPELINE_DECODE]);
+
+	for ( size_t t = 0; t < workers.size(); ++t)
+		workers[t].join();
+
+	std::chrono::duration<double> elapsed = Clock::now() - start;
+
+	report.events = events_;
+	report.main = main_;
+	report.full = full_;
+	report.batches = batches_;
+	report.errors = errors_;
+	report.seconds = elapsed.count();
+	if (latency_events_) {
+		report.latency_mean = latency_sum_ * 1e-9 / latency_events_;
+		report.latency_max = latency_max_ * 1e-9;
+	}
+	return report;
+}
+
+void
+Pipeline::read( EventSource& source, BatchQueue& free, BatchQueue& out)
+{
+	PipelineBatch* batch;
+	while (free.pop(batch)) {
+		batch->clear();
+
+		size_t n;
+		{
+			StageTimer timer(STAGE_READ);
+			n = source.acquire( options_.batch_size, batch->records);
+			timer.items(n);
+		}
+
+		if (!n) {
+			free.push(batch);
+			break;
+		}
+		out.push(batch);
+	}
+	out.close();
+}
+
+void
+Pipeline::work( PipelineStage stage, EventSource& source,
+	BatchQueue& in, BatchQueue& out, std::atomic<unsigned int>& active)
+{
+	PipelineBatch* batch;
+	while (in.pop(batch)) {
+		process( stage, source, *batch);
+		out.push(batch);
+	}
+
+	if (active.fetch_sub(1) == 1)
+		out.close();
+}
+
+void
+Pipeline::process( PipelineStage stage, EventSource& source,
+	PipelineBatch& batch)
+{
+	switch (stage) {
+	case PIPELINE_DECODE: {
+		size_t n = batch.records.size();
+		StageTimer timer( STAGE_DECODE, n);
+
+		size_t k = source.decode( batch.records, batch.hits);
+		source.release(batch.records);
+		events_ += k;
+		errors_ += n - k;
+		break;
+	}
+	case PIPELINE_CLUSTER:
+		for ( size_t i = 0; i < batch.hits.size(); ++i)
+			batch.coordinates.push_back(TrackCoordinates(batch.hits[i]));
+		break;
+	case PIPELINE_FIT: {
+		size_t n = batch.coordinates.size();
+		batch.main_ok.resize(n);
+		batch.full_ok.resize(n);
+
+		size_t main = 0;
+		for ( size_t i = 0; i < n; ++i) {
+			bool main_ok, full_ok;
+			batch.coordinates[i].fit_tracks( main_ok, full_ok);
+			batch.main_ok[i] = main_ok;
+			batch.full_ok[i] = full_ok;
+			main += main_ok;
+		}
+		main_ += main;
+		break;
+	}
+	case PIPELINE_GATE:
+		for ( size_t i = 0; i < batch.coordinates.size(); ++i) {
+			bool full_ok = batch.full_ok[i];
+			batch.coordinates[i].gate_tracks(full_ok);
+			batch.full_ok[i] = full_ok;
+			if (!full_ok)
+				continue;
+
+			// the tag keeps the beam energy and the sub-slice peak
+			batch.tracks.push_back(TracksPositionPair(
+				batch.coordinates[i].get_track(true),
+				batch.hits[i].calorimeter_position()));
+			batch.tags.push_back(batch.hits[i].tag());
+		}
+		full_ += batch.tracks.size();
+		break;
+	case PIPELINE_BIN:
+		image_.add_tracks( batch.tracks, batch.tags);
+		batches_++;
+		add_latency(batch);
+		break;
+	default:
+		break;
+	}
+}
+
+void
+Pipeline::add_latency(const PipelineBatch& batch)
+{
+	const std::vector<unsigned long long>& times = batch.records.times;
+	if (times.empty())
+		return;
+
+	unsigned long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+
+	unsigned long long sum = 0, max = 0;
+	for ( size_t i = 0; i < times.size(); ++i) {
+		unsigned long long latency = (now > times[i]) ? now - times[i] : 0;
+		sum += latency;
+		max = std::max( max, latency);
+	}
+
+	latency_sum_ += sum;
+	latency_events_ += times.size();
+	unsigned long long current = latency_max_.load();
+	while (current < max && !latency_max_.compare_exchange_weak( current, max))
+		;
+}
+
+} // namespace TREC
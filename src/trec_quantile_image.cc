@@ -0,0 +1,283 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+#include "trec_parallel.hh"
+#include "trec_quantile_image.hh"
+
+namespace {
+
+// standard error of the median / standard error of the mean
+// for the normal distribution, sqrt(pi / 2)
+const double median_error_factor = 1.2533;
+
+} // namespace
+
+namespace TREC {
+
+QuantileImage::QuantileImage( const ImageBinning& binning,
+	int object_slice_min, int clear_slice_max, SharedConf conf)
+	:
+	conf_(conf),
+	cache_(conf),
+	binning_(binning),
+	object_pos_min_(object_slice_min),
+	clear_pos_max_(clear_slice_max),
+	slices_(std::max( clear_slice_max - object_slice_min + 1, 0)),
+	counts_( static_cast<size_t>(binning.pixels()) * slices_, 0),
+	entries_( binning.pixels(), 0)
+{
+}
+
+void
+QuantileImage::add_tracks( const FullTracksVector& tracks,
+	unsigned int threads)
+{
+	add_tracks( tracks, EventTagsVector(), threads);
+}
+
+void
+QuantileImage::add_tracks( const FullTracksVector& tracks,
+	const EventTagsVector& tags, unsigned int threads)
+{
+	cache_.prepare(tags);
+
+	double z_x, z_y;
+	image_plane( z_x, z_y);
+
+	threads = worker_threads(threads);
+	size_t pixels = binning_.pixels();
+
+	// sketch cells of the tracks by thread and pixels shard, each shard
+	// is merged by one thread without locks, memory is bounded by the
+	// number of tracks
+	std::vector< std::vector<size_t> > cells(threads * threads);
+
+	parallel_for( tracks.size(), threads,
+		[&]( size_t begin, size_t end, unsigned int t) {
+		std::vector<size_t>* shards = &cells[t * threads];
+
+		for ( size_t i = begin; i < end; ++i) {
+			const Track& full_x = tracks[i].first.first;
+			const Track& full_y = tracks[i].first.second;
+			const int& position = tracks[i].second;
+
+			// slice of the configuration energy, the window is
+			// checked on it so the sketch edges aren't biased
+			int slice = position;
+			if (i < tags.size())
+				slice = int(std::floor(
+					cache_.equivalent_slice( position, tags[i]) + 0.5));
+
+			if (slice > clear_pos_max_ || slice < object_pos_min_)
+				continue;
+
+			int pixel = binning_.index( full_x.fit(z_x), full_y.fit(z_y));
+			if (pixel == -1)
+				continue;
+
+			size_t pos = static_cast<size_t>(pixel) * slices_;
+			size_t shard = static_cast<size_t>(pixel) * threads / pixels;
+			shards[shard].push_back(pos + slice - object_pos_min_);
+		}
+	});
+
+	parallel_for( threads, threads,
+		[&]( size_t begin, size_t end, unsigned int) {
+		for ( size_t shard = begin; shard < end; ++shard) {
+			for ( unsigned int t = 0; t < threads; ++t) {
+				const std::vector<size_t>& c = cells[t * threads + shard];
+				for ( size_t k = 0; k < c.size(); ++k) {
+					counts_[c[k]]++;
+					entries_[c[k] / slices_]++;
+				}
+			}
+		}
+	});
+}
+
+bool
+QuantileImage::merge(const QuantileImage& src)
+{
+	const ImageBinning& b = src.binning_;
+
+	bool bins = (b.bin_x == binning_.bin_x && b.bin_y == binning_.bin_y);
+	bool sizes = (b.size_x1 == binning_.size_x1 &&
+		b.size_x2 == binning_.size_x2 && b.size_y1 == binning_.size_y1 &&
+		b.size_y2 == binning_.size_y2);
+	bool slices = (src.object_pos_min_ == object_pos_min_ &&
+		src.clear_pos_max_ == clear_pos_max_);
+
+	if (!(bins && sizes && slices)) {
+		std::cerr << "Quantile images are not compatible" << std::endl;
+		return false;
+	}
+
+	for ( size_t i = 0; i < counts_.size(); ++i)
+		counts_[i] += src.counts_[i];
+	for ( size_t i = 0; i < entries_.size(); ++i)
+		entries_[i] += src.entries_[i];
+
+	return true;
+}
+
+void
+QuantileImage::reset()
+{
+	std::fill( counts_.begin(), counts_.end(), 0);
+	std::fill( entries_.begin(), entries_.end(), 0);
+}
+
+double
+QuantileImage::quantile( int pixel, double q) const
+{
+	unsigned int n = entries_[pixel];
+	if (!n)
+		return -1.;
+
+	q = std::min( std::max( q, 0.0), 1.0);
+
+	// counts of a slice are uniformly distributed within the slice
+	const unsigned int* c = counts(pixel);
+	double rank = q * n;
+	double cum = 0.0;
+	for ( int s = 0; s < slices_; ++s) {
+		if (c[s] && cum + c[s] >= rank) {
+			double frac = (rank - cum) / c[s];
+			return object_pos_min_ + s - 0.5 + frac;
+		}
+		cum += c[s];
+	}
+	return clear_pos_max_ + 0.5;
+}
+
+ReconstructionImage
+QuantileImage::median() const
+{
+	ReconstructionImage img(binning_);
+
+	for ( int pixel = 0; pixel < binning_.pixels(); ++pixel) {
+		unsigned int n = entries_[pixel];
+		if (!n)
+			continue;
+
+		const unsigned int* c = counts(pixel);
+		double sum = 0.0, sum2 = 0.0;
+		for ( int s = 0; s < slices_; ++s) {
+			double v = conf_->PSET(object_pos_min_ + s);
+			sum += c[s] * v;
+			sum2 += c[s] * v * v;
+		}
+		double mean = sum / n;
+		double sigma = std::sqrt(std::max( sum2 / n - mean * mean, 0.0));
+
+		double value = conf_->PSET(quantile( pixel, 0.5));
+		img.set( pixel, n, value, median_error_factor * sigma / std::sqrt(n));
+	}
+	return img;
+}
+
+ReconstructionImage
+QuantileImage::trimmed_mean( double q_low, double q_high) const
+{
+	ReconstructionImage img(binning_);
+
+	for ( int pixel = 0; pixel < binning_.pixels(); ++pixel) {
+		unsigned int n = entries_[pixel];
+		if (!n)
+			continue;
+
+		double low = std::max( q_low, 0.0) * n;
+		double high = std::min( q_high, 1.0) * n;
+
+		const unsigned int* c = counts(pixel);
+		double cum = 0.0, w = 0.0, sum = 0.0, sum2 = 0.0;
+		for ( int s = 0; s < slices_ && cum < high; ++s) {
+			// part of the slice counts within [low, high] ranks
+			double part = std::min( cum + c[s], high) - std::max( cum, low);
+			if (part > 0.0) {
+				double v = conf_->PSET(object_pos_min_ + s);
+				w += part;
+				sum += part * v;
+				sum2 += part * v * v;
+			}
+			cum += c[s];
+		}
+
+		if (w > 0.0) {
+			double mean = sum / w;
+			double var = std::max( sum2 / w - mean * mean, 0.0);
+			img.set( pixel, w, mean, std::sqrt(var / w));
+		}
+	}
+	return img;
+}
+
+void
+QuantileImage::save(const char* filename) const
+{
+	std::ofstream dump( filename, std::ios::binary);
+
+	dump.write( (char *)&binning_, sizeof(ImageBinning));
+	dump.write( (char *)&object_pos_min_, sizeof(int));
+	dump.write( (char *)&clear_pos_max_, sizeof(int));
+	dump.write( (char *)&counts_[0], counts_.size() * sizeof(unsigned int));
+	dump.close();
+}
+
+bool
+QuantileImage::load(const char* filename)
+{
+	std::ifstream dump( filename, std::ios::binary);
+
+	ImageBinning binning;
+	int slice_min = -1, slice_max = -1;
+
+	dump.read( (char *)&binning, sizeof(ImageBinning));
+	dump.read( (char *)&slice_min, sizeof(int));
+	dump.read( (char *)&slice_max, sizeof(int));
+
+	if (!dump || slice_max < slice_min || binning.pixels() <= 0) {
+		std::cerr << "Can't read quantile image file: " << filename << std::endl;
+		return false;
+	}
+
+	QuantileImage src( binning, slice_min, slice_max, conf_);
+	dump.read( (char *)&src.counts_[0],
+		src.counts_.size() * sizeof(unsigned int));
+	if (!dump) {
+		std::cerr << "Quantile image file " << filename << " is truncated" << std::endl;
+		return false;
+	}
+	dump.close();
+
+	for ( int pixel = 0; pixel < binning.pixels(); ++pixel) {
+		const unsigned int* c = src.counts(pixel);
+		for ( int s = 0; s < src.slices_; ++s)
+			src.entries_[pixel] += c[s];
+	}
+
+	return merge(src);
+}
+
+} // namespace TREC
@@ -0,0 +1,73 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <chrono>
+#include <algorithm>
+
+#include "trec_queue_source.hh"
+
+namespace TREC {
+
+QueueSource::QueueSource(size_t batches)
+	:
+	queue_(batches),
+	events_(0)
+{
+}
+
+QueueSource::~QueueSource()
+{
+	EventRecords* records;
+	while (queue_.try_pop(records))
+		delete records;
+}
+
+void
+QueueSource::write(const HitsPositionsVector& hits)
+{
+	if (hits.empty())
+		return;
+
+	EventRecords* records = new EventRecords;
+	records->assign(hits);
+
+	unsigned long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	records->times.assign( hits.size(), now);
+
+	queue_.push(records);
+}
+
+size_t
+QueueSource::acquire( size_t, EventRecords& records)
+{
+	EventRecords* batch;
+	if (!queue_.pop(batch))
+		return 0;
+
+	// vectors are swapped, data still points to the batch buffer
+	std::swap( records, *batch);
+	delete batch;
+
+	records.begin = events_.fetch_add(records.size());
+	records.end = records.begin + records.size();
+	return records.size();
+}
+
+} // namespace TREC
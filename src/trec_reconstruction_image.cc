@@ -0,0 +1,158 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+
+#ifdef TREC_USE_ROOT
+#include <TH2.h>
+#include <TFile.h>
+#endif
+
+#include "trec_strip_geometry.hh"
+#include "trec_reconstruction_image.hh"
+
+namespace TREC {
+
+ImageBinning::ImageBinning( double x1, double x2,
+	double y1, double y2, int bx, int by)
+	:
+	size_x1(x1),
+	size_x2(x2),
+	size_y1(y1),
+	size_y2(y2),
+	bin_x(bx),
+	bin_y(by)
+{
+}
+
+void
+image_plane( double& z_x, double& z_y)
+{
+	const StripGeometry* plane_y2 = StripGeometry::get(MSD_Y2);
+	const StripGeometry* plane_x2 = StripGeometry::get(MSD_X2);
+	const StripGeometry* plane_y3 = StripGeometry::get(MSD_Y3);
+	const StripGeometry* plane_x3 = StripGeometry::get(MSD_X3);
+
+	z_x = (plane_x2->z + plane_x3->z) / 2.0;
+	z_y = (plane_y2->z + plane_y3->z) / 2.0;
+}
+
+ReconstructionImage::ReconstructionImage(const ImageBinning& binning)
+	:
+	binning_(binning),
+	fluence_( binning.pixels(), 0.0),
+	value_( binning.pixels(), 0.0),
+	error_( binning.pixels(), 0.0)
+{
+}
+
+void
+ReconstructionImage::set( int pixel, double fluence, double value,
+	double error)
+{
+	fluence_[pixel] = fluence;
+	value_[pixel] = value;
+	error_[pixel] = error;
+}
+
+void
+ReconstructionImage::save( const char* filename, const char* suffix,
+	const char* option) const
+{
+#ifdef TREC_USE_ROOT
+	const ImageBinning& b = binning_;
+
+	std::string position_name = std::string("position_") + suffix;
+	std::string fluence_name = std::string("fluence_") + suffix;
+
+	TFile* file = new TFile( filename, option);
+
+	TH2D* position = new TH2D( position_name.c_str(), "Position",
+		b.bin_x, b.size_x1, b.size_x2, b.bin_y, b.size_y1, b.size_y2);
+	TH2D* fluence = new TH2D( fluence_name.c_str(), "Fluence",
+		b.bin_x, b.size_x1, b.size_x2, b.bin_y, b.size_y1, b.size_y2);
+
+	for ( int i = 0; i < b.bin_x; ++i) {
+		for ( int j = 0; j < b.bin_y; ++j) {
+			position->SetBinContent( i + 1, j + 1, value( i, j));
+			position->SetBinError( i + 1, j + 1, error( i, j));
+			fluence->SetBinContent( i + 1, j + 1, this->fluence( i, j));
+		}
+	}
+
+	position->Write();
+	fluence->Write();
+	file->Close();
+
+	delete file; // histograms are owned by the file
+#else
+	std::cerr << "Can't save image into " << filename << ": ";
+	std::cerr << "library is built without ROOT" << std::endl;
+#endif
+}
+
+ImageAccumulator::ImageAccumulator(const ImageBinning& binning)
+	:
+	binning_(binning),
+	fluence_( binning.pixels(), 0.0),
+	sum_( binning.pixels(), 0.0),
+	sum2_( binning.pixels(), 0.0),
+	entries_(0)
+{
+}
+
+void
+ImageAccumulator::merge(const ImageAccumulator& src)
+{
+	for ( size_t i = 0; i < fluence_.size(); ++i) {
+		fluence_[i] += src.fluence_[i];
+		sum_[i] += src.sum_[i];
+		sum2_[i] += src.sum2_[i];
+	}
+	entries_ += src.entries_;
+}
+
+void
+ImageAccumulator::reset()
+{
+	std::fill( fluence_.begin(), fluence_.end(), 0.0);
+	std::fill( sum_.begin(), sum_.end(), 0.0);
+	std::fill( sum2_.begin(), sum2_.end(), 0.0);
+	entries_ = 0;
+}
+
+ReconstructionImage
+ImageAccumulator::image() const
+{
+	ReconstructionImage img(binning_);
+
+	for ( size_t i = 0; i < fluence_.size(); ++i) {
+		double f = fluence_[i];
+		if (f > 0.0) {
+			// same as TracksReconstruction::reconstruct: p / f, pe / f
+			img.set( i, f, sum_[i] / f, std::sqrt(sum2_[i]) / f);
+		}
+	}
+	return img;
+}
+
+} // namespace TREC
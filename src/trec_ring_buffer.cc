@@ -0,0 +1,429 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <iostream>
+#include <streambuf>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trec_queue.hh"
+#include "trec_event_generator.hh"
+#include "trec_ring_buffer.hh"
+
+namespace TREC {
+
+/** Ring buffer header in the shared memory, positions are on own
+ * cache lines
+ */
+struct RingHeader {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t tag_size; // size of the tag after the event record
+	uint64_t capacity; // records memory size (bytes), power of 2
+	char pad0[40];
+	std::atomic<uint64_t> head; // reserved by the writers
+	char pad1[56];
+	std::atomic<uint64_t> tail; // released by the reader
+	char pad2[56];
+	std::atomic<uint32_t> writers; // attached writers
+	std::atomic<uint32_t> finished; // all writers are detached
+};
+
+} // namespace TREC
+
+namespace {
+
+const uint64_t ring_magic = 0x474e495243455254ULL; // "TRECRING"
+const uint32_t ring_version = 1;
+const size_t header_size = 4096; // records begin on the next page
+
+enum {
+	RECORD_FREE = 0,
+	RECORD_EVENT,
+	RECORD_PAD
+};
+
+/** Record header, records are aligned to its size
+ */
+struct RecordHeader {
+	std::atomic<uint32_t> state; // published last
+	uint32_t size; // record size without the header (bytes)
+	uint64_t time; // write time (ns, steady clock)
+};
+
+const uint64_t record_align = sizeof(RecordHeader);
+
+static_assert( sizeof(TREC::RingHeader) <= header_size,
+	"Ring buffer header doesn't fit into its page");
+static_assert( sizeof(RecordHeader) == 16, "Record header must be 16 bytes");
+
+uint64_t
+aligned(uint64_t size)
+{
+	return (size + record_align - 1) & ~(record_align - 1);
+}
+
+uint64_t
+now_ns()
+{
+	// CLOCK_MONOTONIC on Linux, the same for all processes
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Write only stream buffer of a memory block
+ */
+class OutputBuffer : public std::streambuf {
+public:
+	void assign( char* data, size_t size) {
+		setp( data, data + size);
+	}
+};
+
+} // namespace
+
+namespace TREC {
+
+RingWriter::RingWriter(const char* name)
+	:
+	header_(0),
+	ring_(0),
+	mapped_(0),
+	written_(0),
+	dropped_(0),
+	stream_(0)
+{
+	int fd = shm_open( name, O_RDWR, 0);
+	if (fd == -1) {
+		std::cerr << "Can't open ring buffer " << name << std::endl;
+		return;
+	}
+
+	struct stat st;
+	void* memory = MAP_FAILED;
+	if (fstat( fd, &st) == 0 && size_t(st.st_size) > header_size) {
+		mapped_ = st.st_size;
+		memory = mmap( 0, mapped_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	::close(fd);
+
+	if (memory == MAP_FAILED) {
+		std::cerr << "Can't map ring buffer " << name << std::endl;
+		return;
+	}
+
+	RingHeader* header = static_cast<RingHeader*>(memory);
+	if (header->magic != ring_magic || header->version != ring_version ||
+		header->capacity + header_size != mapped_) {
+		std::cerr << "Wrong ring buffer " << name << std::endl;
+		munmap( memory, mapped_);
+		return;
+	}
+
+	header_ = header;
+	ring_ = static_cast<char*>(memory) + header_size;
+	header_->writers.fetch_add(1);
+	header_->finished.store(0);
+}
+
+RingWriter::~RingWriter()
+{
+	close();
+}
+
+void
+RingWriter::close()
+{
+	if (!header_)
+		return;
+
+	if (header_->writers.fetch_sub(1) == 1)
+		header_->finished.store( 1, std::memory_order_release);
+
+	munmap( header_, mapped_);
+	header_ = 0;
+	ring_ = 0;
+}
+
+bool
+RingWriter::write( const HitsPositions& hits, bool wait)
+{
+	if (!header_)
+		return false;
+
+	const uint64_t capacity = header_->capacity;
+	const uint64_t mask = capacity - 1;
+	size_t record = hits.record_size();
+	size_t tag_size = header_->tag_size;
+	uint64_t size = aligned(sizeof(RecordHeader) + record + tag_size);
+
+	if (size > capacity / 2) {
+		std::cerr << "Event record is too big for the ring buffer" << std::endl;
+		dropped_++;
+		return false;
+	}
+
+	// reserve the record and the padding at the end of the ring
+	uint64_t pos, pad;
+	for ( unsigned int n = 0; ; ) {
+		pos = header_->head.load(std::memory_order_relaxed);
+		uint64_t rest = capacity - (pos & mask);
+		pad = (rest < size) ? rest : 0;
+
+		uint64_t tail = header_->tail.load(std::memory_order_acquire);
+		if (pos + pad + size - tail > capacity) {
+			if (!wait) {
+				dropped_++;
+				return false;
+			}
+			backoff(n++);
+			continue;
+		}
+
+		if (header_->head.compare_exchange_weak( pos, pos + pad + size,
+			std::memory_order_relaxed))
+			break;
+	}
+
+	if (pad) {
+		RecordHeader* p = reinterpret_cast<RecordHeader*>(ring_ + (pos & mask));
+		p->size = pad - sizeof(RecordHeader);
+		p->time = 0;
+		p->state.store( RECORD_PAD, std::memory_order_release);
+	}
+
+	uint64_t offset = (pos + pad) & mask;
+	RecordHeader* r = reinterpret_cast<RecordHeader*>(ring_ + offset);
+	char* data = ring_ + offset + sizeof(RecordHeader);
+
+	OutputBuffer buffer;
+	buffer.assign( data, record);
+	stream_.rdbuf(&buffer);
+	stream_ << hits;
+
+	if (tag_size) {
+		EventTag tag = hits.tag();
+		std::memset( data + record, 0, tag_size);
+		std::memcpy( data + record, &tag, std::min( tag_size, sizeof(EventTag)));
+	}
+
+	r->size = record + tag_size;
+	r->time = now_ns();
+	r->state.store( RECORD_EVENT, std::memory_order_release);
+
+	written_++;
+	return true;
+}
+
+void
+RingSink::write(const HitsPositionsVector& hits)
+{
+	for ( size_t i = 0; i < hits.size(); ++i)
+		writer_.write( hits[i], wait_);
+}
+
+RingReader::RingReader( const char* name, size_t capacity)
+	:
+	name_(name),
+	header_(0),
+	ring_(0),
+	mapped_(0),
+	read_(0),
+	events_(0),
+	bytes_(0),
+	stop_(false),
+	corrupted_(false)
+{
+	uint64_t size = 4096;
+	while (size < capacity)
+		size <<= 1;
+
+	shm_unlink(name); // old ring of a finished run
+	int fd = shm_open( name, O_CREAT | O_EXCL | O_RDWR, 0666);
+	if (fd == -1) {
+		std::cerr << "Can't create ring buffer " << name << std::endl;
+		return;
+	}
+
+	void* memory = MAP_FAILED;
+	mapped_ = header_size + size;
+	if (ftruncate( fd, mapped_) == 0)
+		memory = mmap( 0, mapped_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (memory == MAP_FAILED) {
+		std::cerr << "Can't map ring buffer " << name << std::endl;
+		shm_unlink(name);
+		return;
+	}
+
+	// new memory is zero: free records, empty ring
+	header_ = static_cast<RingHeader*>(memory);
+	ring_ = static_cast<char*>(memory) + header_size;
+	header_->version = ring_version;
+	header_->tag_size = sizeof(EventTag);
+	header_->capacity = size;
+	std::atomic_thread_fence(std::memory_order_release);
+	header_->magic = ring_magic;
+}
+
+RingReader::~RingReader()
+{
+	if (!header_)
+		return;
+
+	munmap( header_, mapped_);
+	shm_unlink(name_.c_str());
+}
+
+size_t
+RingReader::acquire( size_t n, EventRecords& records)
+{
+	records.clear();
+	if (!header_ || corrupted_)
+		return 0;
+
+	const uint64_t mask = header_->capacity - 1;
+	records.data = ring_;
+	records.tag_size = header_->tag_size;
+	records.begin = read_;
+
+	for ( unsigned int w = 0; ; ++w) {
+		// published records in the ring order, offsets are in the ring;
+		// memory behind the head can hold records of the previous lap
+		// which aren't released yet
+		uint64_t head = header_->head.load(std::memory_order_acquire);
+		while (records.size() < n && read_ < head) {
+			uint64_t offset = read_ & mask;
+			RecordHeader* r = reinterpret_cast<RecordHeader*>(ring_ + offset);
+			uint32_t state = r->state.load(std::memory_order_acquire);
+			if (state == RECORD_FREE)
+				break;
+
+			// records never wrap around the ring end, a record out of
+			// the ring or behind the head is corrupted and the ring
+			// can't be read past it
+			uint64_t span = aligned(sizeof(RecordHeader) + uint64_t(r->size));
+			if ((state != RECORD_EVENT && state != RECORD_PAD) ||
+				span > header_->capacity - offset || span > head - read_) {
+				std::cerr << "Ring buffer " << name_ <<
+					" has a corrupted record after event " << events_ +
+					records.size() << std::endl;
+				corrupted_ = true;
+				break;
+			}
+
+			if (state == RECORD_EVENT) {
+				records.offsets.push_back(offset + sizeof(RecordHeader));
+				records.sizes.push_back(r->size);
+				records.times.push_back(r->time);
+				bytes_ += r->size;
+			}
+			read_ += aligned(sizeof(RecordHeader) + r->size);
+		}
+
+		if (records.size() || stop_ || corrupted_)
+			break;
+
+		// nothing is published, finish if all writers are detached
+		if (header_->finished.load(std::memory_order_acquire) &&
+			header_->head.load(std::memory_order_acquire) == read_)
+			break;
+
+		backoff(w);
+	}
+
+	records.end = read_;
+	events_ += records.size();
+	return records.size();
+}
+
+void
+RingReader::release(const EventRecords& records)
+{
+	if (!header_ || records.begin == records.end)
+		return;
+
+	const uint64_t capacity = header_->capacity;
+	const uint64_t mask = capacity - 1;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	released_[records.begin] = records.end;
+
+	// clear released spans from the tail, so stale bytes never look
+	// like a published record, then give the space to the writers
+	uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+	std::map< uint64_t, uint64_t>::iterator iter;
+	while ((iter = released_.find(tail)) != released_.end()) {
+		uint64_t size = iter->second - tail;
+		uint64_t offset = tail & mask;
+		uint64_t first = std::min( size, capacity - offset);
+		std::memset( ring_ + offset, 0, first);
+		std::memset( ring_, 0, size - first);
+
+		tail = iter->second;
+		released_.erase(iter);
+	}
+	header_->tail.store( tail, std::memory_order_release);
+}
+
+ProducerReport
+produce_events( const char* name, const EventGenerator& generator,
+	size_t events, double rate, unsigned long long seed, bool wait)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	ProducerReport report;
+
+	RingWriter writer(name);
+	if (!writer.good())
+		return report;
+
+	FastRandom random(seed);
+	HitsPositions hits;
+
+	Clock::time_point start = Clock::now();
+	for ( size_t i = 0; i < events; ++i) {
+		// pace by blocks of events, so the clock isn't read per event
+		if (rate > 0.0 && i % 64 == 0)
+			std::this_thread::sleep_until( start +
+				std::chrono::duration_cast<Clock::duration>(
+				std::chrono::duration<double>(i / rate)));
+
+		generator.generate( random, hits);
+		writer.write( hits, wait);
+	}
+	std::chrono::duration<double> elapsed = Clock::now() - start;
+
+	report.events = writer.written();
+	report.dropped = writer.dropped();
+	report.seconds = elapsed.count();
+
+	writer.close();
+	return report;
+}
+
+} // namespace TREC
@@ -0,0 +1,236 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include "trec_parallel.hh"
+#include "trec_siddon.hh"
+
+namespace TREC {
+
+VolumeGrid::VolumeGrid( int x, int y, int z,
+	double size_x, double size_y, double size_z)
+	:
+	nx(x),
+	ny(y),
+	nz(z),
+	dx(size_x),
+	dy(size_y),
+	dz(size_z)
+{
+}
+
+void
+TracksArrays::assign(const FullTracksVector& tracks)
+{
+	assign( tracks, 0, tracks.size());
+}
+
+void
+TracksArrays::assign( const FullTracksVector& tracks, size_t begin,
+	size_t end)
+{
+	size_t n = end - begin;
+	ax.resize(n);
+	bx.resize(n);
+	ay.resize(n);
+	by.resize(n);
+
+	for ( size_t i = 0; i < n; ++i) {
+		const Track& full_x = tracks[begin + i].first.first;
+		const Track& full_y = tracks[begin + i].first.second;
+		ax[i] = full_x.a();
+		bx[i] = full_x.b();
+		ay[i] = full_y.a();
+		by[i] = full_y.b();
+	}
+}
+
+void
+SparseRows::clear()
+{
+	row_ptr.assign( 1, 0);
+	voxels.clear();
+	lengths.clear();
+}
+
+SiddonTracer::SiddonTracer( const VolumeGrid& grid, double isocenter)
+	:
+	grid_(grid),
+	isocenter_(isocenter)
+{
+	n_[0] = grid.nx;
+	n_[1] = grid.ny;
+	n_[2] = grid.nz;
+	step_[0] = grid.dx;
+	step_[1] = grid.dy;
+	step_[2] = grid.dz;
+	stride_[0] = 1;
+	stride_[1] = grid.nx;
+	stride_[2] = grid.nx * grid.ny;
+
+	for ( int k = 0; k < 3; ++k)
+		size_[k] = n_[k] * step_[k];
+
+	radius_ = 0.5 * std::sqrt(size_[0] * size_[0] + size_[1] * size_[1] +
+		size_[2] * size_[2]);
+}
+
+void
+SiddonTracer::trace( double ax, double bx, double ay, double by,
+	double angle, std::vector<int>& voxels, std::vector<float>& lengths) const
+{
+	voxels.clear();
+	lengths.clear();
+
+	double c = std::cos(angle);
+	double s = std::sin(angle);
+
+	// segment ends in the object coordinate system,
+	// relative to the grid corner
+	double p1[3], d[3];
+	{
+		double z1 = isocenter_ - radius_, z2 = isocenter_ + radius_;
+		double x1 = ax * z1 + bx, x2 = ax * z2 + bx;
+		double y1 = ay * z1 + by, y2 = ay * z2 + by;
+
+		p1[0] = x1 * c + radius_ * s + size_[0] / 2.0;
+		p1[1] = y1 + size_[1] / 2.0;
+		p1[2] = x1 * s - radius_ * c + size_[2] / 2.0;
+		d[0] = x2 * c - radius_ * s + size_[0] / 2.0 - p1[0];
+		d[1] = y2 + size_[1] / 2.0 - p1[1];
+		d[2] = x2 * s + radius_ * c + size_[2] / 2.0 - p1[2];
+	}
+	double len = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+
+	// parametric range of the segment within the grid
+	double amin = 0.0, amax = 1.0;
+	for ( int k = 0; k < 3; ++k) {
+		if (d[k] != 0.0) {
+			double a0 = -p1[k] / d[k];
+			double a1 = (size_[k] - p1[k]) / d[k];
+			amin = std::max( amin, std::min( a0, a1));
+			amax = std::min( amax, std::max( a0, a1));
+		}
+		else if (p1[k] < 0.0 || p1[k] >= size_[k])
+			return;
+	}
+	if (amin >= amax)
+		return;
+
+	// entry voxel, next plane crossing and crossing step of each axis
+	const double inf = std::numeric_limits<double>::max();
+	int index[3], dir[3];
+	double next[3], delta[3];
+	for ( int k = 0; k < 3; ++k) {
+		double entry = p1[k] + amin * d[k];
+		index[k] = static_cast<int>(std::floor(entry / step_[k]));
+		if (d[k] > 0.0) {
+			index[k] = std::min( std::max( index[k], 0), n_[k] - 1);
+			dir[k] = 1;
+			next[k] = ((index[k] + 1) * step_[k] - p1[k]) / d[k];
+			delta[k] = step_[k] / d[k];
+		}
+		else if (d[k] < 0.0) {
+			// entry on the upper plane belongs to the lower voxel
+			if (index[k] * step_[k] >= entry)
+				--index[k];
+			index[k] = std::min( std::max( index[k], 0), n_[k] - 1);
+			dir[k] = -1;
+			next[k] = (index[k] * step_[k] - p1[k]) / d[k];
+			delta[k] = -step_[k] / d[k];
+		}
+		else {
+			index[k] = std::min( std::max( index[k], 0), n_[k] - 1);
+			dir[k] = 0;
+			next[k] = inf;
+			delta[k] = 0.0;
+		}
+	}
+
+	int voxel = index[0] * stride_[0] + index[1] * stride_[1] +
+		index[2] * stride_[2];
+	double a = amin;
+
+	while (a < amax) {
+		int k = (next[0] < next[1]) ?
+			((next[0] < next[2]) ? 0 : 2) : ((next[1] < next[2]) ? 1 : 2);
+
+		double a_next = std::min( next[k], amax);
+		double l = (a_next - a) * len;
+		if (l > 0.0) {
+			voxels.push_back(voxel);
+			lengths.push_back(l);
+		}
+		a = a_next;
+
+		index[k] += dir[k];
+		if (index[k] < 0 || index[k] >= n_[k])
+			break;
+		voxel += dir[k] * stride_[k];
+		next[k] += delta[k];
+	}
+}
+
+void
+SiddonTracer::trace( const TracksArrays& tracks, double angle,
+	SparseRows& rows, unsigned int threads) const
+{
+	threads = worker_threads(threads);
+
+	std::vector<SparseRows> local(threads);
+
+	parallel_for( tracks.size(), threads,
+		[&]( size_t begin, size_t end, unsigned int t) {
+		SparseRows& r = local[t];
+		r.clear();
+		r.row_ptr.reserve(end - begin + 1);
+
+		std::vector<int> voxels;
+		std::vector<float> lengths;
+
+		for ( size_t i = begin; i < end; ++i) {
+			trace( tracks.ax[i], tracks.bx[i], tracks.ay[i], tracks.by[i],
+				angle, voxels, lengths);
+
+			r.voxels.insert( r.voxels.end(), voxels.begin(), voxels.end());
+			for ( size_t k = 0; k < lengths.size(); ++k)
+				r.lengths.push_back(float_to_half(lengths[k]));
+			r.row_ptr.push_back(r.voxels.size());
+		}
+	});
+
+	// concatenate thread rows in the tracks order
+	rows.clear();
+	for ( size_t t = 0; t < local.size(); ++t) {
+		const SparseRows& r = local[t];
+		if (r.row_ptr.empty())
+			continue;
+
+		size_t offset = rows.voxels.size();
+		for ( size_t i = 1; i < r.row_ptr.size(); ++i)
+			rows.row_ptr.push_back(offset + r.row_ptr[i]);
+		rows.voxels.insert( rows.voxels.end(), r.voxels.begin(), r.voxels.end());
+		rows.lengths.insert( rows.lengths.end(), r.lengths.begin(), r.lengths.end());
+	}
+}
+
+} // namespace TREC
@@ -0,0 +1,177 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include "trec_metrics.hh"
+#include "trec_sliced_reconstruction.hh"
+
+namespace TREC {
+
+SlicedReconstruction::SlicedReconstruction( const ImageBinning& binning,
+	int object_slice_min, int clear_slice_max, SliceMode mode,
+	unsigned long long window, size_t open_slices, double latency_target,
+	double idle_timeout, SharedConf conf)
+	:
+	conf_(conf),
+	cache_(conf),
+	binning_(binning),
+	object_pos_min_(object_slice_min),
+	clear_pos_max_(clear_slice_max),
+	mode_(mode),
+	window_(window ? window : 1),
+	open_slices_(open_slices ? open_slices : 1),
+	latency_target_(latency_target),
+	idle_timeout_((idle_timeout > 0.0) ? idle_timeout : latency_target / 2.0),
+	plane_x_z_(0.0),
+	plane_y_z_(0.0),
+	closed_(false),
+	last_closed_(0),
+	dropped_(0)
+{
+	image_plane( plane_x_z_, plane_y_z_);
+}
+
+unsigned long long
+SlicedReconstruction::slice(const EventTag& tag) const
+{
+	return (mode_ == SLICE_SPILL) ? tag.spill : (tag.time / window_);
+}
+
+void
+SlicedReconstruction::add_tracks( const FullTracksVector& batch,
+	const EventTagsVector& tags)
+{
+	StageTimer timer( STAGE_BIN, batch.size());
+
+	Clock::time_point now = Clock::now();
+
+	cache_.prepare(tags);
+
+	// cached slice of the previous track, tracks come in time order
+	OpenSlicesMap::iterator current = slices_.end();
+
+	for ( size_t i = 0; i < batch.size() && i < tags.size(); ++i) {
+		const Track& full_x = batch[i].first.first;
+		const Track& full_y = batch[i].first.second;
+		const int& position = batch[i].second;
+
+		unsigned long long id = slice(tags[i]);
+		if (closed_ && id <= last_closed_) {
+			// slice image has been already formed
+			++dropped_;
+			continue;
+		}
+
+		if (current == slices_.end() || current->first != id) {
+			current = slices_.find(id);
+			if (current == slices_.end()) {
+				if (slices_.size() >= open_slices_ &&
+					id < slices_.begin()->first) {
+					// older than all slices of the full rolling set
+					++dropped_;
+					continue;
+				}
+				current = slices_.insert(std::make_pair( id,
+					OpenSlice(binning_))).first;
+
+				// keep the rolling set bounded, close the oldest slices
+				while (slices_.size() > open_slices_)
+					close(slices_.begin());
+			}
+		}
+		current->second.updated = now;
+
+		if (position > clear_pos_max_ || position < object_pos_min_)
+			continue;
+
+		// full track (xy1-xy2-xy3) coordinates
+		double fx = full_x.fit(plane_x_z_);
+		double fy = full_y.fit(plane_y_z_);
+
+		int pixel = binning_.index( fx, fy);
+		if (pixel != -1)
+			current->second.accumulator.add( pixel,
+				cache_.PSET( position, tags[i]));
+	}
+
+	poll();
+}
+
+void
+SlicedReconstruction::poll()
+{
+	if (idle_timeout_ <= 0.0)
+		return;
+
+	Clock::time_point now = Clock::now();
+
+	// slices are closed in order, so an idle slice closes older ones too
+	OpenSlicesMap::iterator last = slices_.end();
+	for ( OpenSlicesMap::iterator iter = slices_.begin();
+		iter != slices_.end(); ++iter) {
+		std::chrono::duration<double, std::milli> idle =
+			now - iter->second.updated;
+		if (idle.count() >= idle_timeout_)
+			last = iter;
+	}
+
+	if (last != slices_.end()) {
+		unsigned long long id = last->first;
+		while (!slices_.empty() && slices_.begin()->first <= id)
+			close(slices_.begin());
+	}
+}
+
+void
+SlicedReconstruction::flush()
+{
+	while (!slices_.empty())
+		close(slices_.begin());
+}
+
+void
+SlicedReconstruction::close(OpenSlicesMap::iterator iter)
+{
+	TimeSliceImage result;
+	result.slice = iter->first;
+	result.image = iter->second.accumulator.image();
+
+	std::chrono::duration<double, std::milli> latency =
+		Clock::now() - iter->second.updated;
+	result.latency = latency.count();
+	result.late = (latency_target_ > 0.0 && result.latency > latency_target_);
+
+	finished_.push_back(result);
+
+	closed_ = true;
+	last_closed_ = iter->first;
+	slices_.erase(iter);
+}
+
+bool
+SlicedReconstruction::pop(TimeSliceImage& image)
+{
+	if (finished_.empty())
+		return false;
+
+	image = finished_.front();
+	finished_.pop_front();
+	return true;
+}
+
+} // namespace TREC
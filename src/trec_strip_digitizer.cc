@@ -0,0 +1,159 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "trec_strip_digitizer.hh"
+
+namespace {
+
+const int planes = TREC_NUMBER_OF_SILICON_DETECTORS;
+const int guard = 2; // guard strips on each side of the charges array
+
+} // namespace
+
+namespace TREC {
+
+DigitizerParameters::DigitizerParameters()
+	:
+	strip_threshold(0.025 * units::MeV), // ~1/3 of MIP in 300 um
+	charge_sharing(0.2),
+	cross_talk(0.02),
+	adc_unit(0.01 * units::MeV),
+	calorimeter_threshold(0.1 * units::MeV), // secondaries past the peak
+	batch_size(256)
+{
+}
+
+StripDigitizer::StripDigitizer(const DigitizerParameters& parameters)
+	:
+	parameters_(parameters)
+{
+	for ( int i = 0; i < planes; ++i) {
+		// measured coordinate with the in-plane rotation, as EventGenerator
+		const PlaneTransform& t = StripGeometry::transforms()[i];
+		double ax = plane_metadata_[i].y_axis ? -t.sin_angle : t.cos_angle;
+		double ay = plane_metadata_[i].y_axis ? t.cos_angle : t.sin_angle;
+
+		Plane& p = planes_[i];
+		p.cx = t.sign * ax / t.pitch;
+		p.cy = t.sign * ay / t.pitch;
+		p.c0 = -t.origin / t.pitch;
+		p.strips = StripGeometry::geometries()[i].strips;
+		p.charges.assign( p.strips + 2 * guard, 0.0);
+		p.induced.assign( p.strips + 2 * guard, 0.0);
+	}
+}
+
+void
+StripDigitizer::digitize( int plane, NumbersVector& numbers)
+{
+	Plane& p = planes_[plane];
+	numbers.clear();
+
+	size_t n = p.edep.size();
+	if (!n)
+		return;
+
+	if (strip_.size() < n) {
+		strip_.resize(n);
+		next_.resize(n);
+		shared_.resize(n);
+	}
+
+	const double* x = &p.x[0];
+	const double* y = &p.y[0];
+	const double* edep = &p.edep[0];
+	int* strip = &strip_[0];
+	int* next = &next_[0];
+	double* shared = &shared_[0];
+
+	double cx = p.cx, cy = p.cy, c0 = p.c0;
+	double last_strip = p.strips;
+	double width = parameters_.charge_sharing;
+	double edge = 0.5 - 0.5 * width;
+	double scale = (width > 0.0) ? 1.0 / width : 0.0;
+
+	// strips of the deposits batch, branch free and vectorized by
+	// the compiler; positions outside the plane go to the guard strips
+	for ( size_t k = 0; k < n; ++k) {
+		double f = cx * x[k] + cy * y[k] + c0;
+		f = std::min( std::max( f, -1.0), last_strip);
+		int s = static_cast<int>(f + 1.5) - 1; // floor(f + 0.5)
+		double d = f - s;
+
+		// linear sharing with the nearest neighbour near the strips border
+		double share = std::min( std::max( (std::fabs(d) - edge) * scale, 0.0), 0.5);
+		strip[k] = s;
+		next[k] = s + ((d < 0.0) ? -1 : 1);
+		shared[k] = edep[k] * share;
+	}
+
+	double* q = &p.charges[guard];
+	int first = p.strips, last = -1;
+	for ( size_t k = 0; k < n; ++k) {
+		q[strip[k]] += edep[k] - shared[k];
+		q[next[k]] += shared[k];
+		first = std::min( first, std::min( strip[k], next[k]));
+		last = std::max( last, std::max( strip[k], next[k]));
+	}
+
+	// deposits outside the plane are dropped
+	q[-2] = q[-1] = q[p.strips] = q[p.strips + 1] = 0.0;
+
+	int begin = std::max( first - 1, 0);
+	int end = std::min( last + 1, p.strips - 1);
+	double xt = parameters_.cross_talk;
+	double* v = &p.induced[guard];
+	for ( int i = begin; i <= end; ++i)
+		v[i] = (1.0 - 2.0 * xt) * q[i] + xt * (q[i - 1] + q[i + 1]);
+
+	double threshold = parameters_.strip_threshold;
+	for ( int i = begin; i <= end; ++i)
+		if (v[i] >= threshold)
+			numbers.push_back(i);
+
+	std::fill( q + first, q + last + 1, 0.0);
+
+	p.x.clear();
+	p.y.clear();
+	p.edep.clear();
+}
+
+void
+StripDigitizer::digitize(HitsPositions& hits)
+{
+	for ( int i = 0; i < planes; ++i) {
+		digitize( i, numbers_);
+		hits.add_plane_numbers( plane_metadata_[i].type, numbers_);
+	}
+}
+
+void
+StripDigitizer::clear()
+{
+	for ( int i = 0; i < planes; ++i) {
+		planes_[i].x.clear();
+		planes_[i].y.clear();
+		planes_[i].edep.clear();
+	}
+}
+
+} // namespace TREC
@@ -17,143 +17,186 @@
  * 
  */
 
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
 #include "trec_strip_geometry.hh"
 
 namespace {
 
-const std::string Silicon("Silicon");
-const std::string Log("Log");
-const std::string Phys("Phys");
-const std::string Parallel("Parallel");
-const std::string Division("Division");
-const std::string Sensitive("Sensitive");
-const std::string Detector("Detector");
+const int planes = TREC_NUMBER_OF_SILICON_DETECTORS;
+
+static_assert( sizeof(TREC::strip_geometry_) / sizeof(TREC::StripGeometry) == planes,
+	"Built-in geometry doesn't match the number of planes");
+
+/** Geometry of the setup at runtime: built-in geometry with the loaded
+ * alignment, and transforms compiled from it
+ */
+struct RuntimeGeometry {
+	RuntimeGeometry();
+
+	/** Compile transform of the plane from its geometry
+	 */
+	void compile(int i);
+
+	TREC::StripGeometry geometry[planes];
+	TREC::PlaneTransform transforms[planes];
+};
+
+RuntimeGeometry::RuntimeGeometry()
+{
+	for ( int i = 0; i < planes; ++i) {
+		geometry[i] = TREC::strip_geometry_[i];
+		compile(i);
+	}
+}
+
+void
+RuntimeGeometry::compile(int i)
+{
+	const TREC::StripGeometry& g = geometry[i];
+	TREC::PlaneTransform& t = transforms[i];
+
+	t.origin = -g.x // half on detector size
+		+ g.pitch / 2.0 // half strip offset
+		+ g.offset // pitch offset
+		+ g.dx; // detector offset
+	t.pitch = g.pitch;
+	// Y axis is opposite to the strips numbers
+	t.sign = TREC::plane_metadata_[i].y_axis ? -1.0 : 1.0;
+	t.cos_angle = std::cos(g.angle_diff);
+	t.sin_angle = std::sin(g.angle_diff);
+	t.z = g.z;
+}
+
+RuntimeGeometry&
+runtime()
+{
+	static RuntimeGeometry geometry;
+	return geometry;
+}
 
 } // namespace
 
 namespace TREC {
 
 const StripGeometry*
-StripGeometry::get(StripGeometryType type)
+StripGeometry::geometries()
 {
-	const StripGeometry* geom = 0;
-
-	switch (type) {
-	case MSD_Y1:
-		geom = &strip_geometry_[0];
-		break;
-	case MSD_X1:
-		geom = &strip_geometry_[1];
-		break;
-	case MSD_Y2:
-		geom = &strip_geometry_[2];
-		break;
-	case MSD_X2:
-		geom = &strip_geometry_[3];
-		break;
-	case MSD_Y3:
-		geom = &strip_geometry_[4];
-		break;
-	case MSD_X3:
-		geom = &strip_geometry_[5];
-		break;
-	case MSD__U:
-		geom = &strip_geometry_[6];
-		break;
-	case MSD__V:
-		geom = &strip_geometry_[7];
-		break;
-	case MSD_ER: // error - no value
-	default:
-		break;
-	}
+	return runtime().geometry;
+}
 
-	return geom;
+const PlaneTransform*
+StripGeometry::transforms()
+{
+	return runtime().transforms;
+}
+
+StripGeometryType
+StripGeometry::type(const std::string& plane_name)
+{
+	for ( int i = 0; i < planes; ++i) {
+		if (plane_name == plane_metadata_[i].name)
+			return plane_metadata_[i].type;
+	}
+	return MSD_ER;
 }
 
-StripGeometryMap
-StripGeometry::create()
+bool
+StripGeometry::load(const char* filename)
 {
-	StripGeometryMap map;
-	
-	map[MSD_Y1] = StripGeometryPair( strip_geometry_[0], create(MSD_Y1));
-	map[MSD_X1] = StripGeometryPair( strip_geometry_[1], create(MSD_X1));
-	map[MSD_Y2] = StripGeometryPair( strip_geometry_[2], create(MSD_Y2));
-	map[MSD_X2] = StripGeometryPair( strip_geometry_[3], create(MSD_X2));
-	map[MSD_Y3] = StripGeometryPair( strip_geometry_[4], create(MSD_Y3));
-	map[MSD_X3] = StripGeometryPair( strip_geometry_[5], create(MSD_X3));
-	map[MSD__U] = StripGeometryPair( strip_geometry_[6], create(MSD__U));
-	map[MSD__V] = StripGeometryPair( strip_geometry_[7], create(MSD__V));
-
-	return map;
+	std::ifstream file(filename);
+	if (!file.is_open()) {
+		std::cerr << "Can't open geometry file " << filename << std::endl;
+		return false;
+	}
+
+	RuntimeGeometry& rt = runtime();
+	StripGeometry geometry[planes];
+	std::copy( rt.geometry, rt.geometry + planes, geometry);
+
+	std::string line;
+	int line_number = 0;
+	while (std::getline( file, line)) {
+		++line_number;
+		line = line.substr( 0, line.find('#'));
+
+		std::istringstream in(line);
+		std::string plane_name;
+		if (!(in >> plane_name))
+			continue; // empty or comment line
+
+		double z, angle, x, pitch, t, dx, offset, angle_diff;
+		int strips;
+		in >> z >> angle >> x >> strips >> pitch >> t >> dx >> offset >> angle_diff;
+
+		int i = index(type(plane_name));
+		if (in.fail() || i == -1 || strips <= 0 || pitch <= 0.0) {
+			std::cerr << "Geometry file " << filename << ", line ";
+			std::cerr << line_number << ": wrong plane parameters" << std::endl;
+			return false;
+		}
+
+		StripGeometry& g = geometry[i];
+		g.z = z * units::mm;
+		g.angle = angle * units::deg;
+		g.x = x * units::mm;
+		g.strips = strips;
+		g.pitch = pitch * units::um;
+		g.t = t * units::um;
+		g.dx = dx * units::um;
+		g.offset = offset * units::um;
+		g.angle_diff = angle_diff * units::deg;
+	}
+
+	// whole file is valid, apply it
+	for ( int i = 0; i < planes; ++i) {
+		rt.geometry[i] = geometry[i];
+		rt.compile(i);
+	}
+	return true;
 }
 
-StripNamesMap
-StripGeometry::create_names()
+bool
+StripGeometry::set( StripGeometryType plane, const StripGeometry& geometry)
 {
-	StripNamesMap map;
-
-	map[MSD_Y1] = create(MSD_Y1);
-	map[MSD_X1] = create(MSD_X1);
-	map[MSD_Y2] = create(MSD_Y2);
-	map[MSD_X2] = create(MSD_X2);
-	map[MSD_Y3] = create(MSD_Y3);
-	map[MSD_X3] = create(MSD_X3);
-	map[MSD__U] = create(MSD__U);
-	map[MSD__V] = create(MSD__V);
-
-	return map;
+	int i = index(plane);
+	if (i == -1)
+		return false;
+
+	RuntimeGeometry& rt = runtime();
+	rt.geometry[i] = geometry;
+	rt.compile(i);
+	return true;
 }
 
-StripGeometryNames
-StripGeometry::create(StripGeometryType type)
+bool
+StripGeometry::save(const char* filename)
 {
-	StripGeometryNames names;
-	std::string value;
-	switch (type) {
-	case MSD_Y1:
-		value = std::string("Y1");
-		break;
-	case MSD_X1:
-		value = std::string("X1");
-		break;
-	case MSD_Y2:
-		value = std::string("Y2");
-		break;
-	case MSD_X2:
-		value = std::string("X2");
-		break;
-	case MSD_Y3:
-		value = std::string("Y3");
-		break;
-	case MSD_X3:
-		value = std::string("X3");
-		break;
-	case MSD__U:
-		value = std::string("U");
-		break;
-	case MSD__V:
-		value = std::string("V");
-		break;
-	case MSD_ER: // error - no value
-	default:
-		break;
+	std::ofstream file(filename);
+	if (!file.is_open()) {
+		std::cerr << "Can't open geometry file " << filename << std::endl;
+		return false;
 	}
-	
-	if (!value.empty()) {
-		names.body_name = Silicon + value;
-		names.logical_name = Silicon + value + Log;
-		names.physical_name = Silicon + value + Phys;
-		names.parallel_body_name = Silicon + value + Parallel;
-		names.parallel_logical_name = Silicon + value + Log + Parallel;
-		names.parallel_physical_name = Silicon + value + Phys + Parallel;
-		names.body_devision_name = Silicon + value + Division + Parallel;
-		names.logical_devision_name = Silicon + value + Log + Division + Parallel;
-		names.physical_devision_name = Silicon + value + Phys + Division + Parallel;
-		names.functional_detector_name = Detector + value;
-		names.sensitive_detector_name = Sensitive + Detector + value;
+
+	file << "# plane z(mm) angle(deg) half_size(mm) strips pitch(um) ";
+	file << "thickness(um) dx(um) offset(um) angle_diff(deg)" << std::endl;
+	file.precision(10);
+
+	const RuntimeGeometry& rt = runtime();
+	for ( int i = 0; i < planes; ++i) {
+		const StripGeometry& g = rt.geometry[i];
+		file << plane_metadata_[i].name << " " << g.z / units::mm << " ";
+		file << g.angle / units::deg << " " << g.x / units::mm << " ";
+		file << g.strips << " " << g.pitch / units::um << " ";
+		file << g.t / units::um << " " << g.dx / units::um << " ";
+		file << g.offset / units::um << " " << g.angle_diff / units::deg;
+		file << std::endl;
 	}
-	return names;
+	return file.good();
 }
 
 } // namespace TREC
@@ -17,95 +17,89 @@
  * 
  */
 
-#include <G4SystemOfUnits.hh>
-#include <G4UnitsTable.hh>
+#include <iostream>
+#include <mutex>
+#include <algorithm>
+#include <cmath>
 
 #include "trec_defines.hh"
+#include "trec_units.hh"
 #include "trec_system_configure.hh"
 #include "trec_ccmath.h"
 
 #define LINEAR_FIT 2
 
-#define N1   5
-#define N2   7
-
 namespace {
 
-// calorimeter slice = 1.5 mm in G4_POLYSTYRENE
-const struct EnergyPositionData {
-	double energy; // MeV/u
-	int position; // calorimeter slice + 1
-} ps_epdata[N1] = {
-	{ 180.0, 44 },
-	{ 280.0, 96 },
-	{ 380.0, 159 },
-	{ 455.0, 213 },
-	{ 480.0, 232 }
-};
-
-// calorimeter slice = 1.5 mm in G4_WATER
-const struct EnergyPositionData water_epdata[N1] = {
-	{ 180.0, 46 },
-	{ 280.0, 100 },
-	{ 380.0, 166 },
-	{ 455.0, 223 },
-	{ 480.0, 243 }
-};
-
-// (455 MeV/u) G4_POLYSTYRENE object and calorimeter
-const struct ThicknessPositionData {
-	double thickness; // cm
-	int position; // calorimeter slice + 1
-} ps_ps_tpdata[N2] = {
-	{ 3.0, 193 },
-	{ 6.0, 173 },
-	{ 10.0, 147 },
-	{ 15.0, 113 },
-	{ 20.0, 80 },
-	{ 25.0, 47 },
-	{ 30.0, 13 }
-};
-
-// (455 MeV/u) G4_POLYSTYRENE object and G4_WATER calorimeter
-const struct ThicknessPositionData ps_water_tpdata[N1] = {
-	{ 6.0, 173 },
-	{ 10.0, 153 },
-	{ 20.0, 84 },
-	{ 25.0, 49 },
-	{ 30.0, 14 }
-};
-
-const double calo_x = TREC_SIZE_CALORIMETER * CLHEP::mm / 2.0;  // half size
+const double calo_x = TREC_SIZE_CALORIMETER * TREC::units::mm / 2.0;  // half size
 const double calo_y = calo_x;  // half size
-const double calo_z = TREC_SIZE_CALORIMETER_THICKNESS * CLHEP::mm / 2.0; // half size
-const double calo_slice_z = TREC_SIZE_CALORIMETER_SLICE_THICKNESS * CLHEP::um / 2.0; // half size
+const double calo_z = TREC_SIZE_CALORIMETER_THICKNESS * TREC::units::mm / 2.0; // half size
+const double calo_slice_z = TREC_SIZE_CALORIMETER_SLICE_THICKNESS * TREC::units::um / 2.0; // half size
 const int calo_slices = static_cast<int>(calo_z / calo_slice_z);
 
 const double sigma_xy1 = TREC_SIZE_SILICON_STRIP / sqrt(12.);
 
 const double tension = 0.6;
 
+std::mutex instance_mutex; // guards the global instance
+
+/** Bragg-Kleeman rule fitted to the clear bregg peak positions:
+ * ln(range) = ln(alpha) + power * ln(energy)
+ */
+bool
+range_energy_fit( const TREC::CalibrationPointsVector& data, double slice_size,
+	double& alpha, double& power)
+{
+	double n = data.size();
+	double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+	for ( size_t i = 0; i < data.size(); ++i) {
+		double x = log(data[i].value);
+		double y = log(data[i].position * slice_size);
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+
+	double det = n * sxx - sx * sx;
+	if (det == 0.0)
+		return false;
+
+	power = (n * sxy - sx * sy) / det;
+	alpha = exp((sy - power * sx) / n);
+	return true;
+}
+
 } // namespace
 
 namespace TREC {
 
 SharedConf SystemConfigure::instance_;
 
+SharedConf
+SystemConfigure::create( const char* filename, double energy)
+{
+	return SharedConf(new SystemConfigure( filename, energy));
+}
+
 SharedConf
 SystemConfigure::instance() 
 {
+	std::lock_guard<std::mutex> lock(instance_mutex);
 	return instance_;
 }
 
 SharedConf
 SystemConfigure::instance(const char* filename)
 {
-	instance_ = SharedConf(new SystemConfigure(filename));
+	SharedConf conf = create(filename);
 
+	std::lock_guard<std::mutex> lock(instance_mutex);
+	instance_ = conf;
 	return instance_;
 }
 
-SystemConfigure::SystemConfigure(const char*)
+SystemConfigure::SystemConfigure( const char* filename, double energy)
 	:
 	calorimeter_slices_(calo_slices),
 	calorimeter_slice_size_(calo_slice_z * 2.0),
@@ -115,9 +109,31 @@ SystemConfigure::SystemConfigure(const char*)
 	clear_points_(0),
 	material_position_(0), // object thickness - bregg peak position linear fit
 	material_points_(0),
-	energy_(455.0)
+	energy_(energy),
+	range_alpha_(0.0),
+	range_power_(1.0),
+	water_alpha_(0.0),
+	water_power_(1.0),
+	slice_clear_(0.0),
+	water_ratio_(1.0),
+	clear_table_energy_(0.0),
+	clear_table_step_(0.1)
 {
+	// calibration file, or built-in calibration if there is no file
+	if (filename && *filename) {
+		if (!calibration_.load(filename)) {
+			std::cerr << "Can't load calibration file " << filename;
+			std::cerr << ", built-in calibration is used" << std::endl;
+			calibration_ = CalibrationData::builtin();
+		}
+	}
+	else
+		calibration_ = CalibrationData::builtin();
+
 	calculate_position_2_pset();
+	calculate_range_energy();
+	calculate_position_2_wet();
+	calculate_position_2_wepl();
 }
 
 SystemConfigure::~SystemConfigure()
@@ -153,19 +169,153 @@ SystemConfigure::calculate_calorimeter_wepl()
 	// Use ps_water_tpdata for pb, d and water_epdata for energy dependency pb0
 }
 
+double
+SystemConfigure::range(double energy) const
+{
+	return (energy > 0.0) ? range_alpha_ * pow( energy, range_power_) : 0.0;
+}
+
+double
+SystemConfigure::residual_energy( double energy, double thickness) const
+{
+	double residual = range(energy) - thickness;
+	if (residual <= 0.0)
+		return 0.0; // ion stops within the layer
+
+	return pow( residual / range_alpha_, 1.0 / range_power_);
+}
+
 double
 SystemConfigure::PSET(int slice) const
 {
-	double slice_clear = ccm_splfit( energy_, clear_energy_,
-		clear_position_, clear_spline_, clear_points_ - 1, tension);
+	if (slice >= 0 && slice < int(pset_.size()))
+		return pset_[slice];
+
+	return compute_pset(slice);
+}
+
+double
+SystemConfigure::WET(int slice) const
+{
+	if (slice >= 0 && slice < int(wet_.size()))
+		return wet_[slice];
+
+	return compute_pset(slice) * water_ratio_;
+}
+
+double
+SystemConfigure::WEPL(int slice) const
+{
+	if (slice >= 0 && slice < int(wepl_.size()))
+		return wepl_[slice];
+
+	return compute_wepl(slice);
+}
+
+double
+SystemConfigure::PSET(double slice) const
+{
+	if (slice >= 0.0 && slice <= pset_.size() - 1.0)
+		return interpolate( pset_, slice);
+
+	return compute_pset(slice);
+}
+
+double
+SystemConfigure::WET(double slice) const
+{
+	if (slice >= 0.0 && slice <= wet_.size() - 1.0)
+		return interpolate( wet_, slice);
+
+	return compute_pset(slice) * water_ratio_;
+}
+
+double
+SystemConfigure::WEPL(double slice) const
+{
+	if (slice >= 0.0 && slice <= wepl_.size() - 1.0)
+		return interpolate( wepl_, slice);
+
+	return compute_wepl(slice);
+}
+
+double
+SystemConfigure::PSET( int slice, double energy) const
+{
+	double slice_clear = clear_position(energy);
+	return (slice - slice_clear) / material_position_[1]; // cm
+}
+
+double
+SystemConfigure::PSET( double slice, double energy) const
+{
+	double slice_clear = clear_position(energy);
+	return (slice - slice_clear) / material_position_[1]; // cm
+}
+
+double
+SystemConfigure::clear_position(double energy) const
+{
+	double position;
+	clear_positions( &energy, &position, 1);
+	return position;
+}
+
+void
+SystemConfigure::clear_positions( const double* energies, double* positions,
+	size_t n) const
+{
+	// linear interpolation of the dense spline table, the first
+	// and the last intervals are extended outside the table
+	const double* table = &clear_table_[0];
+	double last = clear_table_.size() - 2.0;
+	double inv_step = 1.0 / clear_table_step_;
+
+	for ( size_t i = 0; i < n; ++i) {
+		double f = (energies[i] - clear_table_energy_) * inv_step;
+		double k = std::min( std::max( std::floor(f), 0.0), last);
+		size_t j = static_cast<size_t>(k);
+		positions[i] = table[j] + (f - k) * (table[j + 1] - table[j]);
+	}
+}
+
+double
+SystemConfigure::interpolate( const std::vector<double>& table, double slice)
+{
+	size_t i = static_cast<size_t>(slice);
+	if (i + 1 >= table.size())
+		return table.back();
+
+	double frac = slice - i;
+	return table[i] + frac * (table[i + 1] - table[i]);
+}
+
+double
+SystemConfigure::compute_pset(double slice) const
+{
 //	double dx1 = (slice - material_position_[0]) / material_position_[1]; // cm
 
-	double dx2 = (slice - slice_clear) /  material_position_[1]; // cm
+	double dx2 = (slice - slice_clear_) /  material_position_[1]; // cm
 	
 	return dx2;
 //	return dx1;
 }
 
+double
+SystemConfigure::compute_wepl(double slice) const
+{
+	// residual energy behind the object of the polystyrene equivalent
+	// thickness, then the ranges difference in water
+	double thickness = compute_pset(slice) * units::cm;
+	double energy_out = residual_energy( energy_, thickness);
+
+	double range_in = water_alpha_ * pow( energy_, water_power_);
+	double range_out = (energy_out > 0.0) ?
+		water_alpha_ * pow( energy_out, water_power_) : 0.0;
+
+	return (range_in - range_out) / units::cm;
+}
+
 void
 SystemConfigure::calculate_position_2_pset()
 {
@@ -173,19 +323,24 @@ SystemConfigure::calculate_position_2_pset()
 	// Use ps_water_tpdata for pb, d and water_epdata for energy dependency pb0
 
 	int i, j;
-	clear_energy_ = new double[N1];
-	clear_position_ = new double[N1];
-	clear_spline_ = new double[N1];
+	const CalibrationPointsVector& energy = calibration_.ps_energy;
+	const CalibrationPointsVector& thickness = calibration_.ps_thickness;
+	int n1 = energy.size();
+	int n2 = thickness.size();
 
-	material_position_ = new double[N2];
-	double *tmp = new double[LINEAR_FIT * N2];
+	clear_energy_ = new double[n1];
+	clear_position_ = new double[n1];
+	clear_spline_ = new double[n1];
 
-	for ( i = 0; i < N1; ++i) {
-		clear_energy_[i] = ps_epdata[i].energy;
-		clear_position_[i] = ps_epdata[i].position;
+	material_position_ = new double[n2];
+	double *tmp = new double[LINEAR_FIT * n2];
+
+	for ( i = 0; i < n1; ++i) {
+		clear_energy_[i] = energy[i].value;
+		clear_position_[i] = energy[i].position;
 	}
 
-	clear_points_ = N1;
+	clear_points_ = n1;
 	ccm_cspl( clear_energy_, clear_position_, clear_spline_,
 		clear_points_ - 1, tension);
 
@@ -196,16 +351,16 @@ SystemConfigure::calculate_position_2_pset()
 	}
 ******/
 
-	for ( i = 0; i < N2; ++i) {
-		material_position_[i] = ps_ps_tpdata[i].position;
+	for ( i = 0; i < n2; ++i) {
+		material_position_[i] = thickness[i].position;
 		for ( j = 0; j < LINEAR_FIT; ++j) {
-			tmp[i * LINEAR_FIT + j] = pow( ps_ps_tpdata[i].thickness, j);
+			tmp[i * LINEAR_FIT + j] = pow( thickness[i].value, j);
 		}
 	}
 
-	material_points_ = N2;
+	material_points_ = n2;
 
-//	matprt( tmp, N2, LINEAR_FIT, " %9.4f");
+//	matprt( tmp, n2, LINEAR_FIT, " %9.4f");
 
 	std::cout << "Compute least squares coefficients via QR reduction." << std::endl;
 	/* double t = */ ccm_qrlsq( tmp, material_position_, material_points_, LINEAR_FIT, &i);
@@ -216,7 +371,7 @@ SystemConfigure::calculate_position_2_pset()
 //		std::cout << "best fit: " << " Y = " << material_position_[0];
 //		std::cout << " + " << material_position_[1] << " X" << std::endl;
 		
-//		matprt( tmp, N2, LINEAR_FIT, " %9.4f");
+//		matprt( tmp, n2, LINEAR_FIT, " %9.4f");
 
 //		printf("cf-out:\n");
 //		matprt( y_lft, 1, LINEAR_FIT, " %10.6f");
@@ -224,6 +379,68 @@ SystemConfigure::calculate_position_2_pset()
 	}
 
 	delete [] tmp;
+
+	slice_clear_ = ccm_splfit( energy_, clear_energy_,
+		clear_position_, clear_spline_, clear_points_ - 1, tension);
+
+	// dense clear bregg peak position table for the batched evaluation
+	clear_table_energy_ = clear_energy_[0];
+	int points = static_cast<int>((clear_energy_[clear_points_ - 1] -
+		clear_energy_[0]) / clear_table_step_ + 0.5) + 1;
+	clear_table_.resize(std::max( points, 2));
+	for ( i = 0; i < int(clear_table_.size()); ++i) {
+		double e = std::min( clear_table_energy_ + i * clear_table_step_,
+			clear_energy_[clear_points_ - 1]);
+		clear_table_[i] = ccm_splfit( e, clear_energy_,
+			clear_position_, clear_spline_, clear_points_ - 1, tension);
+	}
+
+	pset_.resize(calorimeter_slices_);
+	for ( i = 0; i < calorimeter_slices_; ++i)
+		pset_[i] = compute_pset(i);
+}
+
+void
+SystemConfigure::calculate_range_energy()
+{
+	if (!range_energy_fit( calibration_.ps_energy, calorimeter_slice_size_,
+		range_alpha_, range_power_))
+		std::cerr << "range energy fit failed" << std::endl;
+
+	if (!range_energy_fit( calibration_.water_energy, calorimeter_slice_size_,
+		water_alpha_, water_power_))
+		std::cerr << "water range energy fit failed" << std::endl;
+}
+
+void
+SystemConfigure::calculate_position_2_wet()
+{
+	// ratio of the clear bregg peak positions in water and polystyrene
+	// calorimeters at the beam energy
+	const CalibrationPointsVector& water = calibration_.water_energy;
+	int n = water.size();
+	std::vector<double> energy(n), position(n), spline(n);
+	for ( int i = 0; i < n; ++i) {
+		energy[i] = water[i].value;
+		position[i] = water[i].position;
+	}
+	ccm_cspl( &energy[0], &position[0], &spline[0], n - 1, tension);
+
+	double water_clear = ccm_splfit( energy_, &energy[0], &position[0],
+		&spline[0], n - 1, tension);
+	water_ratio_ = water_clear / slice_clear_;
+
+	wet_.resize(pset_.size());
+	for ( size_t i = 0; i < pset_.size(); ++i)
+		wet_[i] = pset_[i] * water_ratio_;
+}
+
+void
+SystemConfigure::calculate_position_2_wepl()
+{
+	wepl_.resize(calorimeter_slices_);
+	for ( int i = 0; i < calorimeter_slices_; ++i)
+		wepl_[i] = compute_wepl(i);
 }
 
 } // namespace TREC
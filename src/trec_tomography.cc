@@ -0,0 +1,405 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <cmath>
+#include <limits>
+#include <unistd.h>
+
+#ifdef TREC_USE_ROOT
+#include <TH3.h>
+#include <TFile.h>
+#endif
+
+#include "trec_parallel.hh"
+#include "trec_tomography.hh"
+
+namespace {
+
+/** Size of the system matrix row in bytes, lengths are padded
+ * so the next row is aligned
+ */
+size_t
+row_size(unsigned int n)
+{
+	return sizeof(unsigned int) + sizeof(float) + n * sizeof(int) +
+		((n + 1) / 2) * 2 * sizeof(unsigned short);
+}
+
+/** Append system matrix row into the buffer
+ * row: number of voxels, projection value, voxels indexes, lengths
+ */
+void
+write_row( std::vector<char>& buf, float value,
+	const TREC::SparseRows& rows, size_t row)
+{
+	size_t begin = rows.row_ptr[row];
+	unsigned int n = rows.row_ptr[row + 1] - begin;
+	size_t pos = buf.size();
+	buf.resize(pos + row_size(n), 0);
+
+	char* p = &buf[pos];
+	memcpy( p, &n, sizeof(unsigned int));
+	p += sizeof(unsigned int);
+	memcpy( p, &value, sizeof(float));
+	p += sizeof(float);
+	memcpy( p, &rows.voxels[begin], n * sizeof(int));
+	p += n * sizeof(int);
+	memcpy( p, &rows.lengths[begin], n * sizeof(unsigned short));
+}
+
+/** Row of the system matrix in the buffer
+ */
+struct Row {
+	Row(const char* p) {
+		memcpy( &n, p, sizeof(unsigned int));
+		memcpy( &value, p + sizeof(unsigned int), sizeof(float));
+		voxels = (const int *)(p + sizeof(unsigned int) + sizeof(float));
+		lengths = (const unsigned short *)(voxels + n);
+	}
+
+	unsigned int n;
+	float value;
+	const int* voxels;
+	const unsigned short* lengths;
+};
+
+/** Entries of the row within the slab of z planes, voxels [v0, v1).
+ * Voxels of the row are in the path order, so their plane index is
+ * monotonic and the entries of the slab are contiguous.
+ * @param voxels - voxels of the row
+ * @param n - number of voxels
+ * @param v0, v1 - voxels of the slab
+ * @param begin - returns first entry of the slab
+ * @param end - returns entry after the last one
+ */
+void
+slab_entries( const int* voxels, unsigned int n, int v0, int v1,
+	unsigned int& begin, unsigned int& end)
+{
+	const int* first = voxels;
+	const int* last = voxels + n;
+	const int* b;
+	const int* e;
+	if (!n || voxels[0] <= voxels[n - 1]) {
+		b = std::partition_point( first, last, [v0](int v) { return v < v0; });
+		e = std::partition_point( b, last, [v1](int v) { return v < v1; });
+	}
+	else {
+		b = std::partition_point( first, last, [v1](int v) { return v >= v1; });
+		e = std::partition_point( b, last, [v0](int v) { return v >= v0; });
+	}
+	begin = b - voxels;
+	end = e - voxels;
+}
+
+} // namespace
+
+namespace TREC {
+
+Tomography::Tomography( const VolumeGrid& grid, double isocenter,
+	int object_slice_min, int clear_slice_max, const char* prefix,
+	SharedConf conf)
+	:
+	conf_(conf),
+	grid_(grid),
+	tracer_( grid, isocenter),
+	object_pos_min_(object_slice_min),
+	clear_pos_max_(clear_slice_max),
+	rows_(0),
+	volume_( grid.voxels(), 0.0)
+{
+	// new empty system matrix, the name is unique for each object
+	std::string name = std::string(prefix) + "XXXXXX";
+	std::vector<char> buf( name.begin(), name.end());
+	buf.push_back('\0');
+
+	int fd = mkstemp(&buf[0]);
+	if (fd == -1) {
+		std::cerr << "Can't create system matrix file " << name << std::endl;
+		return;
+	}
+	close(fd);
+	filename_ = &buf[0];
+}
+
+Tomography::~Tomography()
+{
+	if (!filename_.empty())
+		std::remove(filename_.c_str());
+}
+
+bool
+Tomography::add_projection( const FullTracksVector& tracks, double angle,
+	unsigned int threads, size_t chunk)
+{
+	threads = worker_threads(threads);
+	chunk = std::max( chunk, size_t(1));
+
+	std::ofstream file( filename_.c_str(), std::ios::binary | std::ios::app);
+	if (filename_.empty() || !file.is_open()) {
+		std::cerr << "Can't open system matrix file " << filename_ << std::endl;
+		return false;
+	}
+	file.seekp( 0, std::ios::end);
+
+	RowsBlock block;
+	block.angle = angle;
+	block.offset = file.tellp();
+	block.rows = 0;
+	block.size = 0;
+
+	TracksArrays arrays;
+	SparseRows matrix;
+	std::vector< std::vector<char> > buffers(threads);
+	std::vector<size_t> rows( threads, 0);
+
+	for ( size_t first = 0; first < tracks.size(); first += chunk) {
+		size_t last = std::min( first + chunk, tracks.size());
+		arrays.assign( tracks, first, last);
+		tracer_.trace( arrays, angle, matrix, threads);
+
+		for ( unsigned int t = 0; t < threads; ++t) {
+			buffers[t].clear();
+			rows[t] = 0;
+		}
+
+		parallel_for( last - first, threads,
+			[&]( size_t begin, size_t end, unsigned int t) {
+			for ( size_t i = begin; i < end; ++i) {
+				const int& position = tracks[first + i].second;
+				if (position > clear_pos_max_ || position < object_pos_min_)
+					continue;
+
+				if (matrix.row_ptr[i] == matrix.row_ptr[i + 1])
+					continue; // track misses the grid
+
+				// PSET (cm) is the path integral of relative stopping power
+				float value = conf_->PSET(position) * 10.0; // mm
+				write_row( buffers[t], value, matrix, i);
+				rows[t]++;
+			}
+		});
+
+		for ( unsigned int t = 0; t < threads; ++t) {
+			if (buffers[t].empty())
+				continue;
+			file.write( &buffers[t][0], buffers[t].size());
+			block.rows += rows[t];
+			block.size += buffers[t].size();
+		}
+	}
+	file.close();
+
+	if (!file) {
+		std::cerr << "Can't write system matrix file " << filename_ << std::endl;
+		return false;
+	}
+
+	blocks_.push_back(block);
+	rows_ += block.rows;
+	return true;
+}
+
+bool
+Tomography::reconstruct( int iterations, int subsets, double lambda,
+	unsigned int threads, size_t chunk)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	threads = worker_threads(threads);
+	subsets = std::max( 1, std::min( subsets, int(blocks_.size())));
+	chunk = std::max( chunk, size_t(1));
+
+	size_t voxels = grid_.voxels();
+	int plane = grid_.nx * grid_.ny;
+	unsigned int max_row = grid_.nx + grid_.ny + grid_.nz + 3; // voxels
+		// crossed by a line
+
+	std::vector<double> num(voxels);
+	std::vector<double> den(voxels);
+	std::vector<double> ssq(threads);
+	std::vector<double> corr;
+
+	std::ifstream file( filename_.c_str(), std::ios::binary);
+	if (filename_.empty() || !file.is_open()) {
+		std::cerr << "Can't open system matrix file " << filename_ << std::endl;
+		return false;
+	}
+
+	std::vector<char> buf;
+	std::vector<size_t> offsets;
+
+	for ( int iter = 0; iter < iterations; ++iter) {
+		Clock::time_point start = Clock::now();
+		double residual = 0.0;
+
+		for ( int s = 0; s < subsets; ++s) {
+			num.assign( voxels, 0.0);
+			den.assign( voxels, 0.0);
+
+			for ( size_t b = s; b < blocks_.size(); b += subsets) {
+				const RowsBlock& block = blocks_[b];
+				file.clear();
+				file.seekg(block.offset);
+
+				size_t done = 0;
+				while (done < block.rows) {
+					// read chunk of rows
+					size_t count = std::min( chunk, block.rows - done);
+					buf.clear();
+					offsets.clear();
+					for ( size_t r = 0; r < count; ++r) {
+						unsigned int n = 0;
+						file.read( (char *)&n, sizeof(unsigned int));
+						if (!file || n == 0 || n > max_row) {
+							std::cerr << "System matrix file " << filename_;
+							std::cerr << " is truncated or corrupted" << std::endl;
+							return false;
+						}
+						size_t pos = buf.size();
+						size_t size = row_size(n) - sizeof(unsigned int);
+						buf.resize(pos + sizeof(unsigned int) + size);
+						memcpy( &buf[pos], &n, sizeof(unsigned int));
+						file.read( &buf[pos + sizeof(unsigned int)], size);
+						if (!file) {
+							std::cerr << "System matrix file " << filename_;
+							std::cerr << " is truncated" << std::endl;
+							return false;
+						}
+						offsets.push_back(pos);
+					}
+					done += count;
+
+					std::fill( ssq.begin(), ssq.end(), 0.0);
+					corr.assign( count, 0.0);
+
+					// forward projection of rows, volume is read only,
+					// rows without length get no correction
+					parallel_for( count, threads,
+						[&]( size_t begin, size_t end, unsigned int t) {
+						for ( size_t r = begin; r < end; ++r) {
+							Row row(&buf[offsets[r]]);
+
+							double proj = 0.0, weight = 0.0;
+							for ( unsigned int k = 0; k < row.n; ++k) {
+								double l = half_to_float(row.lengths[k]);
+								proj += l * volume_[row.voxels[k]];
+								weight += l;
+							}
+							if (weight <= 0.0) {
+								corr[r] = std::numeric_limits<double>::quiet_NaN();
+								continue;
+							}
+
+							double diff = row.value - proj;
+							ssq[t] += diff * diff;
+							corr[r] = diff / weight;
+						}
+					});
+
+					for ( unsigned int t = 0; t < threads; ++t)
+						residual += ssq[t];
+
+					// back projection into one volume, each thread
+					// updates its slab of z planes
+					parallel_for( grid_.nz, threads,
+						[&]( size_t k_begin, size_t k_end, unsigned int) {
+						int v0 = k_begin * plane;
+						int v1 = k_end * plane;
+						for ( size_t r = 0; r < count; ++r) {
+							if (std::isnan(corr[r]))
+								continue;
+
+							Row row(&buf[offsets[r]]);
+							unsigned int begin, end;
+							slab_entries( row.voxels, row.n, v0, v1, begin, end);
+							for ( unsigned int k = begin; k < end; ++k) {
+								double l = half_to_float(row.lengths[k]);
+								num[row.voxels[k]] += l * corr[r];
+								den[row.voxels[k]] += l;
+							}
+						}
+					});
+				}
+			}
+
+			// SART update of the subset
+			for ( size_t v = 0; v < voxels; ++v) {
+				if (den[v] > 0.0)
+					volume_[v] = std::max( volume_[v] + lambda * num[v] / den[v], 0.0);
+			}
+		}
+
+		std::chrono::duration<double> elapsed = Clock::now() - start;
+
+		IterationReport report;
+		report.iteration = iter + 1;
+		report.residual = rows_ ? std::sqrt(residual / rows_) : 0.0;
+		report.seconds = elapsed.count();
+		report.rows_per_second = (elapsed.count() > 0.0) ?
+			rows_ / elapsed.count() : 0.0;
+		reports_.push_back(report);
+
+		std::cout << "Iteration " << report.iteration << ": residual ";
+		std::cout << report.residual << " mm, " << report.rows_per_second;
+		std::cout << " rows/s" << std::endl;
+	}
+
+	return true;
+}
+
+void
+Tomography::save(const char* filename) const
+{
+#ifdef TREC_USE_ROOT
+	double x = grid_.nx * grid_.dx / 2.0;
+	double y = grid_.ny * grid_.dy / 2.0;
+	double z = grid_.nz * grid_.dz / 2.0;
+
+	TFile* file = new TFile( filename, "RECREATE");
+
+	TH3D* volume = new TH3D( "volume", "Relative stopping power",
+		grid_.nx, -x, x, grid_.ny, -y, y, grid_.nz, -z, z);
+
+	for ( int k = 0; k < grid_.nz; ++k) {
+		for ( int j = 0; j < grid_.ny; ++j) {
+			for ( int i = 0; i < grid_.nx; ++i) {
+				double v = volume_[(k * grid_.ny + j) * grid_.nx + i];
+				volume->SetBinContent( i + 1, j + 1, k + 1, v);
+			}
+		}
+	}
+
+	volume->Write();
+	file->Close();
+
+	delete file; // histogram is owned by the file
+#else
+	std::cerr << "Can't save volume into " << filename << ": ";
+	std::cerr << "library is built without ROOT" << std::endl;
+#endif
+}
+
+} // namespace TREC
@@ -29,6 +29,18 @@ namespace TREC {
 Track
 Track::create( double* z, double* f, double* w, int n)
 {
+	// unrolled fits of the common telescopes
+	switch (n) {
+	case 2:
+		return create<2>( z, f, w);
+	case 3:
+		return create<3>( z, f, w);
+	case 4:
+		return create<4>( z, f, w);
+	default:
+		break;
+	}
+
 	double c0, c1, cov00, cov01, cov11, chisq;
 	gsl_fit_wlinear( z, 1, w, 1, f, 1, n, 
 		&c0, &c1, &cov00, &cov01, &cov11, &chisq);
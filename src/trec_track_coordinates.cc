@@ -17,12 +17,14 @@
  * 
  */
 
-#include <G4SystemOfUnits.hh>
 #include <algorithm>
 #include <functional>
 #include <numeric>
+#include <cmath>
 
+#include "trec_units.hh"
 #include "trec_constants.hh"
+#include "trec_metrics.hh"
 #include "trec_track_coordinates.hh"
 
 namespace {
@@ -30,115 +32,164 @@ namespace {
 const std::pair< bool, bool> pair_ok( true, true);
 
 // one-strip cluster sigma^2 = pitch^2 / 12
-const double sigma_xy1 = 57.735 * CLHEP::um; // sigma on 1 module (Y1-X1 planes) in (um) 
-const double sigma_xy2 = 94.0 * CLHEP::um; // sigma on 2 module (Y2-X2 planes) in (um) 
-const double sigma_xy3 = 1000.0 * CLHEP::um; // sigma on 3 module (Y3-X3 planes) in (um) 
+const double sigma_xy1 = 57.735 * TREC::units::um; // sigma on 1 module (Y1-X1 planes) in (um) 
+const double sigma_xy2 = 94.0 * TREC::units::um; // sigma on 2 module (Y2-X2 planes) in (um) 
+const double sigma_xy3 = 1000.0 * TREC::units::um; // sigma on 3 module (Y3-X3 planes) in (um) 
+
+/** Sigma of the station, stations behind XY3 have the same sigma
+ * @param station - station index from 0
+ */
+double
+station_sigma(int station)
+{
+	return (station == 0) ? sigma_xy1 : (station == 1) ? sigma_xy2 : sigma_xy3;
+}
 
 } // namespace
 
 namespace TREC {
 
 TrackCoordinates::TrackCoordinates(const HitsPositions& hits_positions)
-	:
-	xy1_(std::make_pair( 0.0, 0.0)),
-	xy1_ok_(std::make_pair( false, false)),
-	xy2_(std::make_pair( 0.0, 0.0)),
-	xy2_ok_(std::make_pair( false, false)),
-	xy3_(std::make_pair( 0.0, 0.0)),
-	xy3_ok_(std::make_pair( false, false))
 {
+	for ( int s = 0; s < TREC_NUMBER_OF_STATIONS; ++s) {
+		xy_[s] = std::make_pair( 0.0, 0.0);
+		xy_ok_[s] = std::make_pair( false, false);
+	}
 	calculate_coordinates(hits_positions);
 }
 
+TrackCoordinates::TrackCoordinates(const TrackCoordinates& src)
+	:
+	main_track_(src.main_track_),
+	full_track_(src.full_track_)
+{
+	std::copy( src.xy_, src.xy_ + TREC_NUMBER_OF_STATIONS, xy_);
+	std::copy( src.xy_ok_, src.xy_ok_ + TREC_NUMBER_OF_STATIONS, xy_ok_);
+}
+
+TrackCoordinates&
+TrackCoordinates::operator=(const TrackCoordinates& src)
+{
+	std::copy( src.xy_, src.xy_ + TREC_NUMBER_OF_STATIONS, xy_);
+	std::copy( src.xy_ok_, src.xy_ok_ + TREC_NUMBER_OF_STATIONS, xy_ok_);
+	main_track_ = src.main_track_;
+	full_track_ = src.full_track_;
+	return *this;
+}
+
 void
 TrackCoordinates::calculate_coordinates(const HitsPositions& hits)
 {
+	StageTimer timer(STAGE_CLUSTER);
+
 	const StripsNumbersMap& si = hits.strips_numbers_;
 
 	for ( StripsNumbersMap::const_iterator it = si.begin();
 		it != si.end(); ++it) {
 		HitsVector si_plane_hits = hits.numbers_2_hits(it->first);
 
-		int res = find_coordinate( it->first, si_plane_hits);
-		if (res == -1) {
-			; // Can't finding coordinates in silicon detector
-		}
+		// rejections of the planes are counted by find_coordinate
+		find_coordinate( it->first, si_plane_hits);
 	}
+
+	for ( int s = 0; s < TREC_NUMBER_OF_STATIONS; ++s)
+		correct_rotation(s);
+}
+
+void
+TrackCoordinates::correct_rotation(int station)
+{
+	if (xy_ok_[station] != pair_ok)
+		return;
+
+	std::pair< double, double>& xy = xy_[station];
+	const PlaneTransform* tx = StripGeometry::transform(station_plane( station + 1, false));
+	const PlaneTransform* ty = StripGeometry::transform(station_plane( station + 1, true));
+	if (tx->sin_angle == 0.0 && ty->sin_angle == 0.0)
+		return;
+
+	// measured: u = x * cos_x + y * sin_x, v = y * cos_y - x * sin_y
+	double u = xy.first, v = xy.second;
+	double det = tx->cos_angle * ty->cos_angle + tx->sin_angle * ty->sin_angle;
+	xy.first = (ty->cos_angle * u - tx->sin_angle * v) / det;
+	xy.second = (tx->cos_angle * v + ty->sin_angle * u) / det;
 }
 
 int
 TrackCoordinates::find_coordinate( StripGeometryType type,
 	const HitsVector& plane_hits)
 {
+	typedef int (TrackCoordinates::*Finder)(const HitsVector&);
+
+	// in the planes index order
+	static const Finder finders[TREC_NUMBER_OF_SILICON_DETECTORS] = {
+		&TrackCoordinates::find_coordinate<MSD_Y1>,
+		&TrackCoordinates::find_coordinate<MSD_X1>,
+		&TrackCoordinates::find_coordinate<MSD_Y2>,
+		&TrackCoordinates::find_coordinate<MSD_X2>,
+		&TrackCoordinates::find_coordinate<MSD_Y3>,
+		&TrackCoordinates::find_coordinate<MSD_X3>,
+		&TrackCoordinates::find_coordinate<MSD__U>,
+		&TrackCoordinates::find_coordinate<MSD__V>
+#if TREC_NUMBER_OF_STATIONS > 3
+		,
+		&TrackCoordinates::find_coordinate<MSD_Y4>,
+		&TrackCoordinates::find_coordinate<MSD_X4>
+#endif
+	};
+
+	int i = StripGeometry::index(type);
+	return (i != -1) ? (this->*finders[i])(plane_hits) : -1;
+}
+
+template <StripGeometryType T>
+int
+TrackCoordinates::find_coordinate(const HitsVector& plane_hits)
+{
+	typedef PlaneTraits<T> Traits;
+
+	if (Traits::station == 0)
+		return -1; // U and V planes aren't used in tracks
+
 	double v = 0;
 	int res = 0;
 
-	const StripGeometry* geom = StripGeometry::get(type);
-
-	HitsVector::const_iterator begin, end, it;
+	HitsVector::const_iterator begin, end;
 	res = check_one_cluster( plane_hits, begin, end);
 	if (!res) {
+		const PlaneTransform* t = StripGeometry::transform<T>();
+
+		double pos;
 		if (end == plane_hits.begin()) {
 			// one strip cluster
-			unsigned int pos = std::distance( plane_hits.begin(), begin);
-			v = -geom->x // half on detector size
-				+ pos * geom->pitch // strips shift
-				+ geom->pitch / 2.0 // half strip offset
-				+ geom->dx; // detector offset
+			pos = std::distance( plane_hits.begin(), begin);
 		}
 		else {
-			// one multistrip cluster
-			for ( it = begin; it != end; ++it) {
-				unsigned int pos = std::distance( plane_hits.begin(), it);
-				v += -geom->x // half on detector size
-					+ pos * geom->pitch // strips shift
-					+ geom->pitch / 2.0 // half strip offset
-					+ geom->dx; // detector offset
-			}
-			v /= std::distance( begin, end);
+			// one multistrip cluster, center of the strips
+			double first = std::distance( plane_hits.begin(), begin);
+			double last = std::distance( plane_hits.begin(), end) - 1;
+			pos = (first + last) / 2.0;
 		}
+		v = Traits::sign * (t->origin + pos * t->pitch);
 	}
-	else if (res == 1) {
-		// no energy in detector bigger than threshold
-		// just skip, exit from function
-		;
-	}
-	else if (res == -1) {
-		// error: something went completely wrong
-		;
+	else if (ThreadMetrics* metrics = Metrics::current()) {
+		// 1: no energy in detector bigger than threshold,
+		// -1: two or more clusters
+		metrics->reject( T, (res == 1) ? REJECT_NO_HITS : REJECT_CLUSTERS);
 	}
 
 	if (!res) {
-		switch (type) {
-		case MSD_X1:
-			xy1_.first = v;
-			xy1_ok_.first = true;
-			break;
-		case MSD_Y1:
-			xy1_.second = -v;
-			xy1_ok_.second = true;
-			break;
-		case MSD_X2:
-			xy2_.first = v;
-			xy2_ok_.first = true;
-			break;
-		case MSD_Y2:
-			xy2_.second = -v;
-			xy2_ok_.second = true;
-			break;
-		case MSD_X3:
-			xy3_.first = v;
-			xy3_ok_.first = true;
-			break;
-		case MSD_Y3:
-			xy3_.second = -v;
-			xy3_ok_.second = true;
-			break;
-		case MSD__U:
-		case MSD__V:
-		default:
-			res = -1;
-			break;
+		const int s = (Traits::station > 0) ? Traits::station - 1 : 0;
+		std::pair< double, double>& xy = xy_[s];
+		std::pair< bool, bool>& ok = xy_ok_[s];
+
+		if (Traits::y_axis) {
+			xy.second = v;
+			ok.second = true;
+		}
+		else {
+			xy.first = v;
+			ok.first = true;
 		}
 	}
 	return res;
@@ -146,7 +197,7 @@ TrackCoordinates::find_coordinate( StripGeometryType type,
 
 int
 TrackCoordinates::check_one_cluster( const HitsVector& plane_hits,
-	HitsVector::const_iterator& begin, HitsVector::const_iterator& end) const
+	HitsVector::const_iterator& begin, HitsVector::const_iterator& end)
 {
 	unsigned int values = std::accumulate( plane_hits.begin(), plane_hits.end(), 0);
 
@@ -219,27 +270,58 @@ TrackCoordinates::check_one_cluster( const HitsVector& plane_hits,
 void
 TrackCoordinates::calculate_tracks( bool& track_main, bool& track_full)
 {
+	fit_tracks( track_main, track_full);
+	gate_tracks(track_full);
+}
+
+void
+TrackCoordinates::fit_tracks( bool& track_main, bool& track_full)
+{
+	StageTimer timer(STAGE_FIT);
+	ThreadMetrics* metrics = Metrics::current();
+
 	track_main = false;
 	track_full = false;
 
-	if (xy1_ok_ == pair_ok && xy2_ok_ == pair_ok) {
+	int stations = 0;
+	while (stations < TREC_NUMBER_OF_STATIONS && xy_ok_[stations] == pair_ok)
+		++stations;
+
+	if (stations >= 2) {
 		track_main = true;
 		calculate_main_track(true); // Y track
 		calculate_main_track(false); // X track
 	}
-	if (xy1_ok_ == pair_ok && xy2_ok_ == pair_ok && xy3_ok_ == pair_ok) {
+	if (stations == TREC_NUMBER_OF_STATIONS) {
+		track_full = true;
 		calculate_full_track(true); // Y track
 		calculate_full_track(false); // X track
-		
-		if (check_tracks_within_trajectory()) {
-			// Track within initial trajectory
-			track_full = true;
-		}
-		else {
-			// Track away from initial trajectory
-			;
-		}
 	}
+
+	if (metrics) {
+		metrics->main_tracks += track_main;
+		if (!track_main)
+			metrics->reject(REJECT_NO_MAIN);
+		else if (!track_full)
+			metrics->reject(REJECT_NO_FULL);
+	}
+}
+
+void
+TrackCoordinates::gate_tracks(bool& track_full) const
+{
+	StageTimer timer(STAGE_GATE);
+	ThreadMetrics* metrics = Metrics::current();
+
+	if (track_full && !check_tracks_within_trajectory()) {
+		// Track away from initial trajectory
+		track_full = false;
+		if (metrics)
+			metrics->reject(REJECT_TRAJECTORY);
+	}
+
+	if (metrics)
+		metrics->full_tracks += track_full;
 }
 
 void
@@ -256,14 +338,14 @@ TrackCoordinates::calculate_main_track(bool axis)
 	if (axis) { // x coordinate (um)
 		f1 = StripGeometry::get(MSD_X1);
 		f2 = StripGeometry::get(MSD_X2);
-		f[0] = xy1_.first;
-		f[1] = xy2_.first;
+		f[0] = xy_[0].first;
+		f[1] = xy_[1].first;
 	}
 	else { // y coordinate (um)
 		f1 = StripGeometry::get(MSD_Y1);
 		f2 = StripGeometry::get(MSD_Y2);
-		f[0] = xy1_.second;
-		f[1] = xy2_.second;
+		f[0] = xy_[0].second;
+		f[1] = xy_[1].second;
 	}
 
 	if (f1 && f2) {
@@ -289,63 +371,38 @@ TrackCoordinates::multistrip_cluster_coordinate(
 {
 	// one multistrip cluster
 
-	double v = 0;
-
-	const StripGeometry* geom = StripGeometry::get(type);
+	const PlaneTransform* t = StripGeometry::transform(type);
 
-	for ( HitsVector::const_iterator it = begin; it != end; ++it) {
-		unsigned int pos = std::distance( plane_hits.begin(), it);
-		v += -geom->x // half on detector size
-			+ pos * geom->pitch // strips shift
-			+ geom->pitch / 2.0 // half strip offset
-			+ geom->dx; // detector offset
-	}
-	v /= std::distance( begin, end);
+	double first = std::distance( plane_hits.begin(), begin);
+	double last = std::distance( plane_hits.begin(), end) - 1;
 	
-	return v;
+	return t->origin + (first + last) / 2.0 * t->pitch;
 }
 
 void
 TrackCoordinates::calculate_full_track(bool axis)
 {
+	const int n = TREC_NUMBER_OF_STATIONS;
+
 	Track& full_x = full_track_.first;
 	Track& full_y = full_track_.second;
 
-	double f[3] = {}; // x coord for "true", y for "false"
-	double z[3] = {}; // z coord
-	double w[3] = { sigma_xy1, sigma_xy2, sigma_xy3 }; // sigma
-	const StripGeometry* f1 = 0;
-	const StripGeometry* f2 = 0;
-	const StripGeometry* f3 = 0;
+	double f[n]; // x coord for "true", y for "false"
+	double z[n]; // z coord
+	double w[n]; // sigma
 
-	if (axis) { // x coordinate (um)
-		f1 = StripGeometry::get(MSD_X1);
-		f2 = StripGeometry::get(MSD_X2);
-		f3 = StripGeometry::get(MSD_X3);
-		f[0] = xy1_.first;
-		f[1] = xy2_.first;
-		f[2] = xy3_.first;
+	for ( int s = 0; s < n; ++s) {
+		const PlaneTransform* t = StripGeometry::transform(station_plane( s + 1, !axis));
+		f[s] = axis ? xy_[s].first : xy_[s].second;
+		z[s] = t->z;
+		w[s] = station_sigma(s);
 	}
-	else { // y coordinate (um)
-		f1 = StripGeometry::get(MSD_Y1);
-		f2 = StripGeometry::get(MSD_Y2);
-		f3 = StripGeometry::get(MSD_Y3);
-		f[0] = xy1_.second;
-		f[1] = xy2_.second;
-		f[2] = xy3_.second;
-	}
-	
-	if (f1 && f2 && f3) {
-		z[0] = f1->z;
-		z[1] = f2->z;
-		z[2] = f3->z;
 
-		// GSL least squares fit function
-		if (axis) // x coordinate
-			full_x = Track::create( z, f, w, 3);
-		else // y coordinate
-			full_y = Track::create( z, f, w, 3);
-	}
+	// least squares fit unrolled for the number of stations
+	if (axis) // x coordinate
+		full_x = Track::create<n>( z, f, w);
+	else // y coordinate
+		full_y = Track::create<n>( z, f, w);
 }
 
 bool
@@ -362,8 +419,8 @@ TrackCoordinates::check_tracks_within_trajectory() const
 	double main_y3 = main_y.fit(y3->z);
 
 	// x, y positions in plane XY3 by hit (um)
-	double mx3 = xy3_.first;
-	double my3 = xy3_.second;
+	double mx3 = xy_[2].first;
+	double my3 = xy_[2].second;
 	
 	double dist_x3 = sqrt( (mx3 - main_x3) * (mx3 - main_x3) +
 		(my3 - main_y3) * (my3 - main_y3));
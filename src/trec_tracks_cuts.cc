@@ -0,0 +1,177 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ * 
+ * 
+ */
+
+#include "trec_parallel.hh"
+#include "trec_tracks_cuts.hh"
+
+namespace TREC {
+
+void
+RunningStatistics::merge(const RunningStatistics& src)
+{
+	if (src.n == 0.0)
+		return;
+
+	double total = n + src.n;
+	double delta = src.mean - mean;
+
+	mean += delta * src.n / total;
+	m2 += src.m2 + delta * delta * n * src.n / total;
+	n = total;
+}
+
+TracksCuts::TracksCuts( const ImageBinning& binning,
+	int object_slice_min, int clear_slice_max, double sigmas,
+	SharedConf conf)
+	:
+	conf_(conf),
+	cache_(conf),
+	accumulator_(binning),
+	object_pos_min_(object_slice_min),
+	clear_pos_max_(clear_slice_max),
+	sigmas_(sigmas),
+	rejected_angle_(0),
+	rejected_slice_(0)
+{
+}
+
+void
+TracksCuts::reconstruct( const FullTracksVector& tracks,
+	unsigned int threads)
+{
+	reconstruct( tracks, EventTagsVector(), threads);
+}
+
+void
+TracksCuts::reconstruct( const FullTracksVector& tracks,
+	const EventTagsVector& tags, unsigned int threads)
+{
+	threads = worker_threads(threads);
+	cache_.prepare(tags);
+
+	accumulator_.reset();
+	rejected_angle_ = 0;
+	rejected_slice_ = 0;
+
+	gather( tracks, tags, threads);
+	apply(threads);
+
+	// release the cache
+	std::vector<int>().swap(pixel_);
+	std::vector<float>().swap(angle_x_);
+	std::vector<float>().swap(angle_y_);
+	std::vector<float>().swap(slice_);
+}
+
+void
+TracksCuts::gather( const FullTracksVector& tracks,
+	const EventTagsVector& tags, unsigned int threads)
+{
+	const ImageBinning& binning = accumulator_.binning();
+	size_t size = static_cast<size_t>(binning.pixels()) * VALUES;
+
+	double z_x, z_y;
+	image_plane( z_x, z_y);
+
+	pixel_.resize(tracks.size());
+	angle_x_.resize(tracks.size());
+	angle_y_.resize(tracks.size());
+	slice_.resize(tracks.size());
+
+	std::vector< std::vector<RunningStatistics> > local(threads);
+
+	parallel_for( tracks.size(), threads,
+		[&]( size_t begin, size_t end, unsigned int t) {
+		std::vector<RunningStatistics>& stat = local[t];
+		stat.resize(size);
+
+		for ( size_t i = begin; i < end; ++i) {
+			const Track& full_x = tracks[i].first.first;
+			const Track& full_y = tracks[i].first.second;
+			const int& position = tracks[i].second;
+
+			int pixel = -1;
+			if (position <= clear_pos_max_ && position >= object_pos_min_)
+				pixel = binning.index( full_x.fit(z_x), full_y.fit(z_y));
+
+			pixel_[i] = pixel;
+			angle_x_[i] = full_x.a();
+			angle_y_[i] = full_y.a();
+			slice_[i] = (i < tags.size()) ?
+				cache_.equivalent_slice( position, tags[i]) : position;
+
+			if (pixel == -1)
+				continue;
+
+			RunningStatistics* s = &stat[pixel * VALUES];
+			s[ANGLE_X].add(angle_x_[i]);
+			s[ANGLE_Y].add(angle_y_[i]);
+			s[SLICE].add(slice_[i]);
+		}
+	});
+
+	statistics_.assign( size, RunningStatistics());
+	for ( size_t t = 0; t < local.size(); ++t) {
+		for ( size_t i = 0; i < local[t].size(); ++i)
+			statistics_[i].merge(local[t][i]);
+	}
+}
+
+void
+TracksCuts::apply(unsigned int threads)
+{
+	const ImageBinning& binning = accumulator_.binning();
+
+	std::vector<ImageAccumulator> local( threads, ImageAccumulator(binning));
+	std::vector<size_t> angle( threads, 0);
+	std::vector<size_t> slice( threads, 0);
+
+	parallel_for( pixel_.size(), threads,
+		[&]( size_t begin, size_t end, unsigned int t) {
+		ImageAccumulator& acc = local[t];
+
+		for ( size_t i = begin; i < end; ++i) {
+			int pixel = pixel_[i];
+			if (pixel == -1)
+				continue;
+
+			const RunningStatistics* s = &statistics_[pixel * VALUES];
+			bool ax = s[ANGLE_X].within( angle_x_[i], sigmas_);
+			bool ay = s[ANGLE_Y].within( angle_y_[i], sigmas_);
+
+			if (!(ax && ay)) {
+				angle[t]++;
+				continue;
+			}
+			if (!s[SLICE].within( slice_[i], sigmas_)) {
+				slice[t]++;
+				continue;
+			}
+			acc.add( pixel, conf_->PSET(double(slice_[i])));
+		}
+	});
+
+	for ( size_t t = 0; t < local.size(); ++t) {
+		accumulator_.merge(local[t]);
+		rejected_angle_ += angle[t];
+		rejected_slice_ += slice[t];
+	}
+}
+
+} // namespace TREC
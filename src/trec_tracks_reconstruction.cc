@@ -47,9 +47,7 @@ TracksReconstruction::~TracksReconstruction()
 void
 TracksReconstruction::form_clear_tracks_data(const FullTracksVector& clear_tracks)
 {
-	SharedConf conf = SystemConfigure::instance();
-
-	int calo_slices = conf->calorimeter_slices();
+	int calo_slices = conf_->calorimeter_slices();
 
 	clear_slice_ = new TH1I( "slice_clear", "Slice",
 		calo_slices, 0, calo_slices - 1);
@@ -106,9 +104,7 @@ void
 TracksReconstruction::form_object_tracks_data(
 	const FullTracksVector& full_tracks_clear)
 {
-	SharedConf conf = SystemConfigure::instance();
-
-	int calo_slices = conf->calorimeter_slices();
+	int calo_slices = conf_->calorimeter_slices();
 
 	form_clear_tracks_data(full_tracks_clear);
 
@@ -154,7 +150,7 @@ TracksReconstruction::form_object_tracks_data(
 		double fy = full_y.fit(full_y_z);
 
 //		int pos = clear_pos_max_ - position;
-		double pos = conf->PSET(position);
+		double pos = conf_->PSET(position);
 		object_position_->Fill( fx, fy, pos);
 		object_fluence_->Fill( fx, fy);
 		object_weight_->Fill( fx, fy, w);